@@ -0,0 +1,379 @@
+#include "cost_to_go_grid.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+const float infinite_cost = std::numeric_limits<float>::infinity();
+const int neighbor_cols[8] = {1, -1, 0, 0, 1, 1, -1, -1};
+const int neighbor_rows[8] = {0, 0, 1, -1, 1, -1, 1, -1};
+const size_t num_neighbors = 8;
+
+void CostToGoGrid::SetGrid(double resolution, size_t num_cols, size_t num_rows, double origin_x, double origin_y) {
+  this->resolution = resolution;
+  this->num_cols = num_cols;
+  this->num_rows = num_rows;
+  this->origin_x = origin_x;
+  this->origin_y = origin_y;
+  size_t num_cells = num_cols*num_rows;
+  occupied.assign(num_cells, 0);
+  blocked.assign(num_cells, 0);
+  cost_to_go.assign(num_cells, infinite_cost);
+  one_step_cost.assign(num_cells, infinite_cost);
+  values.assign(num_cells, 0);
+  if (worker_pool) {
+    parallel_cost_to_go.reset(new std::atomic<float>[num_cells]);
+  }
+  bucket_width = 2.0*resolution;
+  rebuild_pending = false;
+  queue = std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> >();
+  has_goal = false;
+  published = false;
+  changed_min_col = changed_min_row = std::numeric_limits<size_t>::max();
+  changed_max_col = changed_max_row = 0;
+  if (inflation_offsets_col.empty()) {
+    SetObstacleInflationRadius(0.5);
+  }
+}
+
+void CostToGoGrid::SetRebuildThreads(size_t num_threads) {
+  if (num_threads == 0) {
+    worker_pool.reset();
+    parallel_cost_to_go.reset();
+    return;
+  }
+  worker_pool.reset(new WorkerPool(num_threads));
+  parallel_cost_to_go.reset(new std::atomic<float>[cost_to_go.size()]);
+  thread_bucket_cells.resize(num_threads);
+  thread_next_bucket_cells.resize(num_threads);
+}
+
+// Applies to obstacle points added afterwards
+void CostToGoGrid::SetObstacleInflationRadius(double meters) {
+  inflation_offsets_col.clear();
+  inflation_offsets_row.clear();
+  int radius_cells = ceil(meters / resolution);
+  for (int row = -radius_cells; row <= radius_cells; row++) {
+    for (int col = -radius_cells; col <= radius_cells; col++) {
+      if ((col*col + row*row)*resolution*resolution <= meters*meters) {
+        inflation_offsets_col.push_back(col);
+        inflation_offsets_row.push_back(row);
+      }
+    }
+  }
+}
+
+bool CostToGoGrid::CellOfPosition(Vector3 const& position_world_frame, size_t &cell) const {
+  double col = floor((position_world_frame(0) - origin_x) / resolution);
+  double row = floor((position_world_frame(1) - origin_y) / resolution);
+  if (!(col >= 0.0 && col < num_cols && row >= 0.0 && row < num_rows)) {
+    return false;
+  }
+  cell = (size_t)row*num_cols + (size_t)col;
+  return true;
+}
+
+void CostToGoGrid::AddObstaclePoints(Eigen::Matrix<Scalar, 3, Eigen::Dynamic> const& points_world_frame) {
+  for (size_t i = 0; i < (size_t)points_world_frame.cols(); i++) {
+    size_t cell;
+    if (!CellOfPosition(points_world_frame.col(i), cell) || occupied[cell]) {
+      continue;
+    }
+    occupied[cell] = 1;
+    int col = cell % num_cols;
+    int row = cell / num_cols;
+    for (size_t j = 0; j < inflation_offsets_col.size(); j++) {
+      int inflated_col = col + inflation_offsets_col[j];
+      int inflated_row = row + inflation_offsets_row[j];
+      if (inflated_col >= 0 && inflated_col < (int)num_cols && inflated_row >= 0 && inflated_row < (int)num_rows) {
+        BlockCell(inflated_row*num_cols + inflated_col);
+      }
+    }
+  }
+}
+
+// A goal outside the grid is moved to the nearest cell on its border.  Moving the goal changes the
+// cost of nearly every cell, and repairing that expands each cell twice (once to raise it, once to
+// lower it), so the field is instead rebuilt from the new goal.
+void CostToGoGrid::SetGoal(Vector3 const& goal_world_frame) {
+  double col = std::min(std::max(floor((goal_world_frame(0) - origin_x) / resolution), 0.0), num_cols - 1.0);
+  double row = std::min(std::max(floor((goal_world_frame(1) - origin_y) / resolution), 0.0), num_rows - 1.0);
+  size_t new_goal_cell = (size_t)row*num_cols + (size_t)col;
+  if (has_goal && new_goal_cell == goal_cell) {
+    return;
+  }
+  if (has_goal) {
+    cost_to_go.assign(cost_to_go.size(), infinite_cost);
+    one_step_cost.assign(one_step_cost.size(), infinite_cost);
+    queue = std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> >();
+    values.assign(values.size(), 0);
+    changed_min_col = changed_min_row = 0;
+    changed_max_col = num_cols - 1;
+    changed_max_row = num_rows - 1;
+  }
+  goal_cell = new_goal_cell;
+  has_goal = true;
+  one_step_cost[goal_cell] = 0.0;
+  queue.push(QueueEntry(0.0, goal_cell));
+  rebuild_pending = true;
+}
+
+// Cells are expanded in order of min(cost_to_go, one_step_cost).  A cell whose cost dropped settles
+// and offers the lower cost to its neighbors; a cell whose cost rose is reset to infinity and its
+// neighbors recompute theirs, so the rise only spreads through cells that depended on it.
+void CostToGoGrid::ComputeCostToGo(size_t max_cells_expanded) {
+  num_cells_expanded = 0;
+  if (rebuild_pending && worker_pool) {
+    RebuildCostToGoParallel();
+  }
+  rebuild_pending = false;
+  while (!queue.empty() && (max_cells_expanded == 0 || num_cells_expanded < max_cells_expanded)) {
+    QueueEntry entry = queue.top();
+    queue.pop();
+    size_t cell = entry.second;
+    float cell_cost_to_go = cost_to_go[cell];
+    float cell_one_step_cost = one_step_cost[cell];
+    if (cell_cost_to_go == cell_one_step_cost || entry.first != std::min(cell_cost_to_go, cell_one_step_cost)) {
+      continue;
+    }
+    num_cells_expanded++;
+    int col = cell % num_cols;
+    int row = cell / num_cols;
+    if (cell_cost_to_go > cell_one_step_cost) {
+      cost_to_go[cell] = cell_one_step_cost;
+      UpdateValue(cell);
+      for (size_t k = 0; k < num_neighbors; k++) {
+        int neighbor_col = col + neighbor_cols[k];
+        int neighbor_row = row + neighbor_rows[k];
+        if (neighbor_col < 0 || neighbor_col >= (int)num_cols || neighbor_row < 0 || neighbor_row >= (int)num_rows) {
+          continue;
+        }
+        size_t neighbor = neighbor_row*num_cols + neighbor_col;
+        float cost = cell_one_step_cost + EdgeCost(cell, neighbor, k);
+        if (cost < one_step_cost[neighbor] && !(has_goal && neighbor == goal_cell)) {
+          one_step_cost[neighbor] = cost;
+          queue.push(QueueEntry(std::min(cost_to_go[neighbor], cost), neighbor));
+        }
+      }
+    }
+    else {
+      cost_to_go[cell] = infinite_cost;
+      UpdateValue(cell);
+      UpdateCell(cell);
+      for (size_t k = 0; k < num_neighbors; k++) {
+        int neighbor_col = col + neighbor_cols[k];
+        int neighbor_row = row + neighbor_rows[k];
+        if (neighbor_col >= 0 && neighbor_col < (int)num_cols && neighbor_row >= 0 && neighbor_row < (int)num_rows) {
+          UpdateCell(neighbor_row*num_cols + neighbor_col);
+        }
+      }
+    }
+  }
+}
+
+void CostToGoGrid::PublishValues(ValueGridEvaluator &value_grid_evaluator) {
+  if (!published) {
+    value_grid_evaluator.SetValueGrid(resolution, num_cols, num_rows, origin_x, origin_y, values);
+    published = true;
+  }
+  else if (changed_min_col <= changed_max_col) {
+    size_t region_cols, region_rows;
+    CopyChangedRegionValues(region_cols, region_rows);
+    value_grid_evaluator.UpdateValueGridRegion(changed_min_col, changed_min_row, region_cols, region_rows, region_values);
+  }
+  changed_min_col = changed_min_row = std::numeric_limits<size_t>::max();
+  changed_max_col = changed_max_row = 0;
+}
+
+bool CostToGoGrid::PublishValues(ValueVolume &value_volume, double min_z, double max_z) {
+  if (!published) {
+    changed_min_col = changed_min_row = 0;
+    changed_max_col = num_cols - 1;
+    changed_max_row = num_rows - 1;
+    published = true;
+  }
+  bool changed = (changed_min_col <= changed_max_col);
+  if (changed) {
+    size_t region_cols, region_rows;
+    CopyChangedRegionValues(region_cols, region_rows);
+    value_volume.SetValuesOfColumns(origin_x + (changed_min_col + 0.5)*resolution, origin_y + (changed_min_row + 0.5)*resolution,
+                                    region_cols, region_rows, region_values, min_z, max_z);
+  }
+  changed_min_col = changed_min_row = std::numeric_limits<size_t>::max();
+  changed_max_col = changed_max_row = 0;
+  return changed;
+}
+
+void CostToGoGrid::CopyChangedRegionValues(size_t &region_cols, size_t &region_rows) {
+  region_cols = changed_max_col - changed_min_col + 1;
+  region_rows = changed_max_row - changed_min_row + 1;
+  region_values.resize(region_cols*region_rows);
+  for (size_t row = 0; row < region_rows; row++) {
+    std::vector<int8_t>::const_iterator row_begin = values.begin() + (changed_min_row + row)*num_cols + changed_min_col;
+    std::copy(row_begin, row_begin + region_cols, region_values.begin() + row*region_cols);
+  }
+}
+
+double CostToGoGrid::getCostToGo(Vector3 const& position_world_frame) const {
+  size_t cell;
+  if (!CellOfPosition(position_world_frame, cell)) {
+    return infinite_cost;
+  }
+  return cost_to_go[cell];
+}
+
+// Blocked cells cannot be entered or left, and diagonal steps may not cut a blocked corner
+float CostToGoGrid::EdgeCost(size_t from_cell, size_t to_cell, size_t neighbor_index) const {
+  if (blocked[from_cell] || blocked[to_cell]) {
+    return infinite_cost;
+  }
+  int col_step = neighbor_cols[neighbor_index];
+  int row_step = neighbor_rows[neighbor_index];
+  if (col_step != 0 && row_step != 0) {
+    if (blocked[from_cell + col_step] || blocked[from_cell + row_step*(int)num_cols]) {
+      return infinite_cost;
+    }
+    return M_SQRT2*resolution;
+  }
+  return resolution;
+}
+
+// Recomputes one_step_cost from the neighbors and queues the cell if it is now inconsistent
+void CostToGoGrid::UpdateCell(size_t cell) {
+  if (!(has_goal && cell == goal_cell)) {
+    int col = cell % num_cols;
+    int row = cell / num_cols;
+    float cost = infinite_cost;
+    for (size_t k = 0; k < num_neighbors; k++) {
+      int neighbor_col = col + neighbor_cols[k];
+      int neighbor_row = row + neighbor_rows[k];
+      if (neighbor_col >= 0 && neighbor_col < (int)num_cols && neighbor_row >= 0 && neighbor_row < (int)num_rows) {
+        size_t neighbor = neighbor_row*num_cols + neighbor_col;
+        cost = std::min(cost, cost_to_go[neighbor] + EdgeCost(cell, neighbor, k));
+      }
+    }
+    one_step_cost[cell] = cost;
+  }
+  if (cost_to_go[cell] != one_step_cost[cell]) {
+    queue.push(QueueEntry(std::min(cost_to_go[cell], one_step_cost[cell]), cell));
+  }
+}
+
+void CostToGoGrid::UpdateValue(size_t cell) {
+  float cost = cost_to_go[cell];
+  int8_t value = 0;
+  if (cost > 0.0 && cost < infinite_cost) {
+    value = std::min(std::max(ceil(cost / meters_per_value), 1.0), 127.0);
+  }
+  if (value == values[cell]) {
+    return;
+  }
+  values[cell] = value;
+  size_t col = cell % num_cols;
+  size_t row = cell / num_cols;
+  changed_min_col = std::min(changed_min_col, col);
+  changed_max_col = std::max(changed_max_col, col);
+  changed_min_row = std::min(changed_min_row, row);
+  changed_max_row = std::max(changed_max_row, row);
+}
+
+void CostToGoGrid::BlockCell(size_t cell) {
+  if (blocked[cell]) {
+    return;
+  }
+  blocked[cell] = 1;
+  UpdateCell(cell);
+  int col = cell % num_cols;
+  int row = cell / num_cols;
+  for (size_t k = 0; k < num_neighbors; k++) {
+    int neighbor_col = col + neighbor_cols[k];
+    int neighbor_row = row + neighbor_rows[k];
+    if (neighbor_col >= 0 && neighbor_col < (int)num_cols && neighbor_row >= 0 && neighbor_row < (int)num_rows) {
+      UpdateCell(neighbor_row*num_cols + neighbor_col);
+    }
+  }
+}
+
+// Rounds with few cells are relaxed on the calling thread, where waking the pool would cost more
+// than the work.  Stale entries, whose cost has since dropped into an earlier bucket, are skipped.
+void CostToGoGrid::RebuildCostToGoParallel() {
+  const size_t min_cells_per_thread = 64;
+  size_t num_threads = worker_pool->getNumThreads();
+  size_t num_cells = cost_to_go.size();
+  for (size_t cell = 0; cell < num_cells; cell++) {
+    parallel_cost_to_go[cell].store(infinite_cost, std::memory_order_relaxed);
+  }
+  parallel_cost_to_go[goal_cell].store(0.0, std::memory_order_relaxed);
+
+  bucket_cells.assign(1, goal_cell);
+  next_bucket_cells.clear();
+  size_t bucket = 0;
+  while (!bucket_cells.empty() || !next_bucket_cells.empty()) {
+    if (bucket_cells.empty()) {
+      bucket_cells.swap(next_bucket_cells);
+      bucket++;
+      continue;
+    }
+    size_t num_round_cells = bucket_cells.size();
+    size_t num_round_threads = std::min(num_threads, std::max<size_t>(1, num_round_cells / min_cells_per_thread));
+    if (num_round_threads == 1) {
+      RelaxBucketCells(0, bucket, 0, num_round_cells);
+    }
+    else {
+      worker_pool->Run([this, bucket, num_round_cells, num_round_threads](size_t thread_index) {
+        if (thread_index < num_round_threads) {
+          RelaxBucketCells(thread_index, bucket, num_round_cells*thread_index/num_round_threads, num_round_cells*(thread_index + 1)/num_round_threads);
+        }
+      });
+    }
+    bucket_cells.clear();
+    for (size_t thread_index = 0; thread_index < num_round_threads; thread_index++) {
+      bucket_cells.insert(bucket_cells.end(), thread_bucket_cells[thread_index].begin(), thread_bucket_cells[thread_index].end());
+      next_bucket_cells.insert(next_bucket_cells.end(), thread_next_bucket_cells[thread_index].begin(), thread_next_bucket_cells[thread_index].end());
+    }
+  }
+
+  // The solution satisfies one_step_cost == cost_to_go everywhere, so the incremental queue starts empty
+  worker_pool->Run([this, num_threads, num_cells](size_t thread_index) {
+    for (size_t cell = num_cells*thread_index/num_threads; cell < num_cells*(thread_index + 1)/num_threads; cell++) {
+      cost_to_go[cell] = parallel_cost_to_go[cell].load(std::memory_order_relaxed);
+      one_step_cost[cell] = cost_to_go[cell];
+    }
+  });
+  for (size_t cell = 0; cell < num_cells; cell++) {
+    UpdateValue(cell);
+  }
+  queue = std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> >();
+}
+
+void CostToGoGrid::RelaxBucketCells(size_t thread_index, size_t bucket, size_t begin, size_t end) {
+  std::vector<uint32_t> &same_bucket_cells = thread_bucket_cells[thread_index];
+  std::vector<uint32_t> &later_bucket_cells = thread_next_bucket_cells[thread_index];
+  same_bucket_cells.clear();
+  later_bucket_cells.clear();
+  for (size_t i = begin; i < end; i++) {
+    size_t cell = bucket_cells[i];
+    float cell_cost = parallel_cost_to_go[cell].load(std::memory_order_relaxed);
+    if (Bucket(cell_cost) != bucket) {
+      continue;
+    }
+    int col = cell % num_cols;
+    int row = cell / num_cols;
+    for (size_t k = 0; k < num_neighbors; k++) {
+      int neighbor_col = col + neighbor_cols[k];
+      int neighbor_row = row + neighbor_rows[k];
+      if (neighbor_col < 0 || neighbor_col >= (int)num_cols || neighbor_row < 0 || neighbor_row >= (int)num_rows) {
+        continue;
+      }
+      size_t neighbor = neighbor_row*num_cols + neighbor_col;
+      float cost = cell_cost + EdgeCost(cell, neighbor, k);
+      float neighbor_cost = parallel_cost_to_go[neighbor].load(std::memory_order_relaxed);
+      while (cost < neighbor_cost) {
+        if (parallel_cost_to_go[neighbor].compare_exchange_weak(neighbor_cost, cost, std::memory_order_relaxed)) {
+          (Bucket(cost) == bucket ? same_bucket_cells : later_bucket_cells).push_back(neighbor);
+          break;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef COST_TO_GO_GRID_H
+#define COST_TO_GO_GRID_H
+
+#include "value_grid_evaluator.h"
+#include "worker_pool.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+// Onboard cost-to-go field over a world frame grid, for the Dijkstra objective.  Obstacle points
+// accumulate into an inflated occupancy grid and the field is kept consistent with it and the goal
+// by incremental repair (LPA* without a heuristic, since every cell's cost is needed): only cells
+// whose cost depends on a changed cell are expanded.
+//
+// A moved goal changes nearly every cell, so the field is rebuilt instead, optionally in parallel
+// with a bucket queue (delta-stepping with buckets wider than any step, so a bucket only feeds
+// itself and the next one): each round the cells of the current bucket are relaxed in parallel,
+// lowering neighbor costs with an atomic min.
+//
+// Values follow the ValueGrid convention of the Dijkstra objective: 0 for the goal and for blocked
+// or unreachable cells, otherwise the cost-to-go in units of meters_per_value, clamped to [1, 127].
+class CostToGoGrid {
+public:
+
+  CostToGoGrid() {
+    SetGrid(0.2, 500, 500, -50.0, -50.0);
+  };
+
+  // Clears obstacles, goal and costs
+  void SetGrid(double resolution, size_t num_cols, size_t num_rows, double origin_x, double origin_y);
+  void SetObstacleInflationRadius(double meters);
+  void SetMetersPerValue(double meters_per_value) {
+    this->meters_per_value = meters_per_value;
+  };
+  // Threads for rebuilding after a goal change; 0 rebuilds serially through the incremental queue
+  void SetRebuildThreads(size_t num_threads);
+
+  // Points outside the grid are ignored
+  void AddObstaclePoints(Eigen::Matrix<Scalar, 3, Eigen::Dynamic> const& points_world_frame);
+  void SetGoal(Vector3 const& goal_world_frame);
+
+  // Repairs the cells affected by obstacle and goal changes since the last call.  With a nonzero
+  // limit it may stop early, leaving the farthest changed cells for the next call; a parallel
+  // rebuild always runs to completion.
+  void ComputeCostToGo(size_t max_cells_expanded = 0);
+  bool IsComplete() const {return queue.empty();};
+  // The full grid the first time, afterwards only the block of values that changed
+  void PublishValues(ValueGridEvaluator &value_grid_evaluator);
+  // The same into the voxels of a volume at the grid's resolution whose centers lie in [min_z, max_z),
+  // for a grid that publishes nowhere else; returns whether anything was written
+  bool PublishValues(ValueVolume &value_volume, double min_z, double max_z);
+
+  double getCostToGo(Vector3 const& position_world_frame) const;
+  size_t getNumCellsExpanded() const {return num_cells_expanded;};
+
+private:
+  typedef std::pair<float, uint32_t> QueueEntry;
+
+  bool CellOfPosition(Vector3 const& position_world_frame, size_t &cell) const;
+  float EdgeCost(size_t from_cell, size_t to_cell, size_t neighbor_index) const;
+  void UpdateCell(size_t cell);
+  void UpdateValue(size_t cell);
+  void BlockCell(size_t cell);
+  void RebuildCostToGoParallel();
+  void RelaxBucketCells(size_t thread_index, size_t bucket, size_t begin, size_t end);
+  size_t Bucket(float cost) const {return cost / bucket_width;};
+  void CopyChangedRegionValues(size_t &region_cols, size_t &region_rows);
+
+  double resolution;
+  size_t num_cols;
+  size_t num_rows;
+  double origin_x;
+  double origin_y;
+  double meters_per_value = 0.5;
+
+  std::vector<int> inflation_offsets_col;
+  std::vector<int> inflation_offsets_row;
+
+  std::vector<uint8_t> occupied;
+  std::vector<uint8_t> blocked;
+  std::vector<float> cost_to_go;      // g
+  std::vector<float> one_step_cost;   // rhs, lookahead from the neighbors' cost_to_go
+  std::vector<int8_t> values;
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > queue;
+
+  std::unique_ptr<WorkerPool> worker_pool;
+  std::unique_ptr<std::atomic<float>[]> parallel_cost_to_go;
+  float bucket_width;
+  std::vector<uint32_t> bucket_cells;
+  std::vector<uint32_t> next_bucket_cells;
+  std::vector<std::vector<uint32_t> > thread_bucket_cells;
+  std::vector<std::vector<uint32_t> > thread_next_bucket_cells;
+  bool rebuild_pending = false;
+
+  bool has_goal = false;
+  size_t goal_cell = 0;
+  size_t num_cells_expanded = 0;
+
+  bool published = false;
+  size_t changed_min_col, changed_max_col, changed_min_row, changed_max_row;
+  std::vector<int8_t> region_values;
+
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "cost_to_go_volume.h"
+
+#include <math.h>
+
+void CostToGoVolume::SetLayers(double resolution, size_t num_cols, size_t num_rows, double origin_x, double origin_y,
+                               double lowest_altitude, double layer_spacing, size_t num_layers) {
+  this->lowest_altitude = lowest_altitude;
+  this->layer_spacing = layer_spacing;
+  layers.resize(num_layers);
+  for (size_t i = 0; i < num_layers; i++) {
+    if (!layers[i]) {
+      layers[i].reset(new CostToGoGrid());
+    }
+    layers[i]->SetGrid(resolution, num_cols, num_rows, origin_x, origin_y);
+  }
+
+  // Enough blocks for every layer, so none is recycled
+  size_t num_block_layers = ceil(num_layers*layer_spacing / resolution / 8.0) + 2;
+  value_volume.SetResolution(resolution);
+  value_volume.SetMaxNumBlocks((num_cols/8 + 2)*(num_rows/8 + 2)*num_block_layers);
+}
+
+void CostToGoVolume::SetObstacleInflationRadius(double meters) {
+  for (auto& layer : layers) {
+    layer->SetObstacleInflationRadius(meters);
+  }
+}
+
+void CostToGoVolume::SetMetersPerValue(double meters_per_value) {
+  for (auto& layer : layers) {
+    layer->SetMetersPerValue(meters_per_value);
+  }
+}
+
+void CostToGoVolume::SetRebuildThreads(size_t num_threads) {
+  for (auto& layer : layers) {
+    layer->SetRebuildThreads(num_threads);
+  }
+}
+
+void CostToGoVolume::AddObstaclePoints(Eigen::Matrix<Scalar, 3, Eigen::Dynamic> const& points_world_frame) {
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic> layer_points(3, points_world_frame.cols());
+  for (size_t layer_index = 0; layer_index < layers.size(); layer_index++) {
+    double altitude = getLayerAltitude(layer_index);
+    size_t num_points = 0;
+    for (size_t i = 0; i < (size_t)points_world_frame.cols(); i++) {
+      double z = points_world_frame(2, i) - altitude;
+      if (z >= obstacle_min_z && z <= obstacle_max_z) {
+        layer_points.col(num_points++) = points_world_frame.col(i);
+      }
+    }
+    if (num_points > 0) {
+      layers[layer_index]->AddObstaclePoints(layer_points.leftCols(num_points));
+    }
+  }
+}
+
+void CostToGoVolume::SetGoal(Vector3 const& goal_world_frame) {
+  for (auto& layer : layers) {
+    layer->SetGoal(goal_world_frame);
+  }
+}
+
+void CostToGoVolume::ComputeCostToGo(size_t max_cells_expanded) {
+  for (auto& layer : layers) {
+    layer->ComputeCostToGo(max_cells_expanded);
+  }
+}
+
+// Neighboring layers compute their shared border with the same expression, so every voxel in
+// between belongs to exactly one layer
+void CostToGoVolume::PublishValues(ValueGridEvaluator &value_grid_evaluator) {
+  bool value_volume_changed = false;
+  for (size_t layer_index = 0; layer_index < layers.size(); layer_index++) {
+    double min_z = lowest_altitude + (layer_index - 0.5)*layer_spacing;
+    double max_z = lowest_altitude + (layer_index + 0.5)*layer_spacing;
+    if (layers[layer_index]->PublishValues(value_volume, min_z, max_z)) {
+      value_volume_changed = true;
+    }
+  }
+  if (value_volume_changed) {
+    value_grid_evaluator.SetValueVolume(std::make_shared<ValueVolume const>(value_volume));
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef COST_TO_GO_VOLUME_H
+#define COST_TO_GO_VOLUME_H
+
+#include "cost_to_go_grid.h"
+
+#include <memory>
+#include <vector>
+
+// Onboard cost-to-go for the 3D library: one CostToGoGrid per altitude layer, each fed only the
+// obstacle points in its own height band, written into a ValueVolume the layer's thickness deep.
+// A motion that climbs or descends then reads the cost-to-go of the layer it reaches, so walls that
+// only span some altitudes stop blocking the layers above or below them.
+//
+// Layers are repaired and written incrementally like the planar grid.  Publishing hands the planner
+// a copy of the volume, since readers hold the previous one while they score motions.
+class CostToGoVolume {
+public:
+
+  CostToGoVolume() {
+    SetLayers(0.2, 500, 500, -50.0, -50.0, 1.2, 0.5, 1);
+  };
+
+  // Clears every layer.  Layer i is centered on lowest_altitude + i*layer_spacing and is
+  // layer_spacing thick; the volume's voxels are the grids' cells
+  void SetLayers(double resolution, size_t num_cols, size_t num_rows, double origin_x, double origin_y,
+                 double lowest_altitude, double layer_spacing, size_t num_layers);
+  void SetObstacleInflationRadius(double meters);
+  void SetMetersPerValue(double meters_per_value);
+  void SetRebuildThreads(size_t num_threads);
+  // Height band around each layer's altitude whose points become obstacles in that layer
+  void SetObstacleBand(double min_z, double max_z) {
+    obstacle_min_z = min_z;
+    obstacle_max_z = max_z;
+  };
+
+  // Points outside the grid or every layer's band are ignored
+  void AddObstaclePoints(Eigen::Matrix<Scalar, 3, Eigen::Dynamic> const& points_world_frame);
+  // Every layer's goal is the goal's column
+  void SetGoal(Vector3 const& goal_world_frame);
+  // The limit applies to each layer
+  void ComputeCostToGo(size_t max_cells_expanded = 0);
+  // Sets a copy of the volume if any layer changed since the last call
+  void PublishValues(ValueGridEvaluator &value_grid_evaluator);
+
+  size_t getNumLayers() const {return layers.size();};
+  double getLayerAltitude(size_t layer_index) const {return lowest_altitude + layer_index*layer_spacing;};
+  ValueVolume const& getValueVolume() const {return value_volume;};
+
+private:
+  double lowest_altitude;
+  double layer_spacing;
+  double obstacle_min_z = -0.3;
+  double obstacle_max_z = 0.3;
+
+  std::vector<std::unique_ptr<CostToGoGrid> > layers;
+  ValueVolume value_volume;
+
+};
+
+#endif
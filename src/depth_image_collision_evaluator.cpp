@@ -2,14 +2,187 @@
 
 #define num_nearest_neighbors 1
 
+#define DEPTH_IMAGE_SOURCE_MASK (1u << DEPTH_IMAGE_SOURCE)
+#define LASER_SOURCE_MASK (1u << LASER_SOURCE)
+#define LASER_OFF_PLANE_SOURCE_MASK (1u << LASER_OFF_PLANE_SOURCE)
+
+void DepthImageCollisionEvaluator::SetCameraModel(double fx, double fy, double cx, double cy, size_t width, size_t height, double decimation) {
+  K_full_resolution << fx, 0.0, cx, 0.0, fy, cy, 0.0, 0.0, 1.0;
+  num_x_pixels_full_resolution = width;
+  num_y_pixels_full_resolution = height;
+  depth_image_decimation = decimation;
+  SetDepthPyramidLevel(depth_pyramid_level);
+}
+
+void DepthImageCollisionEvaluator::SetDepthPyramidSpeeds(std::vector<double> const& depth_pyramid_speeds) {
+  this->depth_pyramid_speeds = depth_pyramid_speeds;
+  std::sort(this->depth_pyramid_speeds.begin(), this->depth_pyramid_speeds.end());
+}
+
+// Coarser levels at low speed, finer at high speed.  Takes effect with the next depth image so the
+// cloud, KD-tree and camera model always agree.
+void DepthImageCollisionEvaluator::UpdateSpeed(double speed) {
+  size_t level = 0;
+  for (size_t i = 0; i < depth_pyramid_speeds.size(); i++) {
+    if (speed < depth_pyramid_speeds[i]) {
+      level++;
+    }
+  }
+  next_depth_pyramid_level = level;
+}
+
+void DepthImageCollisionEvaluator::SetDepthPyramidLevel(size_t level) {
+  depth_pyramid_level = level;
+  double scale = depth_image_decimation * (1 << level);
+  K = K_full_resolution / scale;
+  K(2,2) = 1.0;
+  num_x_pixels = floor(num_x_pixels_full_resolution / scale);
+  num_y_pixels = floor(num_y_pixels_full_resolution / scale);
+}
+
+// Each pixel of the coarser image keeps the closest valid point of its block, which keeps both the
+// collision and the occlusion checks conservative.
+pcl::PointCloud<pcl::PointXYZ>::Ptr DepthImageCollisionEvaluator::DownsampleDepthImage(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud, size_t level) {
+  size_t block_size = 1 << level;
+  size_t width = xyz_cloud->width / block_size;
+  size_t height = xyz_cloud->height / block_size;
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr downsampled_cloud(new pcl::PointCloud<pcl::PointXYZ>);
+  downsampled_cloud->header = xyz_cloud->header;
+  downsampled_cloud->width = width;
+  downsampled_cloud->height = height;
+  downsampled_cloud->is_dense = false;
+  downsampled_cloud->points.resize(width*height);
+
+  const float NaN = std::numeric_limits<float>::quiet_NaN();
+  for (size_t row = 0; row < height; row++) {
+    for (size_t col = 0; col < width; col++) {
+      pcl::PointXYZ closest_point(NaN, NaN, NaN);
+      float closest_squared_range = std::numeric_limits<float>::max();
+      for (size_t block_row = row*block_size; block_row < (row + 1)*block_size; block_row++) {
+        for (size_t block_col = col*block_size; block_col < (col + 1)*block_size; block_col++) {
+          pcl::PointXYZ const& point = xyz_cloud->points[block_row*xyz_cloud->width + block_col];
+          float squared_range = point.x*point.x + point.y*point.y + point.z*point.z;
+          if (squared_range < closest_squared_range) { // false for NaN points
+            closest_squared_range = squared_range;
+            closest_point = point;
+          }
+        }
+      }
+      downsampled_cloud->points[row*width + col] = closest_point;
+    }
+  }
+  return downsampled_cloud;
+}
+
 void DepthImageCollisionEvaluator::UpdatePointCloudPtr(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new) {
-	xyz_cloud_ptr = xyz_cloud_new;
-  my_kd_tree_depth_image.Initialize(xyz_cloud_ptr);
+  if (next_depth_pyramid_level != depth_pyramid_level) {
+    SetDepthPyramidLevel(next_depth_pyramid_level);
+  }
+  pcl::PointCloud<pcl::PointXYZ>::Ptr previous_cloud_ptr = xyz_cloud_ptr;
+  if (depth_pyramid_level > 0 && xyz_cloud_new->isOrganized()) {
+    xyz_cloud_ptr = DownsampleDepthImage(xyz_cloud_new, depth_pyramid_level);
+  }
+  else {
+    xyz_cloud_ptr = xyz_cloud_new;
+  }
+  RecordObstacleChange(previous_cloud_ptr, xyz_cloud_ptr);
+  my_kd_tree.SetSource(DEPTH_IMAGE_SOURCE, xyz_cloud_ptr);
 }
 
 void DepthImageCollisionEvaluator::UpdateLaserPointCloudPtr(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new) {
+  RecordObstacleChange(xyz_laser_cloud_ptr, xyz_cloud_new);
   xyz_laser_cloud_ptr = xyz_cloud_new;
-  my_kd_tree_laser.Initialize(xyz_laser_cloud_ptr);
+  laser_off_plane_cloud_ptr->points.clear();
+  if (planar_laser) {
+    laser_distance_grid.Initialize(xyz_laser_cloud_ptr);
+    for (size_t i = 0; i < xyz_laser_cloud_ptr->points.size(); i++) {
+      pcl::PointXYZ const& point = xyz_laser_cloud_ptr->points[i];
+      if (point.x == point.x && point.z != 0.0f) {
+        laser_off_plane_cloud_ptr->points.push_back(point);
+      }
+    }
+  }
+  // The whole scan stays in the laser source, so distance queries need not know about the table.
+  // The tree is re-indexed at the next query, once for every update since the last plan.
+  my_kd_tree.SetSource(LASER_SOURCE, xyz_laser_cloud_ptr);
+  my_kd_tree.SetSource(LASER_OFF_PLANE_SOURCE, laser_off_plane_cloud_ptr);
+}
+
+// The table only holds the in-plane points, so the nearest laser point is the nearer of its answer
+// and the nearest off-plane point.  False outside the table, where the laser source is searched.
+bool DepthImageCollisionEvaluator::SearchPlanarLaserForNearest(Vector3 const& robot_position, pcl::PointXYZ &closest_pt) {
+  if (!planar_laser || !laser_distance_grid.SearchForNearest(robot_position, closest_pt)) {
+    return false;
+  }
+  my_kd_tree.SearchForNearest(robot_position[0], robot_position[1], robot_position[2], LASER_OFF_PLANE_SOURCE_MASK);
+  KeepNearerLaserPoint(robot_position, closest_pt);
+  return true;
+}
+
+void DepthImageCollisionEvaluator::KeepNearerLaserPoint(Vector3 const& robot_position, pcl::PointXYZ &closest_pt) const {
+  if (!my_kd_tree.found[LASER_OFF_PLANE_SOURCE]) {
+    return;
+  }
+  Vector3 table_point(closest_pt.x, closest_pt.y, closest_pt.z);
+  if (my_kd_tree.squared_distances[LASER_OFF_PLANE_SOURCE] < (table_point - robot_position).squaredNorm()) {
+    closest_pt = my_kd_tree.closest_pts[LASER_OFF_PLANE_SOURCE];
+  }
+}
+
+// Both clouds come from the same sensor, so points are compared index by index.  A point that moved
+// contributes both its old and new position, so the region also covers obstacles that disappeared.
+void DepthImageCollisionEvaluator::RecordObstacleChange(pcl::PointCloud<pcl::PointXYZ>::Ptr const& previous_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr const& new_cloud) {
+  if (previous_cloud == nullptr || new_cloud == nullptr || previous_cloud->points.size() != new_cloud->points.size()) {
+    RecordAllObstaclesChanged();
+    return;
+  }
+  obstacle_generation++;
+  Eigen::AlignedBox<Scalar, 3> &changed_region = obstacle_changes[obstacle_generation % NUM_TRACKED_OBSTACLE_CHANGES];
+  changed_region.setEmpty();
+  if (previous_cloud == new_cloud) {
+    return;
+  }
+
+  double squared_tolerance = obstacle_change_tolerance*obstacle_change_tolerance;
+  size_t num_points = new_cloud->points.size();
+  for (size_t i = 0; i < num_points; i++) {
+    pcl::PointXYZ const& previous_point = previous_cloud->points[i];
+    pcl::PointXYZ const& new_point = new_cloud->points[i];
+    bool previous_valid = (previous_point.x == previous_point.x);
+    bool new_valid = (new_point.x == new_point.x);
+    if (previous_valid && new_valid) {
+      double dx = new_point.x - previous_point.x;
+      double dy = new_point.y - previous_point.y;
+      double dz = new_point.z - previous_point.z;
+      if (dx*dx + dy*dy + dz*dz <= squared_tolerance) {
+        continue;
+      }
+    }
+    if (previous_valid) {
+      changed_region.extend(Vector3(previous_point.x, previous_point.y, previous_point.z));
+    }
+    if (new_valid) {
+      changed_region.extend(Vector3(new_point.x, new_point.y, new_point.z));
+    }
+  }
+}
+
+void DepthImageCollisionEvaluator::RecordAllObstaclesChanged() {
+  obstacle_generation++;
+  last_full_obstacle_change = obstacle_generation;
+}
+
+// Union of the regions changed after the given generation, false if it is no longer known
+bool DepthImageCollisionEvaluator::GetObstacleChangesSince(size_t generation, Eigen::AlignedBox<Scalar, 3> &changed_region) const {
+  if (generation < last_full_obstacle_change || generation > obstacle_generation || obstacle_generation - generation > NUM_TRACKED_OBSTACLE_CHANGES) {
+    return false;
+  }
+  changed_region.setEmpty();
+  for (size_t g = generation + 1; g <= obstacle_generation; g++) {
+    changed_region.extend(obstacle_changes[g % NUM_TRACKED_OBSTACLE_CHANGES]);
+  }
+  return true;
 }
 
 void DepthImageCollisionEvaluator::UpdateRotationMatrix(Matrix3 const R) {
@@ -20,9 +193,9 @@ bool DepthImageCollisionEvaluator::computeDeterministicCollisionOnePositionKDTre
   if (robot_position(2) < -1.0) {
     return true;
   }
-  my_kd_tree_depth_image.SearchForNearest<1>(robot_position[0], robot_position[1], robot_position[2]);
-  if (my_kd_tree_depth_image.squared_distances.size() > 0) {
-    if (my_kd_tree_depth_image.squared_distances[0] < 2.0) {
+  my_kd_tree.SearchForNearest(robot_position[0], robot_position[1], robot_position[2], DEPTH_IMAGE_SOURCE_MASK);
+  if (my_kd_tree.found[DEPTH_IMAGE_SOURCE]) {
+    if (my_kd_tree.squared_distances[DEPTH_IMAGE_SOURCE] < 2.0) {
       return true;
     }
   }
@@ -81,6 +254,9 @@ double DepthImageCollisionEvaluator::IsOutsideFOV(Vector3 robot_position) {
     if (xyz_cloud_ptr == nullptr) {
       return 0.0;
     } 
+    if (pi_x >= (int)xyz_cloud_ptr->width || pi_y >= (int)xyz_cloud_ptr->height) { // both already checked non-negative
+      return 0.0;
+    }
     pcl::PointXYZ point = xyz_cloud_ptr->at(pi_x,pi_y);
     if (isnan(point.z)) { 
        return 0.0;
@@ -107,8 +283,10 @@ double DepthImageCollisionEvaluator::AddOutsideFOVPenalty(Vector3 robot_position
 double DepthImageCollisionEvaluator::computeProbabilityOfCollisionNPositionsKDTree_DepthImage(Vector3 const& robot_position, Vector3 const& sigma_robot_position) {
   double probability_of_collision = 0.0;
   if (xyz_cloud_ptr != nullptr) {
-    my_kd_tree_depth_image.SearchForNearest<num_nearest_neighbors>(robot_position[0], robot_position[1], robot_position[2]);
-    probability_of_collision = computeProbabilityOfCollisionNPositionsKDTree(robot_position, sigma_robot_position, my_kd_tree_depth_image.closest_pts);
+    my_kd_tree.SearchForNearest(robot_position[0], robot_position[1], robot_position[2], DEPTH_IMAGE_SOURCE_MASK);
+    if (my_kd_tree.found[DEPTH_IMAGE_SOURCE]) {
+      probability_of_collision = computeProbabilityOfCollisionOnePosition(robot_position, sigma_robot_position, my_kd_tree.closest_pts[DEPTH_IMAGE_SOURCE]);
+    }
   }
   return ThresholdSigmoid(probability_of_collision);
 }
@@ -116,34 +294,116 @@ double DepthImageCollisionEvaluator::computeProbabilityOfCollisionNPositionsKDTr
 
 double DepthImageCollisionEvaluator::computeProbabilityOfCollisionNPositionsKDTree_Laser(Vector3 const& robot_position, Vector3 const& sigma_robot_position) {
   if (xyz_laser_cloud_ptr != nullptr) {
-    my_kd_tree_laser.SearchForNearest<num_nearest_neighbors>(robot_position[0], robot_position[1], robot_position[2]);
-    double probability_of_collision = computeProbabilityOfCollisionNPositionsKDTree(robot_position, sigma_robot_position, my_kd_tree_laser.closest_pts);
+    pcl::PointXYZ closest_pt;
+    if (SearchPlanarLaserForNearest(robot_position, closest_pt)) {
+      return ThresholdHard(computeProbabilityOfCollisionOnePosition(robot_position, sigma_robot_position, closest_pt));
+    }
+    double probability_of_collision = 0.0;
+    my_kd_tree.SearchForNearest(robot_position[0], robot_position[1], robot_position[2], LASER_SOURCE_MASK);
+    if (my_kd_tree.found[LASER_SOURCE]) {
+      probability_of_collision = computeProbabilityOfCollisionOnePosition(robot_position, sigma_robot_position, my_kd_tree.closest_pts[LASER_SOURCE]);
+    }
     return ThresholdHard(probability_of_collision);
   }
   return 0.0;
 }
 
+// Same results as calling the _Laser and _DepthImage versions, but with a single tree descent
+void DepthImageCollisionEvaluator::computeProbabilityOfCollisionNPositionsKDTree_LaserAndDepthImage(Vector3 const& robot_position, Vector3 const& sigma_robot_position, double &probability_of_collision_laser, double &probability_of_collision_depth_image) {
+  unsigned source_mask = 0;
+  if (xyz_cloud_ptr != nullptr) {
+    source_mask |= DEPTH_IMAGE_SOURCE_MASK;
+  }
+
+  pcl::PointXYZ closest_laser_pt;
+  bool laser_from_grid = false;
+  if (xyz_laser_cloud_ptr != nullptr) {
+    laser_from_grid = planar_laser && laser_distance_grid.SearchForNearest(robot_position, closest_laser_pt);
+    source_mask |= laser_from_grid ? LASER_OFF_PLANE_SOURCE_MASK : LASER_SOURCE_MASK;
+  }
+
+  if (source_mask != 0) {
+    my_kd_tree.SearchForNearest(robot_position[0], robot_position[1], robot_position[2], source_mask);
+  }
+
+  double probability_of_collision = 0.0;
+  if ((source_mask & DEPTH_IMAGE_SOURCE_MASK) && my_kd_tree.found[DEPTH_IMAGE_SOURCE]) {
+    probability_of_collision = computeProbabilityOfCollisionOnePosition(robot_position, sigma_robot_position, my_kd_tree.closest_pts[DEPTH_IMAGE_SOURCE]);
+  }
+  probability_of_collision_depth_image = ThresholdSigmoid(probability_of_collision);
+
+  probability_of_collision_laser = 0.0;
+  if (laser_from_grid) {
+    KeepNearerLaserPoint(robot_position, closest_laser_pt);
+    probability_of_collision_laser = ThresholdHard(computeProbabilityOfCollisionOnePosition(robot_position, sigma_robot_position, closest_laser_pt));
+  }
+  else if (source_mask & LASER_SOURCE_MASK) {
+    probability_of_collision = 0.0;
+    if (my_kd_tree.found[LASER_SOURCE]) {
+      probability_of_collision = computeProbabilityOfCollisionOnePosition(robot_position, sigma_robot_position, my_kd_tree.closest_pts[LASER_SOURCE]);
+    }
+    probability_of_collision_laser = ThresholdHard(probability_of_collision);
+  }
+}
+
 double DepthImageCollisionEvaluator::computeProbabilityOfCollisionNPositionsKDTree(Vector3 const& robot_position, Vector3 const& sigma_robot_position, std::vector<pcl::PointXYZ> const& closest_pts) {
   double probability_no_collision = 1.0;
   
   if (closest_pts.size() > 0) {
     for (size_t i = 0; i < std::min((int)closest_pts.size(), num_nearest_neighbors); i++) {
+      double probability_of_collision = computeProbabilityOfCollisionOnePosition(robot_position, sigma_robot_position, closest_pts[i]);
+      probability_no_collision = probability_no_collision * (1 - probability_of_collision);
+    }
+    return 1 - probability_no_collision;
+  }
+  return 0.0; // if no points in closest_pts
+}
 
-      pcl::PointXYZ first_point = closest_pts[i];
-      Vector3 depth_position = Vector3(first_point.x, first_point.y, first_point.z);
+double DepthImageCollisionEvaluator::computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position, pcl::PointXYZ const& depth_point) {
+  Vector3 depth_position = Vector3(depth_point.x, depth_point.y, depth_point.z);
 
-      Vector3 total_sigma = sigma_robot_position + sigma_depth_point;
-      Vector3 inverse_total_sigma = Vector3(1/total_sigma(0), 1/total_sigma(1), 1/total_sigma(2));  
-    
-      double volume = 0.267; // 4/3*pi*r^3, with r=0.4 as first guess
-      double denominator = std::sqrt( 248.05021344239853*(total_sigma(0))*(total_sigma(1))*(total_sigma(2)) ); // coefficient is 2pi*2pi*2pi
-      double exponent = -0.5*(robot_position - depth_position).transpose() * inverse_total_sigma.cwiseProduct(robot_position - depth_position);
+  Vector3 total_sigma = sigma_robot_position + sigma_depth_point;
+  Vector3 inverse_total_sigma = Vector3(1/total_sigma(0), 1/total_sigma(1), 1/total_sigma(2));  
 
-      double probability_of_collision = volume / denominator * std::exp(exponent);
+  double exponent = -0.5*(robot_position - depth_position).transpose() * inverse_total_sigma.cwiseProduct(robot_position - depth_position);
 
-      probability_no_collision = probability_no_collision * (1 - probability_of_collision);
+  return PeakProbabilityOfCollision(total_sigma) * std::exp(exponent);
+}
+
+double DepthImageCollisionEvaluator::PeakProbabilityOfCollision(Vector3 const& total_sigma) {
+  double volume = 0.267; // 4/3*pi*r^3, with r=0.4 as first guess
+  double denominator = std::sqrt( 248.05021344239853*(total_sigma(0))*(total_sigma(1))*(total_sigma(2)) ); // coefficient is 2pi*2pi*2pi
+  return volume / denominator;
+}
+
+// Distance beyond which a single point contributes less than the given probability of collision,
+// taken along the widest axis of the Gaussian
+double DepthImageCollisionEvaluator::computeCollisionInfluenceRadius(Vector3 const& sigma_robot_position, double negligible_probability_of_collision) {
+  Vector3 total_sigma = sigma_robot_position + sigma_depth_point;
+  double peak = PeakProbabilityOfCollision(total_sigma);
+  if (peak <= negligible_probability_of_collision) {
+    return 0.0;
+  }
+  return std::sqrt(2.0*total_sigma.maxCoeff()*std::log(peak / negligible_probability_of_collision));
+}
+
+// Closest depth image or laser point, infinite if there are none
+double DepthImageCollisionEvaluator::computeDistanceToNearestObstacle(Vector3 const& position) {
+  unsigned source_mask = 0;
+  if (xyz_cloud_ptr != nullptr) {
+    source_mask |= DEPTH_IMAGE_SOURCE_MASK;
+  }
+  if (xyz_laser_cloud_ptr != nullptr) {
+    source_mask |= LASER_SOURCE_MASK;
+  }
+  double squared_distance = std::numeric_limits<double>::infinity();
+  if (source_mask != 0) {
+    my_kd_tree.SearchForNearest(position[0], position[1], position[2], source_mask);
+    for (int source = 0; source < NUM_SOURCES; source++) {
+      if (my_kd_tree.found[source]) {
+        squared_distance = std::min(squared_distance, my_kd_tree.squared_distances[source]);
+      }
     }
-    return 1 - probability_no_collision;
   }
-  return 0.0; // if no points in closest_pts
-}
\ No newline at end of file
+  return std::sqrt(squared_distance);
+}
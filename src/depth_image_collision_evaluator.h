@@ -1,9 +1,9 @@
 #include "motion.h"
 #include "kd_tree.h"
+#include "laser_distance_grid.h"
 
 #include "nanoflann.hpp"
 
-#include <pcl_conversions/pcl_conversions.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 
@@ -15,14 +15,30 @@ class DepthImageCollisionEvaluator {
 public:
 	DepthImageCollisionEvaluator() {
 		//K << 304.8, 0.0, 160.06, 0.0, 304.8, 119.85, 0.0, 0.0, 1.0;
-                K << 308.57684326171875, 0.0, 154.6868438720703, 0.0, 308.57684326171875, 120.21442413330078, 0.0, 0.0, 1.0;
-                K/=4.0;
-                K(2,2) = 1.0;
+		// R200 defaults, overridden from the camera parameters at startup
+		SetCameraModel(308.57684326171875, 308.57684326171875, 154.6868438720703, 120.21442413330078, 320, 240, 4.0);
+		R.setIdentity();
+		laser_off_plane_cloud_ptr.reset(new pcl::PointCloud<pcl::PointXYZ>);
+		obstacle_changes.resize(NUM_TRACKED_OBSTACLE_CHANGES);
 	}
 	
+  void SetCameraModel(double fx, double fy, double cx, double cy, size_t width, size_t height, double decimation);
+  void SetDepthPyramidSpeeds(std::vector<double> const& depth_pyramid_speeds);
+  void UpdateSpeed(double speed);
+  size_t GetDepthPyramidLevel() const {return depth_pyramid_level;};
+
   void UpdatePointCloudPtr(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new);
   void UpdateLaserPointCloudPtr(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new);
   void UpdateRotationMatrix(Matrix3 const R);
+  Matrix3 GetRotationMatrix() const {return R;};
+  void SetPlanarLaser(bool planar_laser) {this->planar_laser = planar_laser; RecordAllObstaclesChanged();};
+  void SetPlanarLaserGridExtent(double half_width, double resolution) {laser_distance_grid.SetExtent(half_width, resolution); RecordAllObstaclesChanged();};
+
+  // Each cloud update is one obstacle generation; the region where its points moved by more than the
+  // tolerance is kept for the last few generations, so collision results can be reused across cycles
+  void SetObstacleChangeTolerance(double tolerance) {this->obstacle_change_tolerance = tolerance;};
+  size_t GetObstacleGeneration() const {return obstacle_generation;};
+  bool GetObstacleChangesSince(size_t generation, Eigen::AlignedBox<Scalar, 3> &changed_region) const;
 
   bool computeDeterministicCollisionOnePositionKDTree(Vector3 const& robot_position);
 
@@ -33,7 +49,11 @@ public:
   
   double computeProbabilityOfCollisionNPositionsKDTree_DepthImage(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
   double computeProbabilityOfCollisionNPositionsKDTree_Laser(Vector3 const& robot_position, Vector3 const& sigma_robot_position);
+  void computeProbabilityOfCollisionNPositionsKDTree_LaserAndDepthImage(Vector3 const& robot_position, Vector3 const& sigma_robot_position, double &probability_of_collision_laser, double &probability_of_collision_depth_image);
   double computeProbabilityOfCollisionNPositionsKDTree(Vector3 const& robot_position, Vector3 const& sigma_robot_position, std::vector<pcl::PointXYZ> const& closest_pts);
+  double computeProbabilityOfCollisionOnePosition(Vector3 const& robot_position, Vector3 const& sigma_robot_position, pcl::PointXYZ const& depth_point);
+  double computeCollisionInfluenceRadius(Vector3 const& sigma_robot_position, double negligible_probability_of_collision);
+  double computeDistanceToNearestObstacle(Vector3 const& position);
 
 private:
   pcl::PointCloud<pcl::PointXYZ>::Ptr xyz_cloud_ptr;
@@ -41,12 +61,47 @@ private:
 
   Vector3 sigma_depth_point = Vector3(0.01, 0.01, 0.01);
 
+  double PeakProbabilityOfCollision(Vector3 const& total_sigma);
+
+  void RecordObstacleChange(pcl::PointCloud<pcl::PointXYZ>::Ptr const& previous_cloud, pcl::PointCloud<pcl::PointXYZ>::Ptr const& new_cloud);
+  void RecordAllObstaclesChanged();
+  enum { NUM_TRACKED_OBSTACLE_CHANGES = 8 };
+  std::vector<Eigen::AlignedBox<Scalar, 3> > obstacle_changes; // indexed by generation modulo NUM_TRACKED_OBSTACLE_CHANGES
+  size_t obstacle_generation = 0;
+  size_t last_full_obstacle_change = 0;
+  double obstacle_change_tolerance = 0.05;
+
+  void SetDepthPyramidLevel(size_t level);
+  pcl::PointCloud<pcl::PointXYZ>::Ptr DownsampleDepthImage(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud, size_t level);
+
+  // Camera model at full resolution; the incoming cloud is already decimated by depth_image_decimation
+  Matrix3 K_full_resolution;
+  double num_x_pixels_full_resolution;
+  double num_y_pixels_full_resolution;
+  double depth_image_decimation;
+
+  // Speeds at which each successive finer pyramid level is used; level 0 is the cloud as received
+  std::vector<double> depth_pyramid_speeds;
+  size_t depth_pyramid_level = 0;
+  size_t next_depth_pyramid_level = 0;
+
+  // Camera model at the current pyramid level
   Matrix3 K;
-  double num_x_pixels = 320/4.0;
-  double num_y_pixels = 240/4.0;
+  double num_x_pixels;
+  double num_y_pixels;
+
+  // Depth image and laser points share one tree, tagged by source.  The off-plane source repeats
+  // the laser points the planar table leaves out, and is empty unless the laser is planar.
+  enum { DEPTH_IMAGE_SOURCE = 0, LASER_SOURCE = 1, LASER_OFF_PLANE_SOURCE = 2, NUM_SOURCES = 3 };
+  MultiSourceKDTree<double, NUM_SOURCES> my_kd_tree;
 
-  KDTree<double> my_kd_tree_depth_image;
-  KDTree<double> my_kd_tree_laser;
+  // Laser scan projected to z=0 (2D library): in-plane points are served from a lookup table, and
+  // the ground returns the projection keeps below the plane from the off-plane source
+  bool planar_laser = false;
+  LaserDistanceGrid laser_distance_grid;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr laser_off_plane_cloud_ptr;
+  bool SearchPlanarLaserForNearest(Vector3 const& robot_position, pcl::PointXYZ &closest_pt);
+  void KeepNearerLaserPoint(Vector3 const& robot_position, pcl::PointXYZ &closest_pt) const;
 
   Matrix3 R; //rotation matrix from ortho_body frame into camera rdf frame
 
@@ -0,0 +1,344 @@
+#include "flight_log.h"
+
+#include <cstring>
+
+template <class T>
+static void Append(std::string &payload, T const& value) {
+  payload.append(reinterpret_cast<char const*>(&value), sizeof(T));
+}
+
+template <class Derived>
+static void AppendMatrix(std::string &payload, Eigen::MatrixBase<Derived> const& matrix) {
+  for (int column = 0; column < matrix.cols(); column++) {
+    for (int row = 0; row < matrix.rows(); row++) {
+      Append<double>(payload, matrix(row, column));
+    }
+  }
+}
+
+static void AppendList(std::string &payload, std::vector<double> const& list) {
+  Append<uint32_t>(payload, list.size());
+  for (double value : list) {
+    Append<double>(payload, value);
+  }
+}
+
+static void AppendString(std::string &payload, std::string const& value) {
+  Append<uint32_t>(payload, value.size());
+  payload.append(value);
+}
+
+static void AppendCloud(std::string &payload, pcl::PointCloud<pcl::PointXYZ> const& cloud) {
+  Append<uint32_t>(payload, cloud.width);
+  Append<uint32_t>(payload, cloud.height);
+  Append<uint32_t>(payload, cloud.size());
+  for (pcl::PointXYZ const& point : cloud.points) {
+    Append<float>(payload, point.x);
+    Append<float>(payload, point.y);
+    Append<float>(payload, point.z);
+  }
+}
+
+// Reads a payload front to back; any read past its end leaves ok false
+struct PayloadReader {
+  PayloadReader(std::string const& payload) : position(payload.data()), end(payload.data() + payload.size()) {};
+
+  template <class T>
+  T Read() {
+    T value = T();
+    if (ok && (size_t)(end - position) >= sizeof(T)) {
+      memcpy(&value, position, sizeof(T));
+      position += sizeof(T);
+    }
+    else {
+      ok = false;
+    }
+    return value;
+  }
+
+  template <class Derived>
+  void ReadMatrix(Eigen::MatrixBase<Derived> &matrix) {
+    for (int column = 0; column < matrix.cols(); column++) {
+      for (int row = 0; row < matrix.rows(); row++) {
+        matrix(row, column) = Read<double>();
+      }
+    }
+  }
+
+  std::vector<double> ReadList() {
+    uint32_t size = Read<uint32_t>();
+    std::vector<double> list;
+    for (uint32_t i = 0; ok && i < size; i++) {
+      list.push_back(Read<double>());
+    }
+    return list;
+  }
+
+  std::string ReadString() {
+    uint32_t size = Read<uint32_t>();
+    if (!ok || (size_t)(end - position) < size) {
+      ok = false;
+      return std::string();
+    }
+    std::string value(position, size);
+    position += size;
+    return value;
+  }
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr ReadCloud() {
+    pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
+    uint32_t width = Read<uint32_t>();
+    uint32_t height = Read<uint32_t>();
+    uint32_t size = Read<uint32_t>();
+    if (!ok || (size_t)(end - position) < 3*sizeof(float)*(size_t)size) {
+      ok = false;
+      return cloud;
+    }
+    cloud->points.resize(size);
+    for (pcl::PointXYZ &point : cloud->points) {
+      point.x = Read<float>();
+      point.y = Read<float>();
+      point.z = Read<float>();
+    }
+    cloud->width = width;
+    cloud->height = height;
+    return cloud;
+  }
+
+  bool AtEnd() const {
+    return ok && position == end;
+  }
+
+  char const* position;
+  char const* end;
+  bool ok = true;
+};
+
+FlightLogWriter::~FlightLogWriter() {
+  Close();
+}
+
+bool FlightLogWriter::Open(std::string const& path) {
+  std::lock_guard<std::mutex> lock(mutex);
+  file.open(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    error = "cannot open " + path;
+    return false;
+  }
+  file.write(flight_log_magic, sizeof(flight_log_magic));
+  file.write(reinterpret_cast<char const*>(&flight_log_version), sizeof(flight_log_version));
+  return true;
+}
+
+void FlightLogWriter::Close() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (file.is_open()) {
+    file.close();
+  }
+}
+
+void FlightLogWriter::WriteConfig(MotionPlannerConfig const& config) {
+  std::string payload;
+  Append<uint8_t>(payload, config.use_3d_library);
+  Append<uint8_t>(payload, config.use_dijkstra);
+  Append<uint8_t>(payload, config.yaw_on);
+  Append<double>(payload, config.final_time);
+  Append<double>(payload, config.soft_top_speed);
+  Append<double>(payload, config.acceleration_interpolation_min);
+  Append<double>(payload, config.speed_at_acceleration_max);
+  Append<double>(payload, config.acceleration_interpolation_max);
+  Append<double>(payload, config.flight_altitude);
+  Append<double>(payload, config.max_e_stop_pitch_degrees);
+  Append<double>(payload, config.laser_grid_half_width);
+  Append<double>(payload, config.laser_grid_resolution);
+  Append<double>(payload, config.refinement_time_budget);
+  Append<double>(payload, config.collision_reuse_tolerance);
+  AppendList(payload, config.acceleration_grid_horizontal_fractions);
+  AppendList(payload, config.acceleration_grid_vertical_accelerations);
+  Append<int32_t>(payload, config.acceleration_grid_samples_around_circle);
+  Append<uint8_t>(payload, config.use_motion_bvh);
+  AppendString(payload, config.motion_library_file);
+  Append<double>(payload, config.camera_fx);
+  Append<double>(payload, config.camera_fy);
+  Append<double>(payload, config.camera_cx);
+  Append<double>(payload, config.camera_cy);
+  Append<int32_t>(payload, config.camera_width);
+  Append<int32_t>(payload, config.camera_height);
+  Append<double>(payload, config.depth_image_decimation);
+  AppendList(payload, config.depth_pyramid_speeds);
+  WriteRecord(FLIGHT_LOG_CONFIG, payload);
+}
+
+void FlightLogWriter::WriteExtrinsic(FlightLogRecordType type, Eigen::Isometry3d const& body_to_sensor) {
+  std::string payload;
+  AppendMatrix(payload, body_to_sensor.matrix());
+  WriteRecord(type, payload);
+}
+
+void FlightLogWriter::WritePose(Vector3 const& position, double roll, double pitch, double yaw) {
+  std::string payload;
+  AppendMatrix(payload, position);
+  Append<double>(payload, roll);
+  Append<double>(payload, pitch);
+  Append<double>(payload, yaw);
+  WriteRecord(FLIGHT_LOG_POSE, payload);
+}
+
+void FlightLogWriter::WriteVector(FlightLogRecordType type, Vector3 const& vector) {
+  std::string payload;
+  AppendMatrix(payload, vector);
+  WriteRecord(type, payload);
+}
+
+void FlightLogWriter::WritePlan(double now, double library_thrust, double planning_budget, size_t num_motions_evaluated, size_t num_refinement_samples) {
+  std::string payload;
+  Append<double>(payload, now);
+  Append<double>(payload, library_thrust);
+  Append<double>(payload, planning_budget);
+  Append<uint64_t>(payload, num_motions_evaluated);
+  Append<uint64_t>(payload, num_refinement_samples);
+  WriteRecord(FLIGHT_LOG_PLAN, payload);
+}
+
+void FlightLogWriter::WritePlanResult(size_t best_traj_index, Vector3 const& desired_acceleration) {
+  std::string payload;
+  Append<uint64_t>(payload, best_traj_index);
+  AppendMatrix(payload, desired_acceleration);
+  WriteRecord(FLIGHT_LOG_PLAN_RESULT, payload);
+}
+
+std::string FlightLogWriter::EncodeDepthImage(pcl::PointCloud<pcl::PointXYZ> const& cloud, Matrix3 const& ortho_body_to_rdf) {
+  std::string payload;
+  AppendMatrix(payload, ortho_body_to_rdf);
+  AppendCloud(payload, cloud);
+  return payload;
+}
+
+std::string FlightLogWriter::EncodeLaserScan(pcl::PointCloud<pcl::PointXYZ> const& cloud) {
+  std::string payload;
+  AppendCloud(payload, cloud);
+  return payload;
+}
+
+void FlightLogWriter::WriteRecord(FlightLogRecordType type, std::string const& payload) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!file.is_open()) {
+    return;
+  }
+  uint8_t type_byte = type;
+  uint32_t payload_size = payload.size();
+  file.write(reinterpret_cast<char const*>(&type_byte), sizeof(type_byte));
+  file.write(reinterpret_cast<char const*>(&payload_size), sizeof(payload_size));
+  file.write(payload.data(), payload.size());
+}
+
+bool FlightLogReader::Open(std::string const& path) {
+  file.open(path, std::ios::binary);
+  if (!file) {
+    return Fail("cannot open " + path);
+  }
+  char magic[sizeof(flight_log_magic)];
+  uint32_t version = 0;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&version), sizeof(version));
+  if (!file || memcmp(magic, flight_log_magic, sizeof(magic)) != 0 || version != flight_log_version) {
+    return Fail(path + " is not a version " + std::to_string(flight_log_version) + " flight log");
+  }
+  return true;
+}
+
+bool FlightLogReader::ReadRecord(FlightLogRecord &record) {
+  uint8_t type_byte = 0;
+  uint32_t payload_size = 0;
+  if (!file.read(reinterpret_cast<char*>(&type_byte), sizeof(type_byte))) {
+    return false;
+  }
+  // A log cut off mid-record, as when the node was killed, ends at the last whole record
+  if (!file.read(reinterpret_cast<char*>(&payload_size), sizeof(payload_size))) {
+    return false;
+  }
+  payload.resize(payload_size);
+  if (!file.read(&payload[0], payload_size)) {
+    return false;
+  }
+  num_records_read++;
+
+  record.type = (FlightLogRecordType)type_byte;
+  PayloadReader reader(payload);
+  switch (record.type) {
+  case FLIGHT_LOG_CONFIG: {
+    MotionPlannerConfig &config = record.config;
+    config.use_3d_library = reader.Read<uint8_t>();
+    config.use_dijkstra = reader.Read<uint8_t>();
+    config.yaw_on = reader.Read<uint8_t>();
+    config.final_time = reader.Read<double>();
+    config.soft_top_speed = reader.Read<double>();
+    config.acceleration_interpolation_min = reader.Read<double>();
+    config.speed_at_acceleration_max = reader.Read<double>();
+    config.acceleration_interpolation_max = reader.Read<double>();
+    config.flight_altitude = reader.Read<double>();
+    config.max_e_stop_pitch_degrees = reader.Read<double>();
+    config.laser_grid_half_width = reader.Read<double>();
+    config.laser_grid_resolution = reader.Read<double>();
+    config.refinement_time_budget = reader.Read<double>();
+    config.collision_reuse_tolerance = reader.Read<double>();
+    config.acceleration_grid_horizontal_fractions = reader.ReadList();
+    config.acceleration_grid_vertical_accelerations = reader.ReadList();
+    config.acceleration_grid_samples_around_circle = reader.Read<int32_t>();
+    config.use_motion_bvh = reader.Read<uint8_t>();
+    config.motion_library_file = reader.ReadString();
+    config.camera_fx = reader.Read<double>();
+    config.camera_fy = reader.Read<double>();
+    config.camera_cx = reader.Read<double>();
+    config.camera_cy = reader.Read<double>();
+    config.camera_width = reader.Read<int32_t>();
+    config.camera_height = reader.Read<int32_t>();
+    config.depth_image_decimation = reader.Read<double>();
+    config.depth_pyramid_speeds = reader.ReadList();
+    break;
+  }
+  case FLIGHT_LOG_LASER_EXTRINSIC:
+  case FLIGHT_LOG_DEPTH_CAMERA_EXTRINSIC:
+    reader.ReadMatrix(record.transform.matrix());
+    break;
+  case FLIGHT_LOG_POSE:
+    reader.ReadMatrix(record.vector);
+    record.roll = reader.Read<double>();
+    record.pitch = reader.Read<double>();
+    record.yaw = reader.Read<double>();
+    break;
+  case FLIGHT_LOG_VELOCITY:
+  case FLIGHT_LOG_LOCAL_GOAL:
+    reader.ReadMatrix(record.vector);
+    break;
+  case FLIGHT_LOG_DEPTH_IMAGE:
+    reader.ReadMatrix(record.ortho_body_to_rdf);
+    record.cloud = reader.ReadCloud();
+    break;
+  case FLIGHT_LOG_LASER_SCAN:
+    record.cloud = reader.ReadCloud();
+    break;
+  case FLIGHT_LOG_PLAN:
+    record.now = reader.Read<double>();
+    record.library_thrust = reader.Read<double>();
+    record.planning_budget = reader.Read<double>();
+    record.num_motions_evaluated = reader.Read<uint64_t>();
+    record.num_refinement_samples = reader.Read<uint64_t>();
+    break;
+  case FLIGHT_LOG_PLAN_RESULT:
+    record.best_traj_index = reader.Read<uint64_t>();
+    reader.ReadMatrix(record.vector);
+    break;
+  default:
+    return Fail("record " + std::to_string(num_records_read) + " has unknown type " + std::to_string(type_byte));
+  }
+  if (!reader.AtEnd()) {
+    return Fail("record " + std::to_string(num_records_read) + " does not match the size of its type");
+  }
+  return true;
+}
+
+bool FlightLogReader::Fail(std::string const& message) {
+  error = message;
+  return false;
+}
@@ -0,0 +1,110 @@
+#ifndef FLIGHT_LOG_H
+#define FLIGHT_LOG_H
+
+#include "motion_planner.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <stdint.h>
+
+// Inputs of a MotionPlanner in the order it applied them, for motion_selector_replay.
+//
+//   header    magic[8], uint32 version
+//   records   uint8 type, uint32 payload_size, payload
+//
+// Payloads hold the values as the planner saw them, doubles and the clouds' float xyz, in host
+// byte order, so a replay on the same architecture starts from bit-identical inputs.  The PLAN
+// record marks each ComputePlan call, with its deadline as a budget in seconds (0 for none), the
+// number of motions it evaluated and the number of refinement samples it drew, and PLAN_RESULT
+// records what it selected on the vehicle.
+enum FlightLogRecordType {
+  FLIGHT_LOG_CONFIG = 1,
+  FLIGHT_LOG_LASER_EXTRINSIC,
+  FLIGHT_LOG_DEPTH_CAMERA_EXTRINSIC,
+  FLIGHT_LOG_POSE,
+  FLIGHT_LOG_VELOCITY,
+  FLIGHT_LOG_LOCAL_GOAL,
+  FLIGHT_LOG_DEPTH_IMAGE,
+  FLIGHT_LOG_LASER_SCAN,
+  FLIGHT_LOG_PLAN,
+  FLIGHT_LOG_PLAN_RESULT
+};
+
+const char flight_log_magic[8] = {'M', 'P', 'F', 'L', 'I', 'G', 'H', 'T'};
+const uint32_t flight_log_version = 3;
+
+// Only the fields of its type are filled in
+struct FlightLogRecord {
+  FlightLogRecordType type;
+  MotionPlannerConfig config;
+  Eigen::Isometry3d transform = Eigen::Isometry3d::Identity();   // extrinsics
+  Vector3 vector = Vector3::Zero();   // pose position, velocity, local goal, planned acceleration
+  double roll = 0.0, pitch = 0.0, yaw = 0.0;
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+  Matrix3 ortho_body_to_rdf = Matrix3::Identity();
+  double now = 0.0;
+  double library_thrust = 0.0;
+  double planning_budget = 0.0;
+  uint64_t num_motions_evaluated = 0;
+  uint64_t num_refinement_samples = 0;
+  uint64_t best_traj_index = 0;
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+// Records may be written from several threads; each lands whole, in the order the calls took the lock
+class FlightLogWriter {
+public:
+
+  FlightLogWriter() {};
+  ~FlightLogWriter();
+  FlightLogWriter(FlightLogWriter const&) = delete;
+  FlightLogWriter& operator=(FlightLogWriter const&) = delete;
+
+  bool Open(std::string const& path);
+  void Close();
+  bool IsOpen() const {return file.is_open();};
+  std::string const& GetError() const {return error;};
+
+  void WriteConfig(MotionPlannerConfig const& config);
+  void WriteExtrinsic(FlightLogRecordType type, Eigen::Isometry3d const& body_to_sensor);
+  void WritePose(Vector3 const& position, double roll, double pitch, double yaw);
+  void WriteVector(FlightLogRecordType type, Vector3 const& vector);
+  void WritePlan(double now, double library_thrust, double planning_budget, size_t num_motions_evaluated, size_t num_refinement_samples);
+  void WritePlanResult(size_t best_traj_index, Vector3 const& desired_acceleration);
+
+  // Clouds are encoded apart from writing them, so the encoding can happen outside a caller's lock
+  static std::string EncodeDepthImage(pcl::PointCloud<pcl::PointXYZ> const& cloud, Matrix3 const& ortho_body_to_rdf);
+  static std::string EncodeLaserScan(pcl::PointCloud<pcl::PointXYZ> const& cloud);
+  void WriteRecord(FlightLogRecordType type, std::string const& payload);
+
+private:
+  std::mutex mutex;
+  std::ofstream file;
+  std::string error;
+
+};
+
+class FlightLogReader {
+public:
+
+  bool Open(std::string const& path);
+  // False at the end of the log, or with GetError set for a damaged or unknown record
+  bool ReadRecord(FlightLogRecord &record);
+  std::string const& GetError() const {return error;};
+
+private:
+  bool Fail(std::string const& message);
+
+  std::ifstream file;
+  std::string payload;
+  std::string error;
+  size_t num_records_read = 0;
+
+};
+
+#endif
@@ -0,0 +1,14 @@
+#include "frame_utils.h"
+
+// Same rotation as tf2::Quaternion::setRPY(-roll, -pitch, 0), which the node broadcasts as body -> ortho_body
+Eigen::Quaterniond OrthoBodyRotationInBody(double roll, double pitch) {
+	return Eigen::Quaterniond(Eigen::AngleAxisd(-pitch, Eigen::Vector3d::UnitY()) * Eigen::AngleAxisd(-roll, Eigen::Vector3d::UnitX()));
+}
+
+Eigen::Isometry3d OrthoBodyToWorld(Vector3 const& body_position, double roll, double pitch, double yaw) {
+	Eigen::Quaterniond body_rotation = Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()) * Eigen::AngleAxisd(pitch, Eigen::Vector3d::UnitY()) * Eigen::AngleAxisd(roll, Eigen::Vector3d::UnitX());
+	Eigen::Isometry3d isometry = Eigen::Isometry3d::Identity();
+	isometry.translate(body_position);
+	isometry.rotate(body_rotation * OrthoBodyRotationInBody(roll, pitch));
+	return isometry;
+}
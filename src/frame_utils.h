@@ -0,0 +1,12 @@
+#ifndef FRAME_UTILS_H
+#define FRAME_UTILS_H
+
+#include "motion.h"
+
+#include <Eigen/Geometry>
+
+// The ortho_body frame is the body frame with roll and pitch undone, at the body's position
+Eigen::Quaterniond OrthoBodyRotationInBody(double roll, double pitch);
+Eigen::Isometry3d OrthoBodyToWorld(Vector3 const& body_position, double roll, double pitch, double yaw);
+
+#endif
@@ -1,10 +1,12 @@
 #include "nanoflann.hpp"
+#include "trace.h"
 
-#include <pcl_conversions/pcl_conversions.h>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 
 #include <algorithm>
+#include <limits>
+#include <stdint.h>
 
 template <typename T>
 struct PointCloud
@@ -57,6 +59,7 @@ public:
 	KDTree() : cloud(), index(3, cloud, nanoflann::KDTreeSingleIndexAdaptorParams(10 /* max leaf */)) { };
 
 	void Initialize(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new) {
+		TraceSpan span("KDTree::Initialize");
 		using namespace std;
 		using namespace nanoflann;
 		cloud.pts.clear();
@@ -99,4 +102,171 @@ void SearchForNearest(num_t x, num_t y, num_t z) {
 private:
 	PointCloud<num_t> cloud;
 	my_kd_tree_t index;
-};
\ No newline at end of file
+};
+// Points from several sensors in one cloud, each tagged with the index of the sensor it came from
+template <typename T>
+struct TaggedPointCloud
+{
+
+	std::vector<pcl::PointXYZ>  pts;
+	std::vector<uint8_t> sources;
+
+	inline size_t kdtree_get_point_count() const { return pts.size(); }
+
+	inline T kdtree_distance(const T *p1, const size_t idx_p2,size_t /*size*/) const
+	{
+		const T d0=p1[0]-pts[idx_p2].x;
+		const T d1=p1[1]-pts[idx_p2].y;
+		const T d2=p1[2]-pts[idx_p2].z;
+		return d0*d0+d1*d1+d2*d2;
+	}
+
+	inline T kdtree_get_pt(const size_t idx, int dim) const
+	{
+		if (dim==0) return pts[idx].x;
+		else if (dim==1) return pts[idx].y;
+		else return pts[idx].z;
+	}
+
+	template <class BBOX>
+	bool kdtree_get_bbox(BBOX& /*bb*/) const { return false; }
+
+};
+
+// nanoflann result set that keeps the single nearest point of every requested source.
+// The search radius is the worst of the per-source bests, so a subtree is only pruned once it
+// cannot improve the answer for any source and one descent answers all sensors at once.
+template <typename DistanceType, int num_sources>
+class NearestPerSourceResultSet
+{
+public:
+	NearestPerSourceResultSet(std::vector<uint8_t> const& sources, unsigned source_mask) : sources(sources), source_mask(source_mask) {
+		num_requested = 0;
+		for (int s = 0; s < num_sources; s++) {
+			indices[s] = -1;
+			dists[s] = (std::numeric_limits<DistanceType>::max)();
+			if (source_mask & (1u << s)) { num_requested++; }
+		}
+		num_found = 0;
+		worst_dist = (std::numeric_limits<DistanceType>::max)();
+	}
+
+	inline size_t size() const { return num_found; }
+	inline bool full() const { return num_found == num_requested; }
+
+	inline void addPoint(DistanceType dist, size_t index) {
+		uint8_t s = sources[index];
+		if (!(source_mask & (1u << s)) || dist >= dists[s]) {
+			return;
+		}
+		if (indices[s] < 0) { num_found++; }
+		dists[s] = dist;
+		indices[s] = index;
+		if (full()) {
+			worst_dist = 0;
+			for (int i = 0; i < num_sources; i++) {
+				if ((source_mask & (1u << i)) && dists[i] > worst_dist) { worst_dist = dists[i]; }
+			}
+		}
+	}
+
+	inline DistanceType worstDist() const { return worst_dist; }
+
+	long indices[num_sources];
+	DistanceType dists[num_sources];
+
+private:
+	std::vector<uint8_t> const& sources;
+	unsigned source_mask;
+	int num_requested;
+	int num_found;
+	DistanceType worst_dist;
+};
+
+// One KD-tree over the points of several sensors.  Each source is replaced independently and the
+// combined index is rebuilt; a query returns the nearest point of each source.  Replacing a source
+// re-indexes the others' unchanged points too, so SetSource leaves the rebuild to the next search,
+// and sources replaced between two searches share one rebuild.
+template <typename num_t, int num_sources>
+class MultiSourceKDTree {
+public:
+	pcl::PointXYZ closest_pts[num_sources];
+	num_t squared_distances[num_sources];
+	bool found[num_sources];
+
+	typedef nanoflann::KDTreeSingleIndexAdaptor<
+	nanoflann::L2_Simple_Adaptor<num_t, TaggedPointCloud<num_t> > ,
+	TaggedPointCloud<num_t>,
+	3 /* dim */
+	> my_kd_tree_t;
+
+	MultiSourceKDTree() : cloud(), index(3, cloud, nanoflann::KDTreeSingleIndexAdaptorParams(10 /* max leaf */)) {
+		for (int s = 0; s < num_sources; s++) { found[s] = false; }
+	};
+
+	void Initialize(int source, pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new) {
+		TraceSpan span("MultiSourceKDTree::Initialize");
+		SetSource(source, xyz_cloud_new);
+		BuildIndex();
+	}
+
+	// Replaces a source's points; the index is rebuilt by BuildIndex or the next search
+	void SetSource(int source, pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new) {
+		index_stale = true;
+		std::vector<pcl::PointXYZ>& source_pts = source_clouds[source];
+		source_pts.clear();
+		size_t num_points = xyz_cloud_new->points.size();
+		for (size_t i = 0; i < num_points; i++) {
+			if ( !(xyz_cloud_new->points[i].x != xyz_cloud_new->points[i].x) ) {
+				source_pts.push_back(xyz_cloud_new->points[i]);
+			}
+		}
+	}
+
+	void BuildIndex() {
+		TraceSpan span("MultiSourceKDTree::BuildIndex");
+		cloud.pts.clear();
+		cloud.sources.clear();
+		for (int s = 0; s < num_sources; s++) {
+			cloud.pts.insert(cloud.pts.end(), source_clouds[s].begin(), source_clouds[s].end());
+			cloud.sources.insert(cloud.sources.end(), source_clouds[s].size(), s);
+		}
+		index.buildIndex();
+		index_stale = false;
+	}
+
+	bool HasPoints(int source) const {
+		return source_clouds[source].size() > 0;
+	}
+
+	void SearchForNearest(num_t x, num_t y, num_t z, unsigned source_mask = ~0u) {
+		if (index_stale) {
+			BuildIndex();
+		}
+		// A requested source without points would keep the result set from ever filling, and then
+		// nothing is pruned and the whole tree is walked
+		for (int s = 0; s < num_sources; s++) {
+			found[s] = false;
+			if (!HasPoints(s)) { source_mask &= ~(1u << s); }
+		}
+		if ((source_mask & ((1u << num_sources) - 1)) != 0) {
+			num_t query_pt[3] = { x, y, z};
+			NearestPerSourceResultSet<num_t, num_sources> resultSet(cloud.sources, source_mask);
+			nanoflann::SearchParams params(10);
+			index.findNeighbors(resultSet, &query_pt[0], params);
+			for (int s = 0; s < num_sources; s++) {
+				if (resultSet.indices[s] >= 0) {
+					found[s] = true;
+					closest_pts[s] = cloud.pts[resultSet.indices[s]];
+					squared_distances[s] = resultSet.dists[s];
+				}
+			}
+		}
+	}
+
+private:
+	std::vector<pcl::PointXYZ> source_clouds[num_sources];
+	TaggedPointCloud<num_t> cloud;
+	my_kd_tree_t index;
+	bool index_stale = false;
+};
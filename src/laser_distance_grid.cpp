@@ -0,0 +1,155 @@
+#include "laser_distance_grid.h"
+#include "trace.h"
+
+void LaserDistanceGrid::SetExtent(double half_width, double resolution) {
+  this->half_width = half_width;
+  this->resolution = resolution;
+  num_cells_per_side = static_cast<size_t>(ceil(2.0*half_width / resolution));
+  nearest_index.assign(num_cells_per_side*num_cells_per_side, -1);
+}
+
+bool LaserDistanceGrid::Contains(Vector3 const& position) const {
+  return (position(0) >= -half_width) && (position(0) < half_width) && (position(1) >= -half_width) && (position(1) < half_width);
+}
+
+void LaserDistanceGrid::Initialize(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new) {
+  TraceSpan span("LaserDistanceGrid::Initialize");
+  const double INF = std::numeric_limits<double>::infinity();
+  size_t num_cells = num_cells_per_side*num_cells_per_side;
+
+  pts.clear();
+  site_index.assign(num_cells, -1);
+  site_squared_distances.assign(num_cells, INF);
+
+  // Seed each cell with the scan point closest to its center.  Points beyond the extent are
+  // clamped onto the border cells, seeded with their offset from the cell so far points stay far.
+  // Points off the z=0 plane are left out, as an xy distance would place them too close to it.
+  size_t num_points = xyz_cloud_new->points.size();
+  for (size_t i = 0; i < num_points; i++) {
+    pcl::PointXYZ const& point = xyz_cloud_new->points[i];
+    if (point.x != point.x || point.z != 0.0f) {
+      continue;
+    }
+    double col_position = (point.x + half_width) / resolution;
+    double row_position = (point.y + half_width) / resolution;
+    double max_position = num_cells_per_side - 1;
+    size_t col = static_cast<size_t>(std::min(std::max(floor(col_position), 0.0), max_position));
+    size_t row = static_cast<size_t>(std::min(std::max(floor(row_position), 0.0), max_position));
+
+    double dx = col_position - (col + 0.5);
+    double dy = row_position - (row + 0.5);
+    double squared_distance_to_center = dx*dx + dy*dy;
+    size_t cell = CellIndex(col, row);
+    if (squared_distance_to_center < site_squared_distances[cell]) {
+      site_squared_distances[cell] = squared_distance_to_center;
+      site_index[cell] = pts.size();
+    }
+    pts.push_back(point);
+  }
+
+  squared_distances.resize(num_cells);
+  column_squared_distances.resize(num_cells);
+  column_nearest_index.resize(num_cells);
+  envelope_boundaries.resize(num_cells_per_side + 1);
+  envelope_vertices.resize(num_cells_per_side);
+
+  // Separable transform: down each column, then along each row of the column result
+  for (size_t col = 0; col < num_cells_per_side; col++) {
+    DistanceTransform1D(num_cells_per_side, num_cells_per_side, col, site_squared_distances, site_index, column_squared_distances, column_nearest_index);
+  }
+  for (size_t row = 0; row < num_cells_per_side; row++) {
+    DistanceTransform1D(num_cells_per_side, 1, row*num_cells_per_side, column_squared_distances, column_nearest_index, squared_distances, nearest_index);
+  }
+}
+
+// Lower envelope of parabolas rooted at the finite samples of f, as in Felzenszwalb & Huttenlocher,
+// additionally carrying along which point produced the minimum.
+void LaserDistanceGrid::DistanceTransform1D(size_t n, size_t stride, size_t offset, std::vector<double> const& f, std::vector<int> const& f_arg, std::vector<double> &d, std::vector<int> &d_arg) {
+  const double INF = std::numeric_limits<double>::infinity();
+  int k = -1;
+  for (size_t q = 0; q < n; q++) {
+    double f_q = f[offset + q*stride];
+    if (f_q == INF) {
+      continue;
+    }
+    if (k < 0) {
+      k = 0;
+      envelope_vertices[0] = q;
+      envelope_boundaries[0] = -INF;
+      envelope_boundaries[1] = INF;
+      continue;
+    }
+    double s;
+    while (true) {
+      size_t v = envelope_vertices[k];
+      double f_v = f[offset + v*stride];
+      s = ((f_q + 1.0*q*q) - (f_v + 1.0*v*v)) / (2.0*q - 2.0*v);
+      if (s <= envelope_boundaries[k]) {
+        k--;
+      }
+      else {
+        break;
+      }
+    }
+    k++;
+    envelope_vertices[k] = q;
+    envelope_boundaries[k] = s;
+    envelope_boundaries[k+1] = INF;
+  }
+
+  if (k < 0) {
+    for (size_t q = 0; q < n; q++) {
+      d[offset + q*stride] = INF;
+      d_arg[offset + q*stride] = -1;
+    }
+    return;
+  }
+
+  k = 0;
+  for (size_t q = 0; q < n; q++) {
+    while (envelope_boundaries[k+1] < q) {
+      k++;
+    }
+    size_t v = envelope_vertices[k];
+    double offset_q = 1.0*q - 1.0*v;
+    d[offset + q*stride] = offset_q*offset_q + f[offset + v*stride];
+    d_arg[offset + q*stride] = f_arg[offset + v*stride];
+  }
+}
+
+bool LaserDistanceGrid::SearchForNearest(Vector3 const& position, pcl::PointXYZ &closest_pt) const {
+  if (pts.size() == 0 || !Contains(position)) {
+    return false;
+  }
+  size_t col = std::min(static_cast<size_t>((position(0) + half_width) / resolution), num_cells_per_side - 1);
+  size_t row = std::min(static_cast<size_t>((position(1) + half_width) / resolution), num_cells_per_side - 1);
+
+  // The table is exact for cell centers; checking the neighboring cells' answers keeps the
+  // error for off-center queries well under a cell.
+  size_t col_begin = (col > 0) ? col - 1 : col;
+  size_t row_begin = (row > 0) ? row - 1 : row;
+  size_t col_end = std::min(col + 1, num_cells_per_side - 1);
+  size_t row_end = std::min(row + 1, num_cells_per_side - 1);
+  int best_index = -1;
+  double best_squared_distance = std::numeric_limits<double>::infinity();
+  for (size_t r = row_begin; r <= row_end; r++) {
+    for (size_t c = col_begin; c <= col_end; c++) {
+      int index = nearest_index[CellIndex(c, r)];
+      if (index < 0 || index == best_index) {
+        continue;
+      }
+      double dx = pts[index].x - position(0);
+      double dy = pts[index].y - position(1);
+      double squared_distance = dx*dx + dy*dy;
+      if (squared_distance < best_squared_distance) {
+        best_squared_distance = squared_distance;
+        best_index = index;
+      }
+    }
+  }
+  if (best_index < 0) {
+    return false;
+  }
+  closest_pt = pts[best_index];
+  return true;
+}
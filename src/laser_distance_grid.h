@@ -0,0 +1,55 @@
+#ifndef LASER_DISTANCE_GRID_H
+#define LASER_DISTANCE_GRID_H
+
+#include "motion.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <vector>
+#include <limits>
+#include <math.h>
+
+// Nearest-point table for the points of a laser scan that lie in the ortho_body z=0 plane, where
+// the nearest point in xy is also the nearest in 3D.  Points the projection left off the plane
+// are ignored and must be searched separately.
+// Built with an exact 2D distance transform (Felzenszwalb) that also tracks the argmin, so each
+// cell stores the index of the scan point nearest to it and a query is a single table lookup.
+class LaserDistanceGrid {
+public:
+
+  LaserDistanceGrid() {
+    SetExtent(12.0, 0.1);
+  };
+
+  void SetExtent(double half_width, double resolution);
+  void Initialize(pcl::PointCloud<pcl::PointXYZ>::Ptr const& xyz_cloud_new);
+
+  bool Contains(Vector3 const& position) const;
+  bool SearchForNearest(Vector3 const& position, pcl::PointXYZ &closest_pt) const;
+
+private:
+  void DistanceTransform1D(size_t n, size_t stride, size_t offset, std::vector<double> const& f, std::vector<int> const& f_arg, std::vector<double> &d, std::vector<int> &d_arg);
+  size_t CellIndex(size_t col, size_t row) const {
+    return row*num_cells_per_side + col;
+  }
+
+  double half_width;
+  double resolution;
+  size_t num_cells_per_side;
+
+  std::vector<pcl::PointXYZ> pts;
+  std::vector<int> nearest_index;  // index into pts of the nearest point, -1 if scan is empty
+
+  // scratch buffers, kept to avoid reallocating on every scan
+  std::vector<double> site_squared_distances;
+  std::vector<int> site_index;
+  std::vector<double> squared_distances;
+  std::vector<double> column_squared_distances;
+  std::vector<int> column_nearest_index;
+  std::vector<double> envelope_boundaries;
+  std::vector<size_t> envelope_vertices;
+
+};
+
+#endif
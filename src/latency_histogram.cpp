@@ -0,0 +1,62 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram()
+  : counts(new std::atomic<uint64_t>[NUM_BUCKETS]) {
+  for (size_t bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+    counts[bucket].store(0, std::memory_order_relaxed);
+  }
+}
+
+// The bucket is given by the position of the highest set bit and the SUB_BUCKET_BITS bits below it
+size_t LatencyHistogram::BucketOfValue(uint64_t value) {
+  if (value < NUM_EXACT_VALUES) {
+    return value;
+  }
+  size_t highest_bit = 63 - __builtin_clzll(value);
+  size_t shift = highest_bit - SUB_BUCKET_BITS;
+  return NUM_EXACT_VALUES + (shift - 1)*SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::HighestValueInBucket(size_t bucket) {
+  if (bucket < NUM_EXACT_VALUES) {
+    return bucket;
+  }
+  size_t shift = (bucket - NUM_EXACT_VALUES) / SUB_BUCKETS + 1;
+  uint64_t sub_bucket = (bucket - NUM_EXACT_VALUES) % SUB_BUCKETS + SUB_BUCKETS;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t value) {
+  counts[BucketOfValue(value)].fetch_add(1, std::memory_order_relaxed);
+  uint64_t previous_max = max_value.load(std::memory_order_relaxed);
+  while (value > previous_max && !max_value.compare_exchange_weak(previous_max, value, std::memory_order_relaxed)) {
+  }
+}
+
+// Buckets are emptied one at a time, so a value recorded meanwhile lands in this window or the next
+void LatencyHistogram::TakeSnapshot(Snapshot &snapshot) {
+  snapshot.counts.resize(NUM_BUCKETS);
+  snapshot.total_count = 0;
+  for (size_t bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+    snapshot.counts[bucket] = counts[bucket].exchange(0, std::memory_order_relaxed);
+    snapshot.total_count += snapshot.counts[bucket];
+  }
+  snapshot.max_value = max_value.exchange(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Snapshot::ValueAtPercentile(double percentile) const {
+  if (total_count == 0) {
+    return 0;
+  }
+  double rank = percentile / 100.0 * total_count;
+  uint64_t count_below = 0;
+  for (size_t bucket = 0; bucket < counts.size(); bucket++) {
+    count_below += counts[bucket];
+    if (count_below > 0 && count_below >= rank) {
+      return std::min(HighestValueInBucket(bucket), max_value);
+    }
+  }
+  return max_value;
+}
@@ -0,0 +1,45 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+// Lock-free histogram of non-negative integer values, with the log-linear buckets of an HDR
+// histogram: values below 64 are exact, larger ones share a bucket with values within 1/32 of
+// them.  Any thread may record while another takes a snapshot, which starts a new window.
+class LatencyHistogram {
+public:
+
+  struct Snapshot {
+    std::vector<uint64_t> counts;
+    uint64_t total_count = 0;
+    uint64_t max_value = 0;
+
+    // Highest value of the bucket holding the given percentile, so never below the true value;
+    // 0 for an empty window
+    uint64_t ValueAtPercentile(double percentile) const;
+  };
+
+  LatencyHistogram();
+  LatencyHistogram(LatencyHistogram const&) = delete;
+  LatencyHistogram& operator=(LatencyHistogram const&) = delete;
+
+  void Record(uint64_t value);
+  // Moves everything recorded since the last snapshot into snapshot
+  void TakeSnapshot(Snapshot &snapshot);
+
+  static size_t BucketOfValue(uint64_t value);
+  static uint64_t HighestValueInBucket(size_t bucket);
+
+private:
+  enum { SUB_BUCKET_BITS = 5, SUB_BUCKETS = 1 << SUB_BUCKET_BITS, NUM_EXACT_VALUES = 2*SUB_BUCKETS,
+         NUM_BUCKETS = NUM_EXACT_VALUES + (64 - SUB_BUCKET_BITS - 1)*SUB_BUCKETS };
+
+  std::unique_ptr<std::atomic<uint64_t>[]> counts;
+  std::atomic<uint64_t> max_value{0};
+
+};
+
+#endif
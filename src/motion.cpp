@@ -54,9 +54,11 @@ Vector3 Motion::getPosition(Scalar const& t) const {
 };
 
 Vector3 Motion::getTerminalStopPosition(Scalar const& t) const {
-  Vector3 position_end_of_motion = getPosition(t);
-  Vector3 velocity_end_of_motion = getVelocity(t);
+  return getTerminalStopPosition(getPosition(t), getVelocity(t));
+}
 
+// For callers that already sampled the state at the end of the motion
+Vector3 Motion::getTerminalStopPosition(Vector3 const& position_end_of_motion, Vector3 const& velocity_end_of_motion) const {
   double speed = velocity_end_of_motion.norm();
   
   Vector3 stopping_vector = -velocity_end_of_motion/speed;
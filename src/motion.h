@@ -29,10 +29,12 @@ public:
   void setInitialVelocity(Vector3 const& initial_velocity);
   
   Vector3 getAcceleration() const;
+  double getJerkTime() const {return jerk_time;};
   Vector3 getVelocity(Scalar const& t) const;
   Vector3 getInitialVelocity() const;
   Vector3 getPosition(Scalar const& t) const;
   Vector3 getTerminalStopPosition(Scalar const& t) const;
+  Vector3 getTerminalStopPosition(Vector3 const& position_end_of_motion, Vector3 const& velocity_end_of_motion) const;
 
   void setAccelerationLASER(Vector3 const& acceleration_laser);
   void setInitialAccelerationLASER(Vector3 const& initial_acceleration_laser);
@@ -59,32 +61,33 @@ public:
   
 private:
   
-  Vector3 acceleration;
-  Vector3 initial_velocity;
-  Vector3 initial_acceleration;
-  Vector3 jerk;
-  Vector3 position_end_of_jerk_time;
-  Vector3 velocity_end_of_jerk_time;
-
-  Vector3 acceleration_laser;
-  Vector3 initial_velocity_laser;
-  Vector3 initial_acceleration_laser;
-  Vector3 jerk_laser;
-  Vector3 position_end_of_jerk_time_laser;
-  Vector3 velocity_end_of_jerk_time_laser;
-
-  Vector3 acceleration_rdf;
-  Vector3 initial_velocity_rdf;
-  Vector3 initial_acceleration_rdf;
-  Vector3 jerk_rdf;
-  Vector3 position_end_of_jerk_time_rdf;
-  Vector3 velocity_end_of_jerk_time_rdf;
-
-  double a_max_horizontal;
+  // Zero until set, since the first pose updates the laser and RDF jerk terms before any velocity
+  Vector3 acceleration = Vector3(0,0,0);
+  Vector3 initial_velocity = Vector3(0,0,0);
+  Vector3 initial_acceleration = Vector3(0,0,0);
+  Vector3 jerk = Vector3(0,0,0);
+  Vector3 position_end_of_jerk_time = Vector3(0,0,0);
+  Vector3 velocity_end_of_jerk_time = Vector3(0,0,0);
+
+  Vector3 acceleration_laser = Vector3(0,0,0);
+  Vector3 initial_velocity_laser = Vector3(0,0,0);
+  Vector3 initial_acceleration_laser = Vector3(0,0,0);
+  Vector3 jerk_laser = Vector3(0,0,0);
+  Vector3 position_end_of_jerk_time_laser = Vector3(0,0,0);
+  Vector3 velocity_end_of_jerk_time_laser = Vector3(0,0,0);
+
+  Vector3 acceleration_rdf = Vector3(0,0,0);
+  Vector3 initial_velocity_rdf = Vector3(0,0,0);
+  Vector3 initial_acceleration_rdf = Vector3(0,0,0);
+  Vector3 jerk_rdf = Vector3(0,0,0);
+  Vector3 position_end_of_jerk_time_rdf = Vector3(0,0,0);
+  Vector3 velocity_end_of_jerk_time_rdf = Vector3(0,0,0);
+
+  double a_max_horizontal = 0.0;
   double jerk_time = 0.200;
   double stopping_factor = 0.85;
 
-  Vector3 unscaled_acceleration;
+  Vector3 unscaled_acceleration = Vector3(0,0,0);
 
 };
 
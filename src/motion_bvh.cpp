@@ -0,0 +1,95 @@
+#include "motion_bvh.h"
+#include "depth_image_collision_evaluator.h"
+
+#include <algorithm>
+
+void MotionBVH::Build(std::vector<Vector3> const& accelerations) {
+  nodes.clear();
+  motion_indices.resize(accelerations.size());
+  for (size_t i = 0; i < accelerations.size(); i++) {
+    motion_indices[i] = i;
+  }
+  if (accelerations.size() > 0) {
+    nodes.reserve(2*accelerations.size() - 1);
+    BuildNode(accelerations, 0, accelerations.size());
+  }
+}
+
+// Median split along the widest axis of the accelerations in the range, down to one motion per leaf
+int MotionBVH::BuildNode(std::vector<Vector3> const& accelerations, size_t first, size_t count) {
+  int node_index = nodes.size();
+  Node node;
+  node.first = first;
+  node.count = count;
+  node.left = -1;
+  node.right = -1;
+  nodes.push_back(node);
+  if (count == 1) {
+    return node_index;
+  }
+
+  Eigen::AlignedBox<Scalar, 3> acceleration_box;
+  for (size_t i = first; i < first + count; i++) {
+    acceleration_box.extend(accelerations[motion_indices[i]]);
+  }
+  int axis;
+  acceleration_box.sizes().maxCoeff(&axis);
+
+  size_t half = count / 2;
+  std::nth_element(motion_indices.begin() + first, motion_indices.begin() + first + half, motion_indices.begin() + first + count,
+                   [&accelerations, axis](size_t a, size_t b) { return accelerations[a](axis) < accelerations[b](axis); });
+
+  int left = BuildNode(accelerations, first, half);
+  int right = BuildNode(accelerations, first + half, count - half);
+  nodes[node_index].left = left;
+  nodes[node_index].right = right;
+  return node_index;
+}
+
+void MotionBVH::Refit(std::vector<Eigen::AlignedBox<Scalar, 3> > const& motion_boxes) {
+  for (int node_index = nodes.size() - 1; node_index >= 0; node_index--) {
+    Node &node = nodes[node_index];
+    if (node.left < 0) {
+      node.box = motion_boxes[motion_indices[node.first]];
+    }
+    else {
+      node.box = nodes[node.left].box;
+      node.box.extend(nodes[node.right].box);
+    }
+  }
+}
+
+// Every sample in a node's box is within half its diagonal of the center, so the nearest obstacle
+// to the center bounds the obstacle distance of the whole subtree from below.
+void MotionBVH::FindMotionsBeyondReach(DepthImageCollisionEvaluator &depth_image_collision_evaluator, double reach, std::vector<bool> &motion_beyond_reach) {
+  std::fill(motion_beyond_reach.begin(), motion_beyond_reach.end(), false);
+  num_nodes_queried = 0;
+  if (nodes.size() == 0) {
+    return;
+  }
+
+  traversal_stack.clear();
+  traversal_stack.push_back(0);
+  while (!traversal_stack.empty()) {
+    int node_index = traversal_stack.back();
+    traversal_stack.pop_back();
+    Node const& node = nodes[node_index];
+
+    double distance_to_obstacle = depth_image_collision_evaluator.computeDistanceToNearestObstacle(node.box.center());
+    num_nodes_queried++;
+    if (distance_to_obstacle - 0.5*node.box.diagonal().norm() > reach) {
+      MarkSubtree(node_index, motion_beyond_reach);
+    }
+    else if (node.left >= 0) {
+      traversal_stack.push_back(node.right);
+      traversal_stack.push_back(node.left);
+    }
+  }
+}
+
+void MotionBVH::MarkSubtree(int node_index, std::vector<bool> &motion_beyond_reach) {
+  Node const& node = nodes[node_index];
+  for (size_t i = node.first; i < node.first + node.count; i++) {
+    motion_beyond_reach[motion_indices[i]] = true;
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef MOTION_BVH_H
+#define MOTION_BVH_H
+
+#include "motion.h"
+
+#include <vector>
+
+class DepthImageCollisionEvaluator;
+
+// Bounding volume hierarchy over the swept volumes of a motion library.  The topology groups motions
+// with similar accelerations and is built once; every cycle the boxes are refit to the motions'
+// current swept boxes, since those move with the initial velocity and max acceleration.
+// A single nearest-obstacle query per node can then clear a whole subtree of motions.
+class MotionBVH {
+public:
+
+  void Build(std::vector<Vector3> const& accelerations);
+  void Refit(std::vector<Eigen::AlignedBox<Scalar, 3> > const& motion_boxes);
+
+  // Marks the motions whose samples all stay further than reach from every obstacle
+  void FindMotionsBeyondReach(DepthImageCollisionEvaluator &depth_image_collision_evaluator, double reach, std::vector<bool> &motion_beyond_reach);
+
+  size_t GetNumNodesQueried() const {return num_nodes_queried;};
+
+private:
+  struct Node {
+    Eigen::AlignedBox<Scalar, 3> box;
+    size_t first;  // range of motion_indices covered by this node
+    size_t count;
+    int left;      // children, -1 for leaves
+    int right;
+  };
+
+  int BuildNode(std::vector<Vector3> const& accelerations, size_t first, size_t count);
+  void MarkSubtree(int node_index, std::vector<bool> &motion_beyond_reach);
+
+  std::vector<Node> nodes;  // parents before children, so a reverse sweep refits bottom-up
+  std::vector<size_t> motion_indices;
+  std::vector<int> traversal_stack;
+  size_t num_nodes_queried = 0;
+
+};
+
+#endif
@@ -5,9 +5,20 @@ void MotionLibrary::InitializeLibrary(bool use_3d_library, double acceleration_i
     this->speed_at_acceleration_max = speed_at_acceleration_max;
     this->max_acceleration_total = max_acceleration_total;
 	this->initial_max_acceleration = acceleration_interpolation_min;
+	this->new_max_acceleration = acceleration_interpolation_min;
 	
 	Vector3 zero_initial_velocity = Vector3(0,0,0);
 
+	if (library_file) {
+		for (size_t index = 0; index < library_file->getNumMotions(); index++) {
+			motions.push_back(Motion( library_file->getAcceleration(0, index), zero_initial_velocity ));
+		}
+		for (size_t index = 0; index < motions.size(); index++) {
+			motions.at(index).setAccelerationMax(acceleration_interpolation_min);
+		}
+		return;
+	}
+
 	// Optimal motion (ignoring obstacles) is 0th motion, initialize to 0 acceleration but this gets recalculated in motion_selector_node
 	Vector3 acceleration = Vector3(0,0,0);
 	motions.push_back(Motion( acceleration, zero_initial_velocity ));
@@ -17,15 +28,14 @@ void MotionLibrary::InitializeLibrary(bool use_3d_library, double acceleration_i
 	motions.push_back(Motion( acceleration, zero_initial_velocity ));
 
 	// Then build up more motions by sampling over accelerations
-	std::vector<double> horizontal_accelerations = {initial_max_acceleration, 0.6*initial_max_acceleration, 0.15*initial_max_acceleration};
+	std::vector<double> horizontal_accelerations;
+	for (size_t i = 0; i < horizontal_acceleration_fractions.size(); i++) {
+		horizontal_accelerations.push_back(horizontal_acceleration_fractions.at(i)*initial_max_acceleration);
+	}
 	std::vector<double> vertical_accelerations = {0.0};
-	size_t num_samples_around_circle = 8;
 
 	if (use_3d_library) {
-		vertical_accelerations.push_back(-2.0);
-		vertical_accelerations.push_back(-0.75);
-		vertical_accelerations.push_back(0.75);
-		vertical_accelerations.push_back(2.0);
+		vertical_accelerations.insert(vertical_accelerations.end(), vertical_accelerations_3d.begin(), vertical_accelerations_3d.end());
 	}
 
 	for (size_t i = 0; i < vertical_accelerations.size(); i++) {
@@ -39,6 +49,23 @@ void MotionLibrary::InitializeLibrary(bool use_3d_library, double acceleration_i
 	}
 };
 
+bool MotionLibrary::LoadLibraryFile(std::string const& path, std::string &error) {
+	std::shared_ptr<MotionLibraryFile> file = std::make_shared<MotionLibraryFile>();
+	if (!file->Open(path)) {
+		error = file->GetError();
+		return false;
+	}
+	library_file = file;
+	speed_bin = 0;
+	return true;
+}
+
+void MotionLibrary::SetAccelerationGrid(std::vector<double> const& horizontal_acceleration_fractions, std::vector<double> const& vertical_accelerations_3d, size_t num_samples_around_circle) {
+	this->horizontal_acceleration_fractions = horizontal_acceleration_fractions;
+	this->vertical_accelerations_3d = vertical_accelerations_3d;
+	this->num_samples_around_circle = num_samples_around_circle;
+}
+
 void MotionLibrary::BuildMotionsSamplingAroundHorizontalCircle(double vertical_acceleration, double horizontal_acceleration_radius, size_t num_samples_around_circle) {
 	for (double i = 0; i < num_samples_around_circle; i++) {
 		double theta = i*2*M_PI/num_samples_around_circle;
@@ -50,10 +77,18 @@ void MotionLibrary::BuildMotionsSamplingAroundHorizontalCircle(double vertical_a
 
 void MotionLibrary::UpdateMaxAcceleration(double speed) {
 	new_max_acceleration = ComputeNewMaxAcceleration(speed);
+	if (library_file) {
+		speed_bin = library_file->getSpeedBin(speed);
+	}
 	for (size_t index = 0; index < motions.size(); index++) {
 		motions.at(index).setAccelerationMax(new_max_acceleration);
 		if (index != 0) {
-			motions.at(index).ScaleAcceleration(new_max_acceleration/initial_max_acceleration);
+			if (library_file) {
+				motions.at(index).setAcceleration(library_file->getAcceleration(speed_bin, index));
+			}
+			else {
+				motions.at(index).ScaleAcceleration(new_max_acceleration/initial_max_acceleration);
+			}
 		}
 	}
 }
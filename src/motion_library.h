@@ -2,7 +2,9 @@
 #define MOTION_LIBRARY_H
 
 #include "motion.h"
+#include "motion_library_file.h"
 #include <vector>
+#include <memory>
 
 #include <string>
 #include <map>
@@ -14,6 +16,18 @@ class MotionLibrary {
 public:
 
   void InitializeLibrary(bool use_3d_library, double a_max_horizontal, double, double);
+  // Rings of num_samples_around_circle motions at each fraction of the max horizontal acceleration,
+  // repeated at zero and (3D library only) each vertical acceleration.  Set before InitializeLibrary.
+  void SetAccelerationGrid(std::vector<double> const& horizontal_acceleration_fractions, std::vector<double> const& vertical_accelerations_3d, size_t num_samples_around_circle);
+  // Takes the motions from a generated library file instead of the acceleration grid, switching to the
+  // file's accelerations for the current speed bin in UpdateMaxAcceleration.  Load before InitializeLibrary.
+  bool LoadLibraryFile(std::string const& path, std::string &error);
+  MotionLibraryFile const* GetLibraryFile() const {
+    return library_file.get();
+  };
+  size_t GetSpeedBin() const {
+    return speed_bin;
+  };
   void BuildMotionsSamplingAroundHorizontalCircle(double vertical_acceleration, double horizontal_acceleration_radius, size_t num_samples_around_circle);
 
   void setInitialVelocity(Vector3 const& initialVelocity);
@@ -31,6 +45,9 @@ public:
   Vector3 getInitialAcceleration() const{
     return initial_acceleration;
   }
+  Vector3 getInitialVelocity() const{
+    return initial_velocity;
+  }
 
   void setMaxAccelerationTotal(double max_accel);
   void setMinSpeedAtMaxAccelerationTotal(double speed);
@@ -104,6 +121,13 @@ private:
   double speed_at_acceleration_max = 5.0;
   double max_acceleration_total = 4.0;
 
+  std::vector<double> horizontal_acceleration_fractions = {1.0, 0.6, 0.15};
+  std::vector<double> vertical_accelerations_3d = {-2.0, -0.75, 0.75, 2.0};
+  size_t num_samples_around_circle = 8;
+
+  std::shared_ptr<MotionLibraryFile> library_file;
+  size_t speed_bin = 0;
+
 };
 
 #endif
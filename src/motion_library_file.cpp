@@ -0,0 +1,172 @@
+#include "motion_library_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+// Whether num_items items of item_size bytes fit in the file from an aligned offset past the
+// header, checked without any product or sum that could overflow
+static bool SectionFits(uint64_t offset, uint64_t num_items, uint64_t item_size, uint64_t file_size) {
+  return offset % 8 == 0 && offset >= sizeof(MotionLibraryFileHeader) && offset <= file_size && num_items <= (file_size - offset) / item_size;
+}
+
+MotionLibraryFile::~MotionLibraryFile() {
+  Close();
+}
+
+bool MotionLibraryFile::Open(std::string const& path) {
+  Close();
+  fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Fail("cannot open " + path);
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(MotionLibraryFileHeader)) {
+    return Fail(path + " is too small to be a motion library");
+  }
+  size = file_stat.st_size;
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    data = nullptr;
+    return Fail("cannot map " + path);
+  }
+  data = static_cast<unsigned char const*>(mapping);
+  header = reinterpret_cast<MotionLibraryFileHeader const*>(data);
+
+  if (memcmp(header->magic, motion_library_file_magic, sizeof(header->magic)) != 0 || header->version != motion_library_file_version) {
+    return Fail(path + " is not a version " + std::to_string(motion_library_file_version) + " motion library");
+  }
+  if (header->file_size != size || header->num_motions == 0 || header->num_samples == 0 || header->num_speed_bins == 0 ||
+      !(header->jerk_time > 0.0f)) {
+    return Fail(path + " has an inconsistent header");
+  }
+  uint64_t bins_motions = (uint64_t)header->num_speed_bins * header->num_motions;
+  if (!SectionFits(header->sample_times_offset, header->num_samples, sizeof(float), size) ||
+      !SectionFits(header->speed_bins_offset, header->num_speed_bins, sizeof(float), size) ||
+      !SectionFits(header->accelerations_offset, bins_motions, sizeof(float)*3, size) ||
+      !SectionFits(header->swept_bounds_offset, bins_motions, sizeof(float)*6, size)) {
+    return Fail(path + " has a section outside the file");
+  }
+  return true;
+}
+
+void MotionLibraryFile::Close() {
+  if (data != nullptr) {
+    munmap(const_cast<unsigned char*>(data), size);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  fd = -1;
+  data = nullptr;
+  size = 0;
+  header = nullptr;
+}
+
+bool MotionLibraryFile::Fail(std::string const& message) {
+  Close();
+  error = message;
+  return false;
+}
+
+double MotionLibraryFile::getSampleTime(size_t sample_index) const {
+  return Section(header->sample_times_offset)[sample_index];
+}
+
+// Bin with the largest lower speed not above the given speed
+size_t MotionLibraryFile::getSpeedBin(double speed) const {
+  float const* speed_bins = Section(header->speed_bins_offset);
+  size_t speed_bin = 0;
+  while (speed_bin + 1 < header->num_speed_bins && speed >= speed_bins[speed_bin + 1]) {
+    speed_bin++;
+  }
+  return speed_bin;
+}
+
+Vector3 MotionLibraryFile::getAcceleration(size_t speed_bin, size_t motion_index) const {
+  float const* acceleration = Section(header->accelerations_offset) + 3*(speed_bin*header->num_motions + motion_index);
+  return Vector3(acceleration[0], acceleration[1], acceleration[2]);
+}
+
+Eigen::AlignedBox<Scalar, 3> MotionLibraryFile::getSweptBounds(size_t speed_bin, size_t motion_index) const {
+  float const* bounds = Section(header->swept_bounds_offset) + 6*(speed_bin*header->num_motions + motion_index);
+  return Eigen::AlignedBox<Scalar, 3>(Vector3(bounds[0], bounds[1], bounds[2]), Vector3(bounds[3], bounds[4], bounds[5]));
+}
+
+// Swept bounds come from the same Motion code used in flight, with zero initial velocity and
+// acceleration.  Bounds are rounded outwards so they still contain the double precision samples.
+bool MotionLibraryFile::Write(std::string const& path, std::vector<double> const& sample_times, std::vector<double> const& speed_bins,
+                              std::vector<std::vector<Vector3> > const& accelerations) {
+  if (sample_times.empty() || speed_bins.empty() || accelerations.size() != speed_bins.size() || accelerations.at(0).empty()) {
+    return false;
+  }
+  size_t num_samples = sample_times.size();
+  size_t num_speed_bins = speed_bins.size();
+  size_t num_motions = accelerations.at(0).size();
+
+  std::vector<float> sample_times_section(sample_times.begin(), sample_times.end());
+  std::vector<float> speed_bins_section(speed_bins.begin(), speed_bins.end());
+  std::vector<float> accelerations_section;
+  std::vector<float> swept_bounds_section;
+  const float infinity = std::numeric_limits<float>::infinity();
+  for (size_t speed_bin = 0; speed_bin < num_speed_bins; speed_bin++) {
+    if (accelerations.at(speed_bin).size() != num_motions) {
+      return false;
+    }
+    for (size_t motion_index = 0; motion_index < num_motions; motion_index++) {
+      Vector3 acceleration = accelerations.at(speed_bin).at(motion_index).cast<float>().cast<Scalar>();
+      Motion motion(acceleration, Vector3(0,0,0));
+      motion.setInitialAcceleration(Vector3(0,0,0));
+      Eigen::AlignedBox<Scalar, 3> bounds;
+      for (size_t i = 0; i < 3; i++) {
+        accelerations_section.push_back(acceleration(i));
+      }
+      for (size_t sample_index = 0; sample_index < num_samples; sample_index++) {
+        bounds.extend(motion.getPosition(sample_times.at(sample_index)));
+      }
+      for (size_t i = 0; i < 3; i++) {
+        swept_bounds_section.push_back(std::nextafter((float)bounds.min()(i), -infinity));
+      }
+      for (size_t i = 0; i < 3; i++) {
+        swept_bounds_section.push_back(std::nextafter((float)bounds.max()(i), infinity));
+      }
+    }
+  }
+
+  MotionLibraryFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, motion_library_file_magic, sizeof(header.magic));
+  header.version = motion_library_file_version;
+  header.num_motions = num_motions;
+  header.num_samples = num_samples;
+  header.num_speed_bins = num_speed_bins;
+  header.jerk_time = Motion().getJerkTime();
+
+  std::vector<float> const* sections[4] = {&sample_times_section, &speed_bins_section, &accelerations_section, &swept_bounds_section};
+  uint64_t* section_offsets[4] = {&header.sample_times_offset, &header.speed_bins_offset, &header.accelerations_offset, &header.swept_bounds_offset};
+  uint64_t offset = sizeof(MotionLibraryFileHeader);
+  for (size_t i = 0; i < 4; i++) {
+    offset = (offset + 7) / 8 * 8;
+    *section_offsets[i] = offset;
+    offset += sizeof(float)*sections[i]->size();
+  }
+  header.file_size = offset;
+
+  std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file) {
+    return false;
+  }
+  file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+  for (size_t i = 0; i < 4; i++) {
+    std::vector<char> padding(*section_offsets[i] - file.tellp(), 0);
+    file.write(padding.data(), padding.size());
+    file.write(reinterpret_cast<char const*>(sections[i]->data()), sizeof(float)*sections[i]->size());
+  }
+  return file.good();
+}
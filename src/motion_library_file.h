@@ -0,0 +1,81 @@
+#ifndef MOTION_LIBRARY_FILE_H
+#define MOTION_LIBRARY_FILE_H
+
+#include "motion.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// On-disk motion library, written by motion_library_generator and memory-mapped read-only so
+// processes loading the same file share its pages.
+//
+// All sections are little-endian float arrays at 8-byte aligned offsets:
+//   sample_times        [num_samples]
+//   speed_bins          [num_speed_bins]                                  ascending lower speed of each bin
+//   accelerations       [num_speed_bins][num_motions][3]
+//   swept_bounds        [num_speed_bins][num_motions][6]                  min xyz, max xyz of the samples
+//
+// Swept bounds are taken over the positions from the acceleration alone.  Motion positions are
+// linear in acceleration, initial acceleration and initial velocity, so a sample is that position
+// plus a term shared by every motion, and the bounds stay valid once that term's bounds are added.
+// They also depend on the jerk time of the Motion that wrote them, which the header records.
+// Version 1 also stored the sample positions themselves, which nothing read.
+struct MotionLibraryFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_motions;
+  uint32_t num_samples;
+  uint32_t num_speed_bins;
+  float jerk_time;
+  float reserved;
+  uint64_t sample_times_offset;
+  uint64_t speed_bins_offset;
+  uint64_t accelerations_offset;
+  uint64_t swept_bounds_offset;
+  uint64_t file_size;
+};
+
+const char motion_library_file_magic[8] = {'M', 'P', 'L', 'I', 'B', 'R', 'A', 'R'};
+const uint32_t motion_library_file_version = 2;
+
+class MotionLibraryFile {
+public:
+
+  MotionLibraryFile() {};
+  ~MotionLibraryFile();
+  MotionLibraryFile(MotionLibraryFile const&) = delete;
+  MotionLibraryFile& operator=(MotionLibraryFile const&) = delete;
+
+  bool Open(std::string const& path);
+  void Close();
+  std::string const& GetError() const {return error;};
+
+  size_t getNumMotions() const {return header->num_motions;};
+  size_t getNumSamples() const {return header->num_samples;};
+  size_t getNumSpeedBins() const {return header->num_speed_bins;};
+  double getJerkTime() const {return header->jerk_time;};
+
+  double getSampleTime(size_t sample_index) const;
+  size_t getSpeedBin(double speed) const;
+  Vector3 getAcceleration(size_t speed_bin, size_t motion_index) const;
+  Eigen::AlignedBox<Scalar, 3> getSweptBounds(size_t speed_bin, size_t motion_index) const;
+
+  static bool Write(std::string const& path, std::vector<double> const& sample_times, std::vector<double> const& speed_bins,
+                    std::vector<std::vector<Vector3> > const& accelerations);
+
+private:
+  bool Fail(std::string const& message);
+  float const* Section(uint64_t offset) const {
+    return reinterpret_cast<float const*>(data + offset);
+  }
+
+  int fd = -1;
+  unsigned char const* data = nullptr;
+  size_t size = 0;
+  MotionLibraryFileHeader const* header = nullptr;
+  std::string error;
+
+};
+
+#endif
@@ -0,0 +1,83 @@
+// Writes a motion library file for the motion_library_file node parameter.
+//
+//   motion_library_generator output.mplib [--use_3d_library=0] [--final_time=1.0]
+//     [--acceleration_interpolation_min=2.5] [--speed_at_acceleration_max=10.0] [--acceleration_interpolation_max=7.5]
+//     [--horizontal_fractions=1.0,0.6,0.15] [--vertical_accelerations=-2.0,-0.75,0.75,2.0] [--samples_around_circle=8]
+//     [--speed_bin_width=0.25]
+//
+// The acceleration options must match the node's parameters, since each speed bin stores the library
+// as UpdateMaxAcceleration would scale it at the bin's lower speed.
+
+#include "motion_selector.h"
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+std::vector<double> ParseList(std::string const& value) {
+  std::vector<double> list;
+  std::stringstream stream(value);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    list.push_back(std::stod(item));
+  }
+  return list;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "usage: motion_library_generator output.mplib [--option=value ...]" << std::endl;
+    return 1;
+  }
+  std::string output_path = argv[1];
+
+  std::map<std::string, std::string> options = {
+    {"use_3d_library", "0"}, {"final_time", "1.0"},
+    {"acceleration_interpolation_min", "2.5"}, {"speed_at_acceleration_max", "10.0"}, {"acceleration_interpolation_max", "7.5"},
+    {"horizontal_fractions", "1.0,0.6,0.15"}, {"vertical_accelerations", "-2.0,-0.75,0.75,2.0"}, {"samples_around_circle", "8"},
+    {"speed_bin_width", "0.25"}};
+  for (int i = 2; i < argc; i++) {
+    std::string argument = argv[i];
+    size_t equals = argument.find('=');
+    if (argument.compare(0, 2, "--") != 0 || equals == std::string::npos || options.count(argument.substr(2, equals - 2)) == 0) {
+      std::cerr << "unknown option " << argument << std::endl;
+      return 1;
+    }
+    options[argument.substr(2, equals - 2)] = argument.substr(equals + 1);
+  }
+
+  bool use_3d_library = std::stoi(options["use_3d_library"]) != 0;
+  double speed_at_acceleration_max = std::stod(options["speed_at_acceleration_max"]);
+  double speed_bin_width = std::stod(options["speed_bin_width"]);
+  if (speed_bin_width <= 0.0) {
+    std::cerr << "speed_bin_width must be positive" << std::endl;
+    return 1;
+  }
+
+  MotionSelector motion_selector;
+  MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
+  motion_library_ptr->SetAccelerationGrid(ParseList(options["horizontal_fractions"]), ParseList(options["vertical_accelerations"]), std::stoi(options["samples_around_circle"]));
+  motion_selector.InitializeLibrary(use_3d_library, std::stod(options["final_time"]), 0.0, std::stod(options["acceleration_interpolation_min"]),
+                                    speed_at_acceleration_max, std::stod(options["acceleration_interpolation_max"]));
+
+  // Above speed_at_acceleration_max the accelerations stop changing, so one more bin covers all faster speeds
+  std::vector<double> speed_bins;
+  std::vector<std::vector<Vector3> > accelerations;
+  for (double speed = 0.0; speed <= speed_at_acceleration_max + speed_bin_width; speed += speed_bin_width) {
+    motion_library_ptr->UpdateMaxAcceleration(speed);
+    speed_bins.push_back(speed);
+    accelerations.push_back(std::vector<Vector3>());
+    for (auto motion = motion_library_ptr->GetMotionIteratorBegin(); motion != motion_library_ptr->GetMotionIteratorEnd(); motion++) {
+      accelerations.back().push_back(motion->getAcceleration());
+    }
+  }
+
+  if (!MotionLibraryFile::Write(output_path, motion_selector.getCollisionSamplingTimes(), speed_bins, accelerations)) {
+    std::cerr << "failed to write " << output_path << std::endl;
+    return 1;
+  }
+  std::cout << "Wrote " << motion_selector.getNumMotions() << " motions in " << speed_bins.size() << " speed bins to " << output_path << std::endl;
+  return 0;
+}
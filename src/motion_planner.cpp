@@ -0,0 +1,342 @@
+#include "motion_planner.h"
+#include "flight_log.h"
+
+#include <iostream>
+
+bool MotionPlanner::Configure(MotionPlannerConfig const& config, std::string &error) {
+  this->config = config;
+  MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
+  motion_library_ptr->SetAccelerationGrid(config.acceleration_grid_horizontal_fractions, config.acceleration_grid_vertical_accelerations,
+                                          config.acceleration_grid_samples_around_circle);
+
+  // A generated library file replaces the grid; it must have been generated with the same acceleration parameters
+  bool library_file_loaded = config.motion_library_file.empty() || motion_library_ptr->LoadLibraryFile(config.motion_library_file, error);
+
+  motion_selector.InitializeLibrary(config.use_3d_library, config.final_time, config.soft_top_speed, config.acceleration_interpolation_min,
+                                    config.speed_at_acceleration_max, config.acceleration_interpolation_max);
+  motion_selector.SetNominalFlightAltitude(config.flight_altitude);
+  motion_selector.SetRefinementTimeBudget(config.refinement_time_budget);
+  motion_selector.SetCollisionReuseTolerance(config.collision_reuse_tolerance);
+  motion_selector.SetMotionBVHCulling(config.use_motion_bvh);
+
+  // The node projects the laser scan to z=0 for the 2D library, so use the planar lookup table for it
+  DepthImageCollisionEvaluator* depth_image_collision_ptr = motion_selector.GetDepthImageCollisionEvaluatorPtr();
+  depth_image_collision_ptr->SetPlanarLaser(!config.use_3d_library);
+  depth_image_collision_ptr->SetPlanarLaserGridExtent(config.laser_grid_half_width, config.laser_grid_resolution);
+
+  // Camera model and speed-dependent depth image resolution
+  depth_image_collision_ptr->SetCameraModel(config.camera_fx, config.camera_fy, config.camera_cx, config.camera_cy,
+                                            config.camera_width, config.camera_height, config.depth_image_decimation);
+  depth_image_collision_ptr->SetDepthPyramidSpeeds(config.depth_pyramid_speeds);
+  return library_file_loaded;
+}
+
+void MotionPlanner::SetFlightLog(FlightLogWriter* flight_log) {
+  this->flight_log = flight_log;
+  if (flight_log != nullptr) {
+    flight_log->WriteConfig(config);
+  }
+}
+
+void MotionPlanner::SetLaserExtrinsic(Eigen::Isometry3d const& body_to_laser) {
+  laser_extrinsic.is_set = true;
+  laser_extrinsic.body_to_sensor = body_to_laser;
+  if (flight_log != nullptr) {
+    flight_log->WriteExtrinsic(FLIGHT_LOG_LASER_EXTRINSIC, body_to_laser);
+  }
+}
+
+void MotionPlanner::SetDepthCameraExtrinsic(Eigen::Isometry3d const& body_to_rdf) {
+  rdf_extrinsic.is_set = true;
+  rdf_extrinsic.body_to_sensor = body_to_rdf;
+  if (flight_log != nullptr) {
+    flight_log->WriteExtrinsic(FLIGHT_LOG_DEPTH_CAMERA_EXTRINSIC, body_to_rdf);
+  }
+}
+
+void MotionPlanner::ApplyPose(Vector3 const& position, double roll, double pitch, double yaw) {
+  if (flight_log != nullptr) {
+    flight_log->WritePose(position, roll, pitch, yaw);
+  }
+  UpdateOrthoBodyFrames(position, roll, pitch, yaw);
+  motion_selector.GetMotionLibraryPtr()->setRollPitch(roll, pitch);
+  UpdateCarrotOrthoBodyFrame();
+  UpdateLaserRDFFramesFromPose();
+  ComputeBestAccelerationMotion();
+  pose_global = position;
+  pose_global_yaw = yaw;
+}
+
+void MotionPlanner::ApplyVelocity(Vector3 const& velocity_world_frame) {
+  Vector3 velocity_ortho_body_frame = ortho_body_frames.world_to_ortho_body.linear() * velocity_world_frame;
+  velocity_ortho_body_frame(2) = 0.0;  // WARNING for 2D only
+
+  MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
+  motion_library_ptr->setInitialVelocity(velocity_ortho_body_frame);
+  motion_library_ptr->setInitialVelocityLASER(transformOrthoBodyIntoLaserFrame(velocity_ortho_body_frame));
+  motion_library_ptr->setInitialVelocityRDF(transformOrthoBodyIntoRDFFrame(velocity_ortho_body_frame));
+  double speed = velocity_ortho_body_frame.norm();
+  motion_library_ptr->UpdateMaxAcceleration(speed);
+
+  // Logged under the lock, since the speed picks the depth pyramid level the next depth image is indexed at
+  std::lock_guard<std::mutex> lock(selector_mutex);
+  if (flight_log != nullptr) {
+    flight_log->WriteVector(FLIGHT_LOG_VELOCITY, velocity_world_frame);
+  }
+  motion_selector.GetDepthImageCollisionEvaluatorPtr()->UpdateSpeed(speed);
+}
+
+void MotionPlanner::ApplyLocalGoal(Vector3 const& goal_world_frame) {
+  if (flight_log != nullptr) {
+    flight_log->WriteVector(FLIGHT_LOG_LOCAL_GOAL, goal_world_frame);
+  }
+  carrot_world_frame = goal_world_frame;
+  UpdateCarrotOrthoBodyFrame();
+}
+
+void MotionPlanner::UpdateDepthImage(pcl::PointCloud<pcl::PointXYZ>::Ptr const& ortho_body_cloud, Matrix3 const& ortho_body_to_rdf) {
+  std::string payload;
+  if (flight_log != nullptr) {
+    payload = FlightLogWriter::EncodeDepthImage(*ortho_body_cloud, ortho_body_to_rdf);
+  }
+  std::lock_guard<std::mutex> lock(selector_mutex);
+  if (flight_log != nullptr) {
+    flight_log->WriteRecord(FLIGHT_LOG_DEPTH_IMAGE, payload);
+  }
+  DepthImageCollisionEvaluator* depth_image_collision_ptr = motion_selector.GetDepthImageCollisionEvaluatorPtr();
+  depth_image_collision_ptr->UpdateRotationMatrix(ortho_body_to_rdf);
+  depth_image_collision_ptr->UpdatePointCloudPtr(ortho_body_cloud);
+}
+
+void MotionPlanner::UpdateLaserScan(pcl::PointCloud<pcl::PointXYZ>::Ptr const& ortho_body_cloud) {
+  std::string payload;
+  if (flight_log != nullptr) {
+    payload = FlightLogWriter::EncodeLaserScan(*ortho_body_cloud);
+  }
+  std::lock_guard<std::mutex> lock(selector_mutex);
+  if (flight_log != nullptr) {
+    flight_log->WriteRecord(FLIGHT_LOG_LASER_SCAN, payload);
+  }
+  motion_selector.GetDepthImageCollisionEvaluatorPtr()->UpdateLaserPointCloudPtr(ortho_body_cloud);
+}
+
+MotionPlanner::Plan MotionPlanner::ComputePlan(double now, std::chrono::steady_clock::time_point const& deadline, double library_thrust,
+                                               size_t max_motions_evaluated, size_t max_refinement_samples) {
+  motion_selector.GetMotionLibraryPtr()->setThrust(library_thrust);
+  double planning_budget = 0.0;
+  if (deadline != std::chrono::steady_clock::time_point::max()) {
+    planning_budget = std::chrono::duration<double>(deadline - std::chrono::steady_clock::now()).count();
+  }
+
+  // Only the map stage's index updates wait on this
+  std::vector<double> hokuyo_collision_probabilities;
+  selector_mutex.lock();
+  if (config.use_dijkstra) {
+    motion_selector.computeBestDijkstraMotion(carrot_ortho_body_frame, carrot_world_frame, ortho_body_frames.ortho_body_to_world, best_traj_index, desired_acceleration);
+    num_motions_evaluated = motion_selector.getNumMotions();
+    num_refinement_samples = 0;
+  }
+  else {
+    motion_selector.computeBestEuclideanMotion(carrot_ortho_body_frame, deadline, max_motions_evaluated, max_refinement_samples, best_traj_index, desired_acceleration);
+    num_motions_evaluated = motion_selector.getNumMotionsEvaluated();
+    num_refinement_samples = motion_selector.getNumRefinementSamples();
+  }
+  // Written once the number of motions and refinement samples the deadline allowed is known, still
+  // under the lock so no cloud update can land between the plan and the inputs it used
+  if (flight_log != nullptr) {
+    flight_log->WritePlan(now, library_thrust, planning_budget, num_motions_evaluated, num_refinement_samples);
+  }
+  best_motion = motion_selector.getSelectedMotion();
+  collision_probabilities = motion_selector.getCollisionProbabilities();
+  hokuyo_collision_probabilities = motion_selector.getHokuyoCollisionProbabilities();
+  selector_mutex.unlock();
+
+  Plan plan;
+  if (executing_e_stop || CheckIfInevitableCollision(hokuyo_collision_probabilities)) {
+    ExecuteEStop(now);
+  }
+  else if (config.yaw_on) {
+    SetYawFromMotion(plan);
+  }
+
+  plan.best_traj_index = best_traj_index;
+  plan.desired_acceleration = desired_acceleration;
+  if (config.use_3d_library) {
+    plan.has_z_setpoint = true;
+    plan.z_setpoint = AltitudeSetpointOfBestMotion();
+  }
+  if (flight_log != nullptr) {
+    flight_log->WritePlanResult(plan.best_traj_index, plan.desired_acceleration);
+  }
+  return plan;
+}
+
+void MotionPlanner::UpdateOrthoBodyFrames(Vector3 const& position, double roll, double pitch, double yaw) {
+  ortho_body_frames.ortho_body_to_world = OrthoBodyToWorld(position, roll, pitch, yaw);
+  ortho_body_frames.world_to_ortho_body = ortho_body_frames.ortho_body_to_world.inverse(Eigen::Isometry);
+  UpdateOrthoBodyToSensor(laser_extrinsic, roll, pitch, ortho_body_frames.ortho_body_to_laser);
+  UpdateOrthoBodyToSensor(rdf_extrinsic, roll, pitch, ortho_body_frames.ortho_body_to_rdf);
+}
+
+void MotionPlanner::UpdateOrthoBodyToSensor(SensorExtrinsic const& extrinsic, double roll, double pitch, Eigen::Isometry3d &ortho_body_to_sensor) {
+  if (!extrinsic.is_set) {
+    return;
+  }
+  Eigen::Isometry3d ortho_body_to_body = Eigen::Isometry3d::Identity();
+  ortho_body_to_body.rotate(OrthoBodyRotationInBody(roll, pitch));
+  ortho_body_to_sensor = extrinsic.body_to_sensor * ortho_body_to_body;
+}
+
+void MotionPlanner::UpdateCarrotOrthoBodyFrame() {
+  carrot_ortho_body_frame = ortho_body_frames.world_to_ortho_body * carrot_world_frame;
+}
+
+void MotionPlanner::UpdateLaserRDFFramesFromPose() {
+  transformAccelerationsIntoLaserRDFFrames();
+  MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
+  Vector3 initial_acceleration = motion_library_ptr->getInitialAcceleration();
+  motion_library_ptr->setInitialAccelerationLASER(transformOrthoBodyIntoLaserFrame(initial_acceleration));
+  motion_library_ptr->setInitialAccelerationRDF(transformOrthoBodyIntoRDFFrame(initial_acceleration));
+}
+
+void MotionPlanner::transformAccelerationsIntoLaserRDFFrames() {
+  MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
+  std::vector<Motion>::iterator motion_iterator_begin = motion_library_ptr->GetMotionNonConstIteratorBegin();
+  std::vector<Motion>::iterator motion_iterator_end = motion_library_ptr->GetMotionNonConstIteratorEnd();
+  for (auto motion = motion_iterator_begin; motion != motion_iterator_end; motion++) {
+    Vector3 acceleration_ortho_body = motion->getAcceleration();
+    motion->setAccelerationLASER(transformOrthoBodyIntoLaserFrame(acceleration_ortho_body));
+    motion->setAccelerationRDF(transformOrthoBodyIntoRDFFrame(acceleration_ortho_body));
+  }
+}
+
+void MotionPlanner::ComputeBestAccelerationMotion() {
+  if (executing_e_stop) { //Does not compute if executing e stop
+    return;
+  }
+  MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
+
+  // compute best acceleration in open field
+  double time_to_eval = 0.5;
+  Vector3 initial_velocity_ortho_body = motion_library_ptr->getMotionFromIndex(best_traj_index).getVelocity(0.0);
+  Vector3 position_if_dont_accel = initial_velocity_ortho_body*time_to_eval;
+  Vector3 vector_towards_goal = (carrot_ortho_body_frame - position_if_dont_accel);
+  Vector3 best_acceleration = ((vector_towards_goal/vector_towards_goal.norm()) * config.soft_top_speed - initial_velocity_ortho_body) / time_to_eval;
+  double current_max_acceleration = motion_library_ptr->getNewMaxAcceleration();
+  if (best_acceleration.norm() > current_max_acceleration) {
+    best_acceleration = best_acceleration * current_max_acceleration / best_acceleration.norm();
+  }
+  motion_library_ptr->setBestAccelerationMotion(best_acceleration);
+
+  // if within stopping distance, line search for best stopping acceleration
+  Vector3 stop_position = motion_library_ptr->getMotionFromIndex(0).getTerminalStopPosition(0.5);
+  double stop_distance = stop_position.dot(vector_towards_goal/vector_towards_goal.norm());
+  double distance_to_carrot = carrot_ortho_body_frame(0);
+
+  int max_line_searches = 10;
+  int counter_line_searches = 0;
+  while ( (stop_distance > distance_to_carrot) && (counter_line_searches < max_line_searches) ) {
+    best_acceleration = best_acceleration * distance_to_carrot / stop_distance;
+    if (best_acceleration.norm() > current_max_acceleration) {
+      best_acceleration = best_acceleration * current_max_acceleration / best_acceleration.norm();
+    }
+    motion_library_ptr->setBestAccelerationMotion(best_acceleration);
+    stop_position = motion_library_ptr->getMotionFromIndex(0).getTerminalStopPosition(0.5);
+    stop_distance = stop_position.dot(vector_towards_goal/vector_towards_goal.norm());
+    counter_line_searches++;
+  }
+}
+
+void MotionPlanner::ExecuteEStop(double now) {
+  best_traj_index = 0; // this overwrites the "best acceleration motion"
+
+  MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
+  // If first time entering e stop, compute open loop parameters
+  if (!executing_e_stop) {
+    begin_e_stop_time = now;
+    double e_stop_acceleration_magnitude = 9.8*tan(config.max_e_stop_pitch_degrees * M_PI / 180.0);
+    Vector3 initial_velocity_ortho_body = motion_library_ptr->getMotionFromIndex(best_traj_index).getVelocity(0.0);
+    Vector3 e_stop_acceleration = -1.0 * e_stop_acceleration_magnitude * initial_velocity_ortho_body/initial_velocity_ortho_body.norm();
+    motion_library_ptr->setBestAccelerationMotion(e_stop_acceleration);
+    Vector3 end_jerk_velocity_ortho_body = motion_library_ptr->getMotionFromIndex(best_traj_index).getVelocity(0.2);
+
+    e_stop_time_needed = end_jerk_velocity_ortho_body.norm() / e_stop_acceleration_magnitude / 0.85;
+    std::cout << "E STOP TIME NEEDED " << e_stop_time_needed << std::endl;
+  }
+  executing_e_stop = true;
+  best_motion = motion_library_ptr->getMotionFromIndex(best_traj_index);
+  desired_acceleration = best_motion.getAcceleration();
+
+  // Check if time to exit open loop e stop
+  double e_stop_time_elapsed = now - begin_e_stop_time;
+  std::cout << "E STOP TIME ELAPSED " << e_stop_time_elapsed << std::endl;
+  if (e_stop_time_elapsed > e_stop_time_needed) {
+    executing_e_stop = false;
+  }
+}
+
+void MotionPlanner::SetYawFromMotion(Plan &plan) {
+  // get position at t=0
+  Vector3 initial_position_ortho_body = best_motion.getPosition(0.0);
+  // get velocity at t=0
+  Vector3 initial_velocity_ortho_body = best_motion.getVelocity(0.5);
+  Vector3 final_velocity_ortho_body = best_motion.getVelocity(0.5);
+  // normalize velocity
+  double speed_initial = initial_velocity_ortho_body.norm();
+  double speed_final = final_velocity_ortho_body.norm();
+  if (speed_final != 0) {
+    final_velocity_ortho_body = final_velocity_ortho_body / speed_final;
+  }
+
+  // add normalized velocity to position to get a future position
+  Vector3 final_position_ortho_body = initial_position_ortho_body + initial_velocity_ortho_body;
+  // yaw towards future position using below
+  Vector3 final_position_world = ortho_body_frames.ortho_body_to_world * final_position_ortho_body;
+
+  if (speed_initial < 2.0 && carrot_ortho_body_frame.norm() < 2.0) {
+    motion_selector.SetSoftTopSpeed(config.soft_top_speed);
+    return;
+  }
+  if ((final_position_world(0) - pose_global(0))!= 0) {
+    double potential_bearing_azimuth_degrees = CalculateYawFromPosition(final_position_world);
+    double actual_bearing_azimuth_degrees = -pose_global_yaw * 180.0/M_PI;
+    double bearing_error = potential_bearing_azimuth_degrees - actual_bearing_azimuth_degrees;
+    while(bearing_error > 180) {
+      bearing_error -= 360;
+    }
+    while(bearing_error < -180) {
+      bearing_error += 360;
+    }
+
+    if (abs(bearing_error) < 60.0)  {
+      motion_selector.SetSoftTopSpeed(config.soft_top_speed);
+      plan.has_bearing = true;
+      plan.bearing_azimuth_degrees = potential_bearing_azimuth_degrees;
+      return;
+    }
+    motion_selector.SetSoftTopSpeed(0.1);
+    if (speed_initial < 0.5) {
+      plan.has_bearing = true;
+      plan.bearing_azimuth_degrees = CalculateYawFromPosition(carrot_world_frame);
+    }
+  }
+}
+
+double MotionPlanner::CalculateYawFromPosition(Vector3 const& final_position) {
+  return 180.0/M_PI*atan2(-(final_position(1) - pose_global(1)), final_position(0) - pose_global(0));
+}
+
+double MotionPlanner::AltitudeSetpointOfBestMotion() {
+  Vector3 best_motion_position_ortho_body = best_motion.getPosition(0.5);
+  Vector3 best_motion_position_world = ortho_body_frames.ortho_body_to_world * best_motion_position_ortho_body;
+  return best_motion_position_world(2);
+}
+
+bool MotionPlanner::CheckIfInevitableCollision(std::vector<double> const& hokuyo_collision_probabilities) {
+  for (size_t i = 0; i < hokuyo_collision_probabilities.size(); i++) {
+    if (hokuyo_collision_probabilities.at(i) < 0.6) {
+      return false;
+    }
+  }
+  return true;
+}
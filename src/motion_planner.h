@@ -0,0 +1,171 @@
+#ifndef MOTION_PLANNER_H
+#define MOTION_PLANNER_H
+
+#include "motion_selector.h"
+#include "frame_utils.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class FlightLogWriter;
+
+// What the planning core is built from; the defaults are the node's parameter defaults
+struct MotionPlannerConfig {
+  bool use_3d_library = false;
+  bool use_dijkstra = false;
+  bool yaw_on = false;
+  double final_time = 1.5;
+  double soft_top_speed = 2.0;
+  double acceleration_interpolation_min = 3.5;
+  double speed_at_acceleration_max = 10.0;
+  double acceleration_interpolation_max = 4.0;
+  double flight_altitude = 1.2;
+  double max_e_stop_pitch_degrees = 60.0;
+  double laser_grid_half_width = 12.0;
+  double laser_grid_resolution = 0.1;
+  double refinement_time_budget = 0.0;
+  double collision_reuse_tolerance = 0.0;
+
+  std::vector<double> acceleration_grid_horizontal_fractions = {1.0, 0.6, 0.15};
+  std::vector<double> acceleration_grid_vertical_accelerations = {-2.0, -0.75, 0.75, 2.0};
+  int acceleration_grid_samples_around_circle = 8;
+  bool use_motion_bvh = false;
+  std::string motion_library_file;
+
+  double camera_fx = 308.57684326171875;
+  double camera_fy = 308.57684326171875;
+  double camera_cx = 154.6868438720703;
+  double camera_cy = 120.21442413330078;
+  int camera_width = 320;
+  int camera_height = 240;
+  double depth_image_decimation = 4.0;
+  std::vector<double> depth_pyramid_speeds;
+};
+
+// The planning stage of MotionSelectorNode without ROS: it turns poses, velocities, goals and
+// sensor clouds into the selected motion and acceleration.  Poses, velocities, goals and ComputePlan
+// must all come from one thread; the clouds may come from another, as they only touch the
+// collision evaluator under selector_mutex.
+//
+// With a flight log set, every input is recorded at the point it takes effect, so that
+// motion_selector_replay can repeat the same calls in the same order.
+class MotionPlanner {
+public:
+
+  struct Plan {
+    size_t best_traj_index = 0;
+    Vector3 desired_acceleration = Vector3::Zero();
+    bool has_z_setpoint = false;
+    double z_setpoint = 0.0;
+    bool has_bearing = false;
+    double bearing_azimuth_degrees = 0.0;
+  };
+
+  MotionPlanner(MotionSelector &motion_selector, std::mutex &selector_mutex)
+    : motion_selector(motion_selector), selector_mutex(selector_mutex) {};
+  MotionPlanner(MotionPlanner const&) = delete;
+  MotionPlanner& operator=(MotionPlanner const&) = delete;
+
+  // Builds the library and sets up the selector; false, with the reason in error, when the motion
+  // library file could not be loaded and the acceleration grid is used instead
+  bool Configure(MotionPlannerConfig const& config, std::string &error);
+  MotionPlannerConfig const& GetConfig() const {return config;};
+  // Starts recording with the configuration, so call it after Configure
+  void SetFlightLog(FlightLogWriter* flight_log);
+
+  // Until a sensor's extrinsic is set, its frame keeps the previous transform
+  void SetLaserExtrinsic(Eigen::Isometry3d const& body_to_laser);
+  void SetDepthCameraExtrinsic(Eigen::Isometry3d const& body_to_rdf);
+
+  void ApplyPose(Vector3 const& position, double roll, double pitch, double yaw);
+  void ApplyVelocity(Vector3 const& velocity_world_frame);
+  void ApplyLocalGoal(Vector3 const& goal_world_frame);
+
+  // Clouds in the ortho_body frame
+  void UpdateDepthImage(pcl::PointCloud<pcl::PointXYZ>::Ptr const& ortho_body_cloud, Matrix3 const& ortho_body_to_rdf);
+  void UpdateLaserScan(pcl::PointCloud<pcl::PointXYZ>::Ptr const& ortho_body_cloud);
+
+  // now, in seconds, only times the e-stop; the deadline cuts the Euclidean evaluation short, and so
+  // does max_motions_evaluated, with which replay stops where the deadline stopped in flight.
+  // max_refinement_samples likewise stands in for the refinement time budget.
+  Plan ComputePlan(double now, std::chrono::steady_clock::time_point const& deadline, double library_thrust,
+                   size_t max_motions_evaluated = std::numeric_limits<size_t>::max(),
+                   size_t max_refinement_samples = std::numeric_limits<size_t>::max());
+
+  size_t getNumMotionsEvaluated() const {return num_motions_evaluated;};
+  size_t getNumRefinementSamples() const {return num_refinement_samples;};
+  std::vector<double> const& getCollisionProbabilities() const {return collision_probabilities;};
+  Vector3 const& getCarrotOrthoBodyFrame() const {return carrot_ortho_body_frame;};
+  // The motion the last plan flies, refined or e-stop, which its yaw and altitude setpoint follow
+  Motion const& getBestMotion() const {return best_motion;};
+
+private:
+
+  // Where the ortho_body frame is at the pose last applied
+  struct OrthoBodyFrames {
+    Eigen::Isometry3d ortho_body_to_world = Eigen::Isometry3d::Identity();
+    Eigen::Isometry3d world_to_ortho_body = Eigen::Isometry3d::Identity();
+    Eigen::Isometry3d ortho_body_to_laser = Eigen::Isometry3d::Identity();
+    Eigen::Isometry3d ortho_body_to_rdf = Eigen::Isometry3d::Identity();
+  };
+
+  struct SensorExtrinsic {
+    bool is_set = false;
+    Eigen::Isometry3d body_to_sensor = Eigen::Isometry3d::Identity();
+  };
+
+  void UpdateOrthoBodyFrames(Vector3 const& position, double roll, double pitch, double yaw);
+  void UpdateOrthoBodyToSensor(SensorExtrinsic const& extrinsic, double roll, double pitch, Eigen::Isometry3d &ortho_body_to_sensor);
+  void UpdateCarrotOrthoBodyFrame();
+  void UpdateLaserRDFFramesFromPose();
+  void transformAccelerationsIntoLaserRDFFrames();
+  void ComputeBestAccelerationMotion();
+  void ExecuteEStop(double now);
+  void SetYawFromMotion(Plan &plan);
+  double CalculateYawFromPosition(Vector3 const& final_position);
+  double AltitudeSetpointOfBestMotion();
+  static bool CheckIfInevitableCollision(std::vector<double> const& hokuyo_collision_probabilities);
+
+  Vector3 transformOrthoBodyIntoLaserFrame(Vector3 const& ortho_body_vector) {
+    return ortho_body_frames.ortho_body_to_laser * ortho_body_vector;
+  };
+  Vector3 transformOrthoBodyIntoRDFFrame(Vector3 const& ortho_body_vector) {
+    return ortho_body_frames.ortho_body_to_rdf * ortho_body_vector;
+  };
+
+  MotionSelector &motion_selector;
+  std::mutex &selector_mutex;
+  MotionPlannerConfig config;
+  FlightLogWriter* flight_log = nullptr;
+
+  SensorExtrinsic laser_extrinsic;
+  SensorExtrinsic rdf_extrinsic;
+  OrthoBodyFrames ortho_body_frames;
+
+  Vector3 carrot_world_frame = Vector3::Zero();
+  Vector3 carrot_ortho_body_frame = Vector3::Zero();
+  Vector3 pose_global = Vector3::Zero();
+  double pose_global_yaw = 0.0;
+
+  size_t best_traj_index = 0;
+  Vector3 desired_acceleration = Vector3::Zero();
+  Motion best_motion;
+  size_t num_motions_evaluated = 0;
+  size_t num_refinement_samples = 0;
+  std::vector<double> collision_probabilities;
+
+  bool executing_e_stop = false;
+  double begin_e_stop_time = 0.0;
+  double e_stop_time_needed = 0.0;
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+#endif
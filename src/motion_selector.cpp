@@ -1,4 +1,5 @@
 #include "motion_selector.h"
+#include "trace.h"
 
 MotionLibrary* MotionSelector::GetMotionLibraryPtr() {
   return &motion_library;
@@ -18,6 +19,12 @@ void MotionSelector::InitializeLibrary(bool use_3d_library, double const& final_
 
   motion_library.InitializeLibrary(use_3d_library, a_max_horizontal, min_speed_at_max_acceleration_total, max_acceleration_total);
   InitializeObjectiveVectors();
+
+  std::vector<Vector3> accelerations;
+  for (auto motion = motion_library.GetMotionIteratorBegin(); motion != motion_library.GetMotionIteratorEnd(); motion++) {
+    accelerations.push_back(motion->getAcceleration());
+  }
+  motion_bvh.Build(accelerations);
   this->soft_top_speed = soft_top_speed;
   last_desired_acceleration << 0, 0, 0;
   this->final_time = final_time;
@@ -41,9 +48,6 @@ void MotionSelector::InitializeLibrary(bool use_3d_library, double const& final_
 void MotionSelector::InitializeObjectiveVectors() {
   for (size_t i = 0; i < getNumMotions(); i++) {
     dijkstra_evaluations.push_back(0.0);
-    goal_progress_evaluations.push_back(0.0);
-    terminal_velocity_evaluations.push_back(0.0);
-    altitude_evaluations.push_back(0.0);
 
     collision_probabilities.push_back(0.0);
     no_collision_probabilities.push_back(0.0);
@@ -51,11 +55,29 @@ void MotionSelector::InitializeObjectiveVectors() {
 
     objectives_dijkstra.push_back(0.0);
     objectives_euclid.push_back(0.0);
+
+    motion_evaluated.push_back(false);
+    collision_cache_valid.push_back(false);
+    collision_cache_generation.push_back(0);
+    motion_beyond_obstacle_reach.push_back(false);
   }
+  size_t num_cached_samples = getNumMotions()*num_samples_collision;
+  motion_swept_boxes.resize(getNumMotions());
+  cached_collision_positions.resize(num_cached_samples);
+  cached_collision_sigmas.resize(num_cached_samples);
+  cached_laser_collision_probabilities.resize(num_cached_samples);
+  cached_depth_image_collision_probabilities.resize(num_cached_samples);
+}
+
+void MotionSelector::SetCollisionReuseTolerance(double tolerance) {
+  this->collision_reuse_tolerance = tolerance;
+  depth_image_collision_evaluator.SetObstacleChangeTolerance(tolerance);
+  std::fill(collision_cache_valid.begin(), collision_cache_valid.end(), false);
 }
 
 void MotionSelector::UpdateTimeHorizon(double const& final_time) {
   this->final_time = final_time;
+  std::fill(collision_cache_valid.begin(), collision_cache_valid.end(), false);
 
   size_t num_samples = 10;
   double sampling_time = 0;
@@ -78,25 +100,64 @@ size_t MotionSelector::getNumMotions() {
   return motion_library.getNumMotions();
 };
 
+std::vector<double> MotionSelector::getCollisionSamplingTimes() {
+  return std::vector<double>(collision_sampling_time_vector.data(), collision_sampling_time_vector.data() + num_samples_collision);
+}
+
 // Euclidean Evaluator
 void MotionSelector::computeBestEuclideanMotion(Vector3 const& carrot_body_frame, size_t &best_traj_index, Vector3 &desired_acceleration) {
-  EvaluateCollisionProbabilities();
+  computeBestEuclideanMotion(carrot_body_frame, std::chrono::steady_clock::time_point::max(), best_traj_index, desired_acceleration);
+}
 
+void MotionSelector::computeBestEuclideanMotion(Vector3 const& carrot_body_frame, std::chrono::steady_clock::time_point const& deadline, size_t &best_traj_index, Vector3 &desired_acceleration) {
+  computeBestEuclideanMotion(carrot_body_frame, deadline, std::numeric_limits<size_t>::max(), std::numeric_limits<size_t>::max(), best_traj_index, desired_acceleration);
+}
 
-  EvaluateGoalProgress(carrot_body_frame); 
-  EvaluateTerminalVelocityCost();
-  if (use_3d_library) {EvaluateAltitudeCost();};
-  EvaluateObjectivesEuclid();
+// Motions are evaluated in priority order (last cycle's best, then the motions with the closest
+// accelerations) until the deadline or max_motions_evaluated, and the best fully evaluated motion is
+// returned.  At least the first motion is always evaluated.  Motions that were not reached keep last
+// cycle's collision probabilities and get an objective of -infinity.  Since the order only depends
+// on the inputs, a limit equal to an earlier getNumMotionsEvaluated repeats where a deadline stopped.
+// Likewise a max_refinement_samples other than max replaces the refinement time budget, so passing an
+// earlier getNumRefinementSamples draws the same refinement samples.
+void MotionSelector::computeBestEuclideanMotion(Vector3 const& carrot_body_frame, std::chrono::steady_clock::time_point const& deadline, size_t max_motions_evaluated, size_t max_refinement_samples, size_t &best_traj_index, Vector3 &desired_acceleration) {
+  // Collision probabilities and objectives are evaluated motion by motion under this one span
+  TraceSpan span("computeBestEuclideanMotion");
+  bool has_deadline = (deadline != std::chrono::steady_clock::time_point::max());
+  UpdateEvaluationOrder();
+  ObjectiveContext context = MakeObjectiveContext(carrot_body_frame);
+
+  std::fill(objectives_euclid.begin(), objectives_euclid.end(), -std::numeric_limits<double>::infinity());
+  std::fill(motion_evaluated.begin(), motion_evaluated.end(), false);
+  num_motions_evaluated = 0;
+  num_refinement_samples = 0;
+  num_collision_samples_reused = 0;
+  UpdateMotionsBeyondObstacleReach();
 
   desired_acceleration << 0,0,0;
-  best_traj_index = 0;
-  float current_objective_value;
-  float best_traj_objective_value = objectives_euclid.at(0);
-  for (size_t traj_index = 1; traj_index < getNumMotions(); traj_index++) {
-    current_objective_value = objectives_euclid.at(traj_index);
-    if (current_objective_value > best_traj_objective_value) {
+  best_traj_index = evaluation_order.at(0);
+  double best_traj_objective_value = -std::numeric_limits<double>::infinity();
+  for (size_t order_index = 0; order_index < evaluation_order.size(); order_index++) {
+    if ((order_index > 0) && (order_index >= max_motions_evaluated || (has_deadline && (std::chrono::steady_clock::now() >= deadline)))) {
+      break;
+    }
+    size_t traj_index = evaluation_order[order_index];
+    EvaluateCollisionProbabilityOneMotion(traj_index);
+    if (use_3d_library) {
+      objectives_euclid[traj_index] = EvaluateObjectiveOneMotion<EuclideanObjective3D>(context, traj_index);
+    }
+    else {
+      objectives_euclid[traj_index] = EvaluateObjectiveOneMotion<EuclideanObjective2D>(context, traj_index);
+    }
+    motion_evaluated[traj_index] = true;
+    num_motions_evaluated++;
+
+    // Same float comparison and tie-breaking towards the lower index as the original library sweep
+    float current_objective_value = objectives_euclid[traj_index];
+    float best_objective_value_float = best_traj_objective_value;
+    if ((order_index == 0) || (current_objective_value > best_objective_value_float) || ((current_objective_value == best_objective_value_float) && (traj_index < best_traj_index))) {
       best_traj_index = traj_index;
-      best_traj_objective_value = current_objective_value;
+      best_traj_objective_value = objectives_euclid[traj_index];
     }
   }
 
@@ -109,32 +170,168 @@ void MotionSelector::computeBestEuclideanMotion(Vector3 const& carrot_body_frame
     angle_to_goal = 180.0/M_PI * angle_to_goal;
   }
 
-  if ( (collision_probabilities.at(0) < 0.05) && (angle_to_goal < 30) && (carrot_body_frame.norm() > motion_library.getMotionFromIndex(0).getTerminalStopPosition(0.5).norm() ))  {
+  bool goal_motion_is_clear = motion_evaluated.at(0) && (collision_probabilities.at(0) < 0.05) && (angle_to_goal < 30) && (carrot_body_frame.norm() > motion_library.getMotionFromIndex(0).getTerminalStopPosition(0.5).norm() );
+  if (goal_motion_is_clear)  {
     best_traj_index = 0;
   }
 
   desired_acceleration = motion_library.getMotionFromIndex(best_traj_index).getAcceleration();
+  if (!goal_motion_is_clear && refinement_time_budget > 0.0 && num_motions_evaluated == getNumMotions()) {
+    std::chrono::steady_clock::time_point refinement_deadline = std::chrono::steady_clock::time_point::max();
+    if (max_refinement_samples == std::numeric_limits<size_t>::max()) {
+      refinement_deadline = std::min(deadline, std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(refinement_time_budget)));
+    }
+    RefineBestMotion(carrot_body_frame, best_traj_index, refinement_deadline, max_refinement_samples, desired_acceleration);
+  }
+  selected_motion = motion_library.getMotionFromIndex(best_traj_index);
+  if (desired_acceleration != selected_motion.getAcceleration()) {
+    selected_motion = MotionWithAcceleration(selected_motion, desired_acceleration);
+  }
   last_desired_acceleration = desired_acceleration;
+  last_best_traj_index = best_traj_index;
 };
 
-void MotionSelector::EvaluateObjectivesEuclid() {
-  for (int i = 0; i < getNumMotions(); i++) {
-    objectives_euclid.at(i) = EvaluateWeightedObjectiveEuclid(i)*no_collision_probabilities.at(i) + collision_reward*collision_probabilities.at(i);
+// Last cycle's best first, then the rest by how close their acceleration is to it
+void MotionSelector::UpdateEvaluationOrder() {
+  size_t num_motions = getNumMotions();
+  if (last_best_traj_index >= num_motions) {
+    last_best_traj_index = 0;
+  }
+  std::vector<Motion>::const_iterator motion_iterator_begin = motion_library.GetMotionIteratorBegin();
+  Vector3 last_best_acceleration = (motion_iterator_begin + last_best_traj_index)->getAcceleration();
+
+  std::vector<std::pair<double, size_t> > distances;
+  distances.reserve(num_motions);
+  for (size_t i = 0; i < num_motions; i++) {
+    double distance = (i == last_best_traj_index) ? -1.0 : ((motion_iterator_begin + i)->getAcceleration() - last_best_acceleration).squaredNorm();
+    distances.push_back(std::make_pair(distance, i));
+  }
+  std::sort(distances.begin(), distances.end());
+
+  evaluation_order.resize(num_motions);
+  for (size_t i = 0; i < num_motions; i++) {
+    evaluation_order[i] = distances[i].second;
   }
 }
 
-double MotionSelector::EvaluateWeightedObjectiveEuclid(size_t const& motion_index) {
-  return goal_progress_evaluations.at(motion_index) + terminal_velocity_evaluations.at(motion_index) + altitude_evaluations.at(motion_index);
+template <typename Objective>
+double MotionSelector::EvaluateObjectiveOneMotion(ObjectiveContext const& context, size_t motion_index) {
+  Motion const& motion = *(motion_library.GetMotionIteratorBegin() + motion_index);
+  return Objective::EvaluateOne(motion, context, motion_index)*no_collision_probabilities[motion_index] + collision_reward*collision_probabilities[motion_index];
 }
 
+// Anytime cross-entropy refinement of the selected motion: sample accelerations around the current
+// mean, score them with the same collision and objective evaluation as the library, refit the mean
+// and spread to the elite samples, and keep the best seen until the deadline or max_samples draws.
+void MotionSelector::RefineBestMotion(Vector3 const& carrot_body_frame, size_t best_traj_index, std::chrono::steady_clock::time_point const& deadline, size_t max_samples, Vector3 &desired_acceleration) {
+  TraceSpan span("RefineBestMotion");
+  const size_t num_samples_per_iteration = 8;
+  const size_t num_elite_samples = 3;
+  const double minimum_sigma = 0.05;
+
+  Motion const& library_motion = *(motion_library.GetMotionIteratorBegin() + best_traj_index);
+  ObjectiveContext context = MakeObjectiveContext(carrot_body_frame);
+  double max_acceleration = motion_library.getNewMaxAcceleration();
+
+  Vector3 mean = library_motion.getAcceleration();
+  Vector3 sigma = Vector3(0.25, 0.25, 0.25) * max_acceleration;
+  if (!use_3d_library) {
+    sigma(2) = 0.0;
+  }
+  double best_objective = objectives_euclid.at(best_traj_index);
+  Vector3 best_acceleration = mean;
+
+  std::normal_distribution<double> standard_normal(0.0, 1.0);
+  std::vector<std::pair<double, Vector3> > samples;
+  while ((num_refinement_samples < max_samples) && (std::chrono::steady_clock::now() < deadline)) {
+    samples.clear();
+    for (size_t i = 0; i < num_samples_per_iteration; i++) {
+      Vector3 acceleration;
+      acceleration << mean(0) + sigma(0)*standard_normal(refinement_generator), mean(1) + sigma(1)*standard_normal(refinement_generator), mean(2) + sigma(2)*standard_normal(refinement_generator);
+      if (acceleration.norm() > max_acceleration) {
+        acceleration = acceleration * max_acceleration / acceleration.norm();
+      }
+      Motion candidate = MotionWithAcceleration(library_motion, acceleration);
+
+      double collision_probability, hokuyo_collision_probability;
+      computeProbabilityOfCollisionOneMotion(candidate, collision_probability, hokuyo_collision_probability);
+      double objective;
+      if (use_3d_library) {
+        objective = EuclideanObjective3D::EvaluateOne(candidate, context, best_traj_index);
+      }
+      else {
+        objective = EuclideanObjective2D::EvaluateOne(candidate, context, best_traj_index);
+      }
+      objective = objective*(1.0 - collision_probability) + collision_reward*collision_probability;
+      samples.push_back(std::make_pair(objective, acceleration));
+      num_refinement_samples++;
+
+      if (objective > best_objective) {
+        best_objective = objective;
+        best_acceleration = acceleration;
+      }
+      if ((num_refinement_samples >= max_samples) || (std::chrono::steady_clock::now() >= deadline)) {
+        break;
+      }
+    }
+    if (samples.size() < num_samples_per_iteration) {
+      break;
+    }
+
+    std::partial_sort(samples.begin(), samples.begin() + num_elite_samples, samples.end(),
+                      [](std::pair<double, Vector3> const& a, std::pair<double, Vector3> const& b) { return a.first > b.first; });
+    mean << 0, 0, 0;
+    for (size_t i = 0; i < num_elite_samples; i++) {
+      mean += samples[i].second / num_elite_samples;
+    }
+    Vector3 variance(0, 0, 0);
+    for (size_t i = 0; i < num_elite_samples; i++) {
+      variance += (samples[i].second - mean).cwiseProduct(samples[i].second - mean) / num_elite_samples;
+    }
+    sigma = variance.cwiseSqrt().cwiseMax(minimum_sigma);
+    if (!use_3d_library) {
+      sigma(2) = 0.0;
+    }
+  }
+
+  desired_acceleration = best_acceleration;
+}
+
+// Copy of a library motion with a different acceleration.  The RDF acceleration is moved by the
+// same rotated offset, so the copy stays consistent with the transform the node applied.
+Motion MotionSelector::MotionWithAcceleration(Motion const& reference_motion, Vector3 const& acceleration) {
+  Motion motion = reference_motion;
+  Matrix3 R = depth_image_collision_evaluator.GetRotationMatrix();
+  motion.setAccelerationRDF(reference_motion.getAccelerationRDF() + R*(acceleration - reference_motion.getAcceleration()));
+  motion.setInitialAccelerationRDF(reference_motion.getInitialAccelerationRDF());
+  motion.setAcceleration(acceleration);
+  motion.setInitialAcceleration(motion_library.getInitialAcceleration());
+  return motion;
+}
+
+ObjectiveContext MotionSelector::MakeObjectiveContext(Vector3 const& carrot_body_frame) {
+  ObjectiveContext context;
+  context.carrot_body_frame = carrot_body_frame;
+  context.initial_distance_to_carrot = carrot_body_frame.norm();
+  context.soft_top_speed = soft_top_speed;
+  context.nominal_altitude = nominal_altitude;
+  context.dijkstra_evaluations = dijkstra_evaluations.data();
+  return context;
+}
+
+template <typename Objective>
+void MotionSelector::EvaluateObjectives(ObjectiveContext const& context, std::vector<double> &objectives) {
+  TraceSpan span("EvaluateObjectives");
+  Objective::EvaluateAll(motion_library.GetMotionIteratorBegin(), getNumMotions(), context,
+                         collision_probabilities.data(), no_collision_probabilities.data(), collision_reward, objectives.data());
+}
 
 // Dijkstra Evaluator
-void MotionSelector::computeBestDijkstraMotion(Vector3 const& carrot_body_frame, Vector3 const& carrot_world_frame, geometry_msgs::TransformStamped const& tf, size_t &best_traj_index, Vector3 &desired_acceleration) {
+void MotionSelector::computeBestDijkstraMotion(Vector3 const& carrot_body_frame, Vector3 const& carrot_world_frame, Eigen::Isometry3d const& ortho_body_to_world, size_t &best_traj_index, Vector3 &desired_acceleration) {
+  TraceSpan span("computeBestDijkstraMotion");
   EvaluateCollisionProbabilities();
-  EvaluateDijkstraCost(carrot_world_frame, tf);
-  EvaluateGoalProgress(carrot_body_frame); 
-  EvaluateTerminalVelocityCost();
-  EvaluateObjectivesDijkstra();
+  EvaluateDijkstraCost(carrot_world_frame, ortho_body_to_world);
+  EvaluateObjectives<DijkstraObjective>(MakeObjectiveContext(carrot_body_frame), objectives_dijkstra);
 
   desired_acceleration << 0,0,0;
   best_traj_index = 0;
@@ -147,136 +344,162 @@ void MotionSelector::computeBestDijkstraMotion(Vector3 const& carrot_body_frame,
       best_traj_objective_value = current_objective_value;
     }
   }
-  desired_acceleration = motion_library.getMotionFromIndex(best_traj_index).getAcceleration();
+  selected_motion = motion_library.getMotionFromIndex(best_traj_index);
+  desired_acceleration = selected_motion.getAcceleration();
   return;
 }
 
-void MotionSelector::EvaluateObjectivesDijkstra() {
-  for (int i = 0; i < getNumMotions(); i++) {
-    objectives_dijkstra.at(i) = EvaluateWeightedObjectiveDijkstra(i)*no_collision_probabilities.at(i) + collision_reward*collision_probabilities.at(i);
-  }
-}
-
+// All samples of all motions are moved into the world frame with one isometry product and looked up
+// in the value grid as a single batch.  The 3D library is scored in the value volume once one is
+// set, so motions that climb or descend read the cost-to-go of the altitude they reach.
+void MotionSelector::EvaluateDijkstraCost(Vector3 const& carrot_world_frame, Eigen::Isometry3d const& ortho_body_to_world) {
+  TraceSpan span("EvaluateDijkstraCost");
 
-double MotionSelector::EvaluateWeightedObjectiveDijkstra(size_t index) {
-  return dijkstra_evaluations.at(index) + 1.0*terminal_velocity_evaluations.at(index);
-}
-
-void MotionSelector::EvaluateDijkstraCost(Vector3 const& carrot_world_frame, geometry_msgs::TransformStamped const& tf) {
-
-  ValueGrid* value_grid_ptr = value_grid_evaluator.GetValueGridPtr();
+  std::shared_ptr<ValueGrid const> value_grid = value_grid_evaluator.GetValueGrid();
+  std::shared_ptr<ValueVolume const> value_volume = value_grid_evaluator.GetValueVolume();
 
   std::vector<Motion>::const_iterator motion_iterator_begin = motion_library.GetMotionIteratorBegin();
-  std::vector<Motion>::const_iterator motion_iterator_end = motion_library.GetMotionIteratorEnd();
-
-  size_t i = 0;
-  Vector3 ortho_body_frame_position;
-  geometry_msgs::PoseStamped pose_ortho_body_frame_position;
-  geometry_msgs::PoseStamped pose_world_frame_position = PoseFromVector3(Vector3(0,0,0), "world");
-  int current_value;
-  // Iterate over motions
-  for (auto motion = motion_iterator_begin; motion != motion_iterator_end; motion++) {
-    
-   dijkstra_evaluations.at(i) = 0;
-    double sampling_time;
-    //Iterate over sampling times
-    for (size_t time_index = 0; time_index < sampling_time_vector.size(); time_index++) {
-      
-      sampling_time = sampling_time_vector(time_index);
-      ortho_body_frame_position = motion->getPosition(sampling_time);
-      
-      geometry_msgs::PoseStamped pose_ortho_body_frame_position = PoseFromVector3(ortho_body_frame_position, "ortho_body");
-      tf2::doTransform(pose_ortho_body_frame_position, pose_world_frame_position, tf);
-      Vector3 world_frame_position = VectorFromPose(pose_world_frame_position);
-
-      // // Then evaluate Dijkstra cost
-      current_value = value_grid_ptr->GetValueOfPosition(world_frame_position);
+  size_t num_motions = getNumMotions();
+  size_t num_samples = sampling_time_vector.size();
+
+  dijkstra_sample_positions.resize(3, num_motions*num_samples);
+  for (size_t i = 0; i < num_motions; i++) {
+    Motion const& motion = *(motion_iterator_begin + i);
+    for (size_t time_index = 0; time_index < num_samples; time_index++) {
+      dijkstra_sample_positions.col(i*num_samples + time_index) = motion.getPosition(sampling_time_vector(time_index));
+    }
+  }
+  dijkstra_sample_positions = ortho_body_to_world * dijkstra_sample_positions;
+  if (use_3d_library && value_volume->getNumBlocks() > 0) {
+    value_volume->GetValuesOfPositions(dijkstra_sample_positions, dijkstra_sample_values);
+  }
+  else {
+    value_grid->GetValuesOfPositions(dijkstra_sample_positions, dijkstra_sample_values);
+  }
 
-      if ((current_value == 0) && ((world_frame_position - carrot_world_frame).norm() > 1.0)) {
+  for (size_t i = 0; i < num_motions; i++) {
+    dijkstra_evaluations.at(i) = 0;
+    for (size_t time_index = 0; time_index < num_samples; time_index++) {
+      size_t sample_index = i*num_samples + time_index;
+      int current_value = dijkstra_sample_values(sample_index);
+      if ((current_value == 0) && ((dijkstra_sample_positions.col(sample_index) - carrot_world_frame).norm() > 1.0)) {
         current_value = 1000;
       }
-
       dijkstra_evaluations.at(i) -= current_value;
-
     }
-    i++;
   }
 };
 
-void MotionSelector::EvaluateGoalProgress(Vector3 const& carrot_body_frame) {
+void MotionSelector::EvaluateCollisionProbabilities() {
+  TraceSpan span("EvaluateCollisionProbabilities");
   std::vector<Motion>::const_iterator motion_iterator_begin = motion_library.GetMotionIteratorBegin();
   std::vector<Motion>::const_iterator motion_iterator_end = motion_library.GetMotionIteratorEnd();
-  double initial_distance = carrot_body_frame.norm();
-  double time_to_eval = 0.5;
   size_t i = 0;
-  Vector3 final_motion_position;
-  double distance;
+  num_collision_samples_reused = 0;
+  UpdateMotionsBeyondObstacleReach();
   for (auto motion = motion_iterator_begin; motion != motion_iterator_end; motion++) {
-    final_motion_position = motion->getTerminalStopPosition(time_to_eval);
-    distance = (final_motion_position - carrot_body_frame).norm();
-    goal_progress_evaluations.at(i) = initial_distance - distance; 
+    EvaluateCollisionProbabilityOneMotion(i);
     i++;
   }
 };
 
-void MotionSelector::EvaluateTerminalVelocityCost() {
-  std::vector<Motion>::const_iterator motion_iterator_begin = motion_library.GetMotionIteratorBegin();
-  std::vector<Motion>::const_iterator motion_iterator_end = motion_library.GetMotionIteratorEnd();
-  size_t i = 0;
-  double final_motion_speed;
-  double distance;
-  for (auto motion = motion_iterator_begin; motion != motion_iterator_end; motion++) {
-    final_motion_speed = motion->getVelocity(0.5).norm();
-    terminal_velocity_evaluations.at(i) = 0;
-    if (final_motion_speed > soft_top_speed) {
-      terminal_velocity_evaluations.at(i) -= 2.0*(soft_top_speed - final_motion_speed)*(soft_top_speed - final_motion_speed);
-    }
-    i++;
+void MotionSelector::EvaluateCollisionProbabilityOneMotion(size_t motion_index) {
+  double collision_probability = 0;
+  double hokuyo_collision_probability = 0;
+  if (motion_beyond_obstacle_reach.at(motion_index)) {
+    computeProbabilityOfCollisionOneMotion(*(motion_library.GetMotionIteratorBegin() + motion_index), collision_probability, hokuyo_collision_probability, true);
+  }
+  else if (collision_reuse_tolerance > 0.0) {
+    computeProbabilityOfCollisionOneMotionReusingSamples(motion_index, collision_probability, hokuyo_collision_probability);
   }
+  else {
+    computeProbabilityOfCollisionOneMotion(*(motion_library.GetMotionIteratorBegin() + motion_index), collision_probability, hokuyo_collision_probability);
+  }
+  collision_probabilities.at(motion_index) = collision_probability;
+  hokuyo_collision_probabilities.at(motion_index) = hokuyo_collision_probability;
+  no_collision_probabilities.at(motion_index) = 1.0 - collision_probabilities.at(motion_index); 
 };
 
-void MotionSelector::EvaluateAltitudeCost() {
+// Refits the motion BVH to this cycle's collision samples and marks the motions that no obstacle can
+// reach.  The reach is the largest influence radius over the sampling times.
+void MotionSelector::UpdateMotionsBeyondObstacleReach() {
+  num_motions_culled = 0;
+  if (!use_motion_bvh) {
+    std::fill(motion_beyond_obstacle_reach.begin(), motion_beyond_obstacle_reach.end(), false);
+    return;
+  }
+
+  double reach = 0.0;
+  for (size_t time_step_index = 0; time_step_index < num_samples_collision; time_step_index++) {
+    Vector3 sigma_robot_position = 0.1*motion_library.getSigmaAtTime(collision_sampling_time_vector(time_step_index));
+    reach = std::max(reach, depth_image_collision_evaluator.computeCollisionInfluenceRadius(sigma_robot_position, negligible_probability_of_collision));
+  }
+
+  UpdateMotionSweptBoxes();
+  motion_bvh.Refit(motion_swept_boxes);
+  motion_bvh.FindMotionsBeyondReach(depth_image_collision_evaluator, reach, motion_beyond_obstacle_reach);
+  num_motions_culled = std::count(motion_beyond_obstacle_reach.begin(), motion_beyond_obstacle_reach.end(), true);
+}
+
+// Boxes around each motion's collision samples.  With a matching library file they come from the
+// file's swept bounds for the current speed bin, shifted by the bounds of the initial velocity and
+// acceleration term that all motions share, so only the best-acceleration motion is sampled.
+void MotionSelector::UpdateMotionSweptBoxes() {
   std::vector<Motion>::const_iterator motion_iterator_begin = motion_library.GetMotionIteratorBegin();
-  std::vector<Motion>::const_iterator motion_iterator_end = motion_library.GetMotionIteratorEnd();
-  size_t i = 0;
-  double minimum_altitude = 0.7;
-  double maximum_altitude = 5.0;
-  double final_altitude;
-  for (auto motion = motion_iterator_begin; motion != motion_iterator_end; motion++) {
-    final_altitude = motion->getPosition(0.1)(2);
-    altitude_evaluations.at(i) = 0;
-    altitude_evaluations.at(i) -= 0.1 * (nominal_altitude - final_altitude) * (nominal_altitude - final_altitude);
-    if (final_altitude < minimum_altitude) {
-      altitude_evaluations.at(i) -= 10.0*(final_altitude - minimum_altitude)*(final_altitude - minimum_altitude);
+  size_t num_sampled_motions = getNumMotions();
+  MotionLibraryFile const* library_file = motion_library.GetLibraryFile();
+
+  if (library_file != nullptr && LibraryFileMatchesSamplingTimes()) {
+    Motion shared_motion(Vector3(0,0,0), motion_library.getInitialVelocity());
+    shared_motion.setInitialAcceleration(motion_library.getInitialAcceleration());
+    Eigen::AlignedBox<Scalar, 3> shared_box;
+    for (size_t time_step_index = 0; time_step_index < num_samples_collision; time_step_index++) {
+      shared_box.extend(shared_motion.getPosition(collision_sampling_time_vector(time_step_index)));
     }
-    else if (final_altitude > maximum_altitude) {
-      altitude_evaluations.at(i) -= 10.0*(final_altitude - maximum_altitude)*(final_altitude - maximum_altitude);
+    size_t speed_bin = motion_library.GetSpeedBin();
+    for (size_t motion_index = 1; motion_index < getNumMotions(); motion_index++) {
+      Eigen::AlignedBox<Scalar, 3> swept_bounds = library_file->getSweptBounds(speed_bin, motion_index);
+      motion_swept_boxes[motion_index] = Eigen::AlignedBox<Scalar, 3>(swept_bounds.min() + shared_box.min(), swept_bounds.max() + shared_box.max());
+    }
+    num_sampled_motions = 1;
+  }
+
+  for (size_t motion_index = 0; motion_index < num_sampled_motions; motion_index++) {
+    Motion const& motion = *(motion_iterator_begin + motion_index);
+    motion_swept_boxes[motion_index].setEmpty();
+    for (size_t time_step_index = 0; time_step_index < num_samples_collision; time_step_index++) {
+      motion_swept_boxes[motion_index].extend(motion.getPosition(collision_sampling_time_vector(time_step_index)));
     }
-    i++;
   }
 }
 
-void MotionSelector::EvaluateCollisionProbabilities() {
-  std::vector<Motion>::const_iterator motion_iterator_begin = motion_library.GetMotionIteratorBegin();
-  std::vector<Motion>::const_iterator motion_iterator_end = motion_library.GetMotionIteratorEnd();
-  size_t i = 0;
-  for (auto motion = motion_iterator_begin; motion != motion_iterator_end; motion++) {
-    double collision_probability = 0;
-    double hokuyo_collision_probability = 0;
-    computeProbabilityOfCollisionOneMotion(*motion, collision_probability, hokuyo_collision_probability);
-    collision_probabilities.at(i) = collision_probability;
-    hokuyo_collision_probabilities.at(i) = hokuyo_collision_probability;
-    no_collision_probabilities.at(i) = 1.0 - collision_probabilities.at(i); 
-    i++;
+// The file's swept bounds only hold for the sampling times and jerk time they were computed with;
+// otherwise every motion is sampled
+bool MotionSelector::LibraryFileMatchesSamplingTimes() {
+  MotionLibraryFile const* library_file = motion_library.GetLibraryFile();
+  if (library_file->getNumSamples() != num_samples_collision || library_file->getNumMotions() != getNumMotions()) {
+    return false;
   }
-};
+  if (fabs(library_file->getJerkTime() - motion_library.GetMotionIteratorBegin()->getJerkTime()) > 1e-6) {
+    return false;
+  }
+  for (size_t time_step_index = 0; time_step_index < num_samples_collision; time_step_index++) {
+    if (fabs(library_file->getSampleTime(time_step_index) - collision_sampling_time_vector(time_step_index)) > 1e-6) {
+      return false;
+    }
+  }
+  return true;
+}
 
-void MotionSelector::computeProbabilityOfCollisionOneMotion(Motion motion, double &collision_probability, double &hokuyo_collision_probability) {
+// With beyond_obstacle_reach the nearest-obstacle queries are skipped and only the field of view
+// penalty is accumulated
+void MotionSelector::computeProbabilityOfCollisionOneMotion(Motion motion, double &collision_probability, double &hokuyo_collision_probability, bool beyond_obstacle_reach) {
   double probability_no_collision = 1;
   double probability_no_collision_hokuyo = 1;
 
   double probability_no_collision_one_step = 1.0;
   double probability_of_collision_one_step_one_depth = 1.0;
+  double probability_of_collision_one_step_laser = 0.0;
   Vector3 robot_position;
   Vector3 robot_position_rdf;
   Vector3 sigma_robot_position;
@@ -285,19 +508,86 @@ void MotionSelector::computeProbabilityOfCollisionOneMotion(Motion motion, doubl
 
     sigma_robot_position = 0.1*motion_library.getSigmaAtTime(collision_sampling_time_vector(time_step_index)); 
     robot_position = motion.getPosition(collision_sampling_time_vector(time_step_index));
-    probability_no_collision_one_step = 1 - depth_image_collision_evaluator.computeProbabilityOfCollisionNPositionsKDTree_Laser(robot_position, sigma_robot_position);
+    robot_position_rdf = motion.getPositionRDF(collision_sampling_time_vector(time_step_index));
+
+    if (beyond_obstacle_reach) {
+      probability_of_collision_one_step_laser = 0.0;
+      probability_of_collision_one_step_one_depth = 0.0;
+    }
+    else {
+      depth_image_collision_evaluator.computeProbabilityOfCollisionNPositionsKDTree_LaserAndDepthImage(robot_position, sigma_robot_position, probability_of_collision_one_step_laser, probability_of_collision_one_step_one_depth);
+    }
+    probability_no_collision_one_step = 1 - probability_of_collision_one_step_laser;
     probability_no_collision_hokuyo = probability_no_collision_hokuyo * probability_no_collision_one_step;
 
+    probability_of_collision_one_step_one_depth = depth_image_collision_evaluator.AddOutsideFOVPenalty(robot_position_rdf, probability_of_collision_one_step_one_depth);
+
+    probability_no_collision_one_step = probability_no_collision_one_step * (1 - probability_of_collision_one_step_one_depth);
+    probability_no_collision = probability_no_collision * probability_no_collision_one_step;    
+  }
+  collision_probability = 1.0 - probability_no_collision;
+  hokuyo_collision_probability = 1.0 - probability_no_collision_hokuyo;
+};
+
+// Same as computeProbabilityOfCollisionOneMotion, but the nearest-obstacle probabilities of a sample are
+// taken from an earlier cycle when the sample has not moved by more than the tolerance, its uncertainty
+// is about the same, and no obstacle changed within its influence radius since.  The field of view
+// penalty depends on the current attitude and image, so it is always recomputed.
+void MotionSelector::computeProbabilityOfCollisionOneMotionReusingSamples(size_t motion_index, double &collision_probability, double &hokuyo_collision_probability) {
+  const double sigma_reuse_relative_tolerance = 0.05;
+
+  Motion const& motion = *(motion_library.GetMotionIteratorBegin() + motion_index);
+  Eigen::AlignedBox<Scalar, 3> changed_region;
+  bool cache_usable = collision_cache_valid[motion_index] && depth_image_collision_evaluator.GetObstacleChangesSince(collision_cache_generation[motion_index], changed_region);
+  double squared_tolerance = collision_reuse_tolerance*collision_reuse_tolerance;
+
+  double probability_no_collision = 1;
+  double probability_no_collision_hokuyo = 1;
+  double probability_no_collision_one_step = 1.0;
+  double probability_of_collision_one_step_one_depth = 1.0;
+  double probability_of_collision_one_step_laser = 0.0;
+  Vector3 robot_position;
+  Vector3 robot_position_rdf;
+  Vector3 sigma_robot_position;
+
+  for (size_t time_step_index = 0; time_step_index < num_samples_collision; time_step_index++) {
+    size_t sample_index = motion_index*num_samples_collision + time_step_index;
     sigma_robot_position = 0.1*motion_library.getSigmaAtTime(collision_sampling_time_vector(time_step_index)); 
     robot_position = motion.getPosition(collision_sampling_time_vector(time_step_index));
     robot_position_rdf = motion.getPositionRDF(collision_sampling_time_vector(time_step_index));
-    
-    probability_of_collision_one_step_one_depth = depth_image_collision_evaluator.computeProbabilityOfCollisionNPositionsKDTree_DepthImage(robot_position, sigma_robot_position);
+
+    bool reuse_sample = cache_usable
+      && ((robot_position - cached_collision_positions[sample_index]).squaredNorm() <= squared_tolerance)
+      && ((sigma_robot_position - cached_collision_sigmas[sample_index]).cwiseAbs().maxCoeff() <= sigma_reuse_relative_tolerance*cached_collision_sigmas[sample_index].minCoeff());
+    if (reuse_sample && !changed_region.isEmpty()) {
+      double influence_radius = depth_image_collision_evaluator.computeCollisionInfluenceRadius(sigma_robot_position, negligible_probability_of_collision);
+      reuse_sample = changed_region.exteriorDistance(robot_position) > influence_radius + collision_reuse_tolerance;
+    }
+
+    if (reuse_sample) {
+      probability_of_collision_one_step_laser = cached_laser_collision_probabilities[sample_index];
+      probability_of_collision_one_step_one_depth = cached_depth_image_collision_probabilities[sample_index];
+      num_collision_samples_reused++;
+    }
+    else {
+      depth_image_collision_evaluator.computeProbabilityOfCollisionNPositionsKDTree_LaserAndDepthImage(robot_position, sigma_robot_position, probability_of_collision_one_step_laser, probability_of_collision_one_step_one_depth);
+      cached_collision_positions[sample_index] = robot_position;
+      cached_collision_sigmas[sample_index] = sigma_robot_position;
+      cached_laser_collision_probabilities[sample_index] = probability_of_collision_one_step_laser;
+      cached_depth_image_collision_probabilities[sample_index] = probability_of_collision_one_step_one_depth;
+    }
+
+    probability_no_collision_one_step = 1 - probability_of_collision_one_step_laser;
+    probability_no_collision_hokuyo = probability_no_collision_hokuyo * probability_no_collision_one_step;
+
     probability_of_collision_one_step_one_depth = depth_image_collision_evaluator.AddOutsideFOVPenalty(robot_position_rdf, probability_of_collision_one_step_one_depth);
 
     probability_no_collision_one_step = probability_no_collision_one_step * (1 - probability_of_collision_one_step_one_depth);
     probability_no_collision = probability_no_collision * probability_no_collision_one_step;    
   }
+  collision_cache_valid[motion_index] = true;
+  collision_cache_generation[motion_index] = depth_image_collision_evaluator.GetObstacleGeneration();
+
   collision_probability = 1.0 - probability_no_collision;
   hokuyo_collision_probability = 1.0 - probability_no_collision_hokuyo;
 };
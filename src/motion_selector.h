@@ -4,13 +4,14 @@
 #include "motion_library.h"
 #include "depth_image_collision_evaluator.h"
 #include "value_grid_evaluator.h"
+#include "objective_policies.h"
+#include "motion_bvh.h"
 
 #include <Eigen/Dense>
 #include <math.h>
-
-// This ROS stuff should go.  Only temporary.
-#include <tf2_geometry_msgs/tf2_geometry_msgs.h>
-#include "geometry_msgs/PoseStamped.h"
+#include <chrono>
+#include <random>
+#include <algorithm>
 
 class MotionSelector {
 public:
@@ -23,9 +24,22 @@ public:
   void InitializeObjectiveVectors();
   void UpdateTimeHorizon(double const& final_time);
   size_t getNumMotions();
+  std::vector<double> getCollisionSamplingTimes();
   
   void computeBestEuclideanMotion(Vector3 const& carrot_body_frame, size_t &best_traj_index, Vector3 &desired_acceleration);
-  void computeBestDijkstraMotion(Vector3 const& carrot_body_frame, Vector3 const& carrot_world_frame, geometry_msgs::TransformStamped const& tf, size_t &best_traj_index, Vector3 &desired_acceleration);
+  void computeBestEuclideanMotion(Vector3 const& carrot_body_frame, std::chrono::steady_clock::time_point const& deadline, size_t &best_traj_index, Vector3 &desired_acceleration);
+  void computeBestEuclideanMotion(Vector3 const& carrot_body_frame, std::chrono::steady_clock::time_point const& deadline, size_t max_motions_evaluated, size_t max_refinement_samples, size_t &best_traj_index, Vector3 &desired_acceleration);
+  size_t getNumMotionsEvaluated() {
+    return num_motions_evaluated;
+  }
+  size_t getNumRefinementSamples() {
+    return num_refinement_samples;
+  }
+  // The motion the last computeBest*Motion selected, with the refined acceleration when refinement moved it
+  Motion const& getSelectedMotion() const {
+    return selected_motion;
+  }
+  void computeBestDijkstraMotion(Vector3 const& carrot_body_frame, Vector3 const& carrot_world_frame, Eigen::Isometry3d const& ortho_body_to_world, size_t &best_traj_index, Vector3 &desired_acceleration);
 
   Eigen::Matrix<Scalar, Eigen::Dynamic, 3> sampleMotionForDrawing(size_t motion_index, Eigen::Matrix<Scalar, Eigen::Dynamic, 1> sampling_time_vector, size_t num_samples);
 
@@ -38,6 +52,18 @@ public:
 
   void SetNominalFlightAltitude(double flight_altitude) {this->nominal_altitude = flight_altitude;};
   void SetSoftTopSpeed(double top_speed) {this->soft_top_speed = top_speed;}
+  void SetRefinementTimeBudget(double seconds) {this->refinement_time_budget = seconds;}
+  void SetCollisionReuseTolerance(double tolerance);
+  size_t getNumCollisionSamplesReused() {
+    return num_collision_samples_reused;
+  }
+  void SetMotionBVHCulling(bool use_motion_bvh) {this->use_motion_bvh = use_motion_bvh;}
+  size_t getNumMotionsCulled() {
+    return num_motions_culled;
+  }
+
+  // Collision probability of any motion against the current clouds, without touching the per-motion caches
+  void computeProbabilityOfCollisionOneMotion(Motion motion, double &collision_probability, double &hokuyo_collision_probability, bool beyond_obstacle_reach = false);
 
 private:
   
@@ -45,22 +71,25 @@ private:
   ValueGridEvaluator value_grid_evaluator;
   DepthImageCollisionEvaluator depth_image_collision_evaluator;
 
-  // For Euclidean
-  void EvaluateObjectivesEuclid();
-  double EvaluateWeightedObjectiveEuclid(size_t const& motion_index);
- 
-  // For Dijkstra
-  void EvaluateObjectivesDijkstra();
-  double EvaluateWeightedObjectiveDijkstra(size_t index);
+  // Weighted objectives composed from objective_policies.h
+  ObjectiveContext MakeObjectiveContext(Vector3 const& carrot_body_frame);
+  template <typename Objective>
+  void EvaluateObjectives(ObjectiveContext const& context, std::vector<double> &objectives);
+  template <typename Objective>
+  double EvaluateObjectiveOneMotion(ObjectiveContext const& context, size_t motion_index);
   
   // Evaluate individual objectives
-  void EvaluateDijkstraCost(Vector3 const& carrot_world_frame, geometry_msgs::TransformStamped const& tf);
-  void EvaluateGoalProgress(Vector3 const& carrot_body_frame);
-  void EvaluateTerminalVelocityCost();
-  void EvaluateAltitudeCost();
+  void EvaluateDijkstraCost(Vector3 const& carrot_world_frame, Eigen::Isometry3d const& ortho_body_to_world);
 
   void EvaluateCollisionProbabilities();
-  void computeProbabilityOfCollisionOneMotion(Motion motion, double &collision_probability, double &hokuyo_collision_probability);
+  void EvaluateCollisionProbabilityOneMotion(size_t motion_index);
+  void UpdateEvaluationOrder();
+  void RefineBestMotion(Vector3 const& carrot_body_frame, size_t best_traj_index, std::chrono::steady_clock::time_point const& deadline, size_t max_samples, Vector3 &desired_acceleration);
+  Motion MotionWithAcceleration(Motion const& reference_motion, Vector3 const& acceleration);
+  void UpdateMotionsBeyondObstacleReach();
+  void UpdateMotionSweptBoxes();
+  bool LibraryFileMatchesSamplingTimes();
+  void computeProbabilityOfCollisionOneMotionReusingSamples(size_t motion_index, double &collision_probability, double &hokuyo_collision_probability);
   double computeProbabilityOfCollisionOneMotion_MonteCarlo(Motion motion, std::vector<Vector3> sampled_initial_velocities, size_t n);
   
   double final_time;
@@ -71,9 +100,8 @@ private:
   size_t num_samples_collision = collision_sampling_time_vector.size();
 
   std::vector<double> dijkstra_evaluations;
-  std::vector<double> goal_progress_evaluations;
-  std::vector<double> terminal_velocity_evaluations;
-  std::vector<double> altitude_evaluations;
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic> dijkstra_sample_positions;
+  Eigen::VectorXi dijkstra_sample_values;
 
   std::vector<double> collision_probabilities;
   std::vector<double> no_collision_probabilities;
@@ -92,6 +120,39 @@ private:
 
   Vector3 last_desired_acceleration;
 
+  // Deadline-aware evaluation
+  size_t last_best_traj_index = 0;
+  std::vector<size_t> evaluation_order;
+  std::vector<bool> motion_evaluated;
+  size_t num_motions_evaluated = 0;
+  size_t num_refinement_samples = 0;
+
+  // Per-sample collision results kept across cycles, indexed by motion_index*num_samples_collision + time_step_index.
+  // A sample is reused while it moved less than collision_reuse_tolerance and no obstacle changed nearby; 0 disables.
+  double collision_reuse_tolerance = 0.0;
+  std::vector<bool> collision_cache_valid;
+  std::vector<size_t> collision_cache_generation;
+  std::vector<Vector3> cached_collision_positions;
+  std::vector<Vector3> cached_collision_sigmas;
+  std::vector<double> cached_laser_collision_probabilities;
+  std::vector<double> cached_depth_image_collision_probabilities;
+  size_t num_collision_samples_reused = 0;
+
+  // Below this a point's contribution to the collision probability is ignored when reusing or culling
+  double negligible_probability_of_collision = 1e-4;
+
+  // Motions whose swept volume is beyond the reach of every obstacle skip the nearest-obstacle queries
+  bool use_motion_bvh = false;
+  MotionBVH motion_bvh;
+  std::vector<Eigen::AlignedBox<Scalar, 3> > motion_swept_boxes;
+  std::vector<bool> motion_beyond_obstacle_reach;
+  size_t num_motions_culled = 0;
+
+  // Seconds spent refining the selected motion each cycle, 0 disables
+  double refinement_time_budget = 0.0;
+  std::mt19937 refinement_generator;
+  Motion selected_motion;
+
 };
 
 #endif
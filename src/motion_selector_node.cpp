@@ -1,4 +1,5 @@
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <nav_msgs/Path.h>
 #include <visualization_msgs/Marker.h>
 #include <sensor_msgs/PointCloud2.h>
@@ -6,6 +7,9 @@
 #include "geometry_msgs/TwistStamped.h"
 #include <mavros_msgs/AttitudeTarget.h>
 #include <nav_msgs/OccupancyGrid.h>
+#include <map_msgs/OccupancyGridUpdate.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <std_srvs/Trigger.h>
 #include <sensor_msgs/PointCloud2.h>
 
 #include "tf/tf.h"
@@ -21,6 +25,7 @@
 #include "pcl_ros/transforms.h"
 #include "pcl_ros/impl/transforms.hpp"
 
+#include <atomic>
 #include <mutex>
 #include <cmath>
 #include <time.h>
@@ -28,296 +33,500 @@
 #include <chrono>
 
 #include "motion_selector.h"
+#include "motion_planner.h"
+#include "flight_log.h"
+#include "motion_selector_utils.h"
+#include "cost_to_go_grid.h"
+#include "cost_to_go_volume.h"
 #include "attitude_generator.h"
 #include "motion_visualizer.h"
-
-
+#include "latency_histogram.h"
+#include "seqlock.h"
+#include "spsc_queue.h"
+#include "stage_thread.h"
+#include "trace.h"
+
+
+// The node runs as four stages, each on its own thread: sensor ingest moves clouds into the
+// ortho_body frame, map build turns them into the collision index and onboard value grid, planning
+// selects the motion, and control publishes the attitude setpoint at a fixed rate.  Data moves
+// forward through bounded lock-free single-producer queues; a full queue drops the newest item,
+// and consumers only keep the latest of what piled up.  Control never waits on another stage.
+// ROS callbacks only push into the queues, and each queue is fed by one subscription, whose
+// callbacks never run concurrently.  Pose, velocity and carrot are published together as one
+// vehicle state snapshot, which every stage reads whole.  Cloud and value grid callbacks are served
+// from their own callback queue and spinner threads, apart from the pose, velocity and goal
+// callbacks, so a burst of clouds never delays a state update.
 class MotionSelectorNode {
 public:
 
-	MotionSelectorNode() {
+	MotionSelectorNode()
+		: depth_cloud_queue(2), laser_cloud_queue(2), sensor_frame_queue(4), map_update_queue(4),
+		  control_command_queue(4) {
 
 		// Subscribers
 
-		pose_sub = nh.subscribe("/pose", 1, &MotionSelectorNode::OnPose, this);
-		velocity_sub = nh.subscribe("/twist", 1, &MotionSelectorNode::OnVelocity, this);
-  	    depth_image_sub = nh.subscribe("/flight/r200/points_xyz", 1, &MotionSelectorNode::OnDepthImage, this);
-  	    local_goal_sub = nh.subscribe("/local_goal", 1, &MotionSelectorNode::OnLocalGoal, this);
-  	    //value_grid_sub = nh.subscribe("/value_grid", 1, &MotionSelectorNode::OnValueGrid, this);
-  	    laser_scan_sub = nh.subscribe("/laserscan_to_pointcloud/cloud2_out", 1, &MotionSelectorNode::OnScan, this);
+		sensor_nh.setCallbackQueue(&sensor_callback_queue);
+		state_nh.setCallbackQueue(&state_callback_queue);
+		pose_sub = state_nh.subscribe("/pose", 1, &MotionSelectorNode::OnPose, this);
+		velocity_sub = state_nh.subscribe("/twist", 1, &MotionSelectorNode::OnVelocity, this);
+  	    depth_image_sub = sensor_nh.subscribe("/flight/r200/points_xyz", 1, &MotionSelectorNode::OnDepthImage, this);
+  	    local_goal_sub = state_nh.subscribe("/local_goal", 1, &MotionSelectorNode::OnLocalGoal, this);
+  	    laser_scan_sub = sensor_nh.subscribe("/laserscan_to_pointcloud/cloud2_out", 1, &MotionSelectorNode::OnScan, this);
 
 
   	    // Publishers
   	    carrot_pub = nh.advertise<visualization_msgs::Marker>( "carrot_marker", 0 );
 		gaussian_pub = nh.advertise<visualization_msgs::Marker>( "gaussian_visualization", 0 );
 		attitude_thrust_pub = nh.advertise<mavros_msgs::AttitudeTarget>("/mux_input_1", 1);
+		diagnostics_pub = nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
 		//attitude_setpoint_visualization_pub = nh.advertise<geometry_msgs::PoseStamped>("attitude_setpoint", 1);
 
 		// Initialization
-		double acceleration_interpolation_min;
-		double soft_top_speed;
-        double speed_at_acceleration_max;
-        double acceleration_interpolation_max;
-
-		nh.param("soft_top_speed", soft_top_speed, 2.0);
-		nh.param("acceleration_interpolation_min", acceleration_interpolation_min, 3.5);
-		nh.param("yaw_on", yaw_on, false);
+		MotionPlannerConfig planner_config;
+		nh.param("soft_top_speed", planner_config.soft_top_speed, 2.0);
+		nh.param("acceleration_interpolation_min", planner_config.acceleration_interpolation_min, 3.5);
+		nh.param("yaw_on", planner_config.yaw_on, false);
 		nh.param("use_depth_image", use_depth_image, true);
-        nh.param("speed_at_acceleration_max", speed_at_acceleration_max, 10.0);
-        nh.param("acceleration_interpolation_max", acceleration_interpolation_max, 4.0);
+        nh.param("speed_at_acceleration_max", planner_config.speed_at_acceleration_max, 10.0);
+        nh.param("acceleration_interpolation_max", planner_config.acceleration_interpolation_max, 4.0);
         nh.param("flight_altitude", flight_altitude, 1.2);
         nh.param("use_3d_library", use_3d_library, false);
-        nh.param("max_e_stop_pitch_degrees", max_e_stop_pitch_degrees, 60.0);
+        nh.param("max_e_stop_pitch_degrees", planner_config.max_e_stop_pitch_degrees, 60.0);
         nh.param("laser_z_below_project_up", laser_z_below_project_up, -0.5);
-
-		this->soft_top_speed_max = soft_top_speed;
-
-		motion_selector.InitializeLibrary(use_3d_library, final_time, soft_top_speed, acceleration_interpolation_min, speed_at_acceleration_max, acceleration_interpolation_max);
-		motion_selector.SetNominalFlightAltitude(flight_altitude);
+        nh.param("laser_grid_half_width", planner_config.laser_grid_half_width, 12.0);
+        nh.param("laser_grid_resolution", planner_config.laser_grid_resolution, 0.1);
+        nh.param("refinement_time_budget", planner_config.refinement_time_budget, 0.0);
+        nh.param("planning_deadline", planning_deadline, 0.0);
+        nh.param("collision_reuse_tolerance", planner_config.collision_reuse_tolerance, 0.0);
+        nh.param("use_value_grid", use_value_grid, false);
+        nh.param("use_onboard_value_grid", use_onboard_value_grid, false);
+		// Both would write one ValueGridEvaluator with values from different grids
+		if (use_value_grid && use_onboard_value_grid) {
+			ROS_WARN("use_value_grid and use_onboard_value_grid are both set, using the onboard value grid only");
+			use_value_grid = false;
+		}
+		planner_config.final_time = final_time;
+		planner_config.flight_altitude = flight_altitude;
+		planner_config.use_3d_library = use_3d_library;
+		planner_config.use_dijkstra = use_value_grid || use_onboard_value_grid;
+
+		// Full grids and incremental updates to them, for the Dijkstra objective
+		if (use_value_grid) {
+			value_grid_sub = sensor_nh.subscribe("/value_grid", 1, &MotionSelectorNode::OnValueGrid, this);
+			value_grid_update_sub = sensor_nh.subscribe("/value_grid_updates", 10, &MotionSelectorNode::OnValueGridUpdate, this);
+		}
+
+		// Or the value grid is computed onboard from the laser scans and the carrot
+		double onboard_value_grid_half_width, onboard_value_grid_resolution, onboard_value_grid_inflation_radius, onboard_value_grid_meters_per_value;
+		int onboard_value_grid_max_cells_per_update;
+		nh.param("onboard_value_grid_half_width", onboard_value_grid_half_width, 50.0);
+		nh.param("onboard_value_grid_resolution", onboard_value_grid_resolution, 0.2);
+		nh.param("onboard_value_grid_inflation_radius", onboard_value_grid_inflation_radius, 0.5);
+		nh.param("onboard_value_grid_meters_per_value", onboard_value_grid_meters_per_value, 0.5);
+		nh.param("onboard_value_grid_max_cells_per_update", onboard_value_grid_max_cells_per_update, 0);
+		int onboard_value_grid_rebuild_threads;
+		nh.param("onboard_value_grid_rebuild_threads", onboard_value_grid_rebuild_threads, 0);
+		nh.param("onboard_value_grid_obstacle_min_z", onboard_value_grid_obstacle_min_z, -0.3);
+		nh.param("onboard_value_grid_obstacle_max_z", onboard_value_grid_obstacle_max_z, 0.3);
+		size_t onboard_value_grid_num_cells_per_side = 2.0*onboard_value_grid_half_width / onboard_value_grid_resolution;
+		cost_to_go_grid.SetGrid(onboard_value_grid_resolution, onboard_value_grid_num_cells_per_side, onboard_value_grid_num_cells_per_side,
+		                        -onboard_value_grid_half_width, -onboard_value_grid_half_width);
+		cost_to_go_grid.SetObstacleInflationRadius(onboard_value_grid_inflation_radius);
+		cost_to_go_grid.SetMetersPerValue(onboard_value_grid_meters_per_value);
+		cost_to_go_grid.SetRebuildThreads(std::max(onboard_value_grid_rebuild_threads, 0));
+		this->onboard_value_grid_max_cells_per_update = std::max(onboard_value_grid_max_cells_per_update, 0);
+
+		// With the 3D library, the same field is also computed in altitude layers around the flight
+		// altitude and scored as a volume, so the vertical rings read the layer they reach
+		int onboard_value_volume_num_layers;
+		double onboard_value_volume_layer_spacing;
+		nh.param("onboard_value_volume_num_layers", onboard_value_volume_num_layers, 0);
+		nh.param("onboard_value_volume_layer_spacing", onboard_value_volume_layer_spacing, 0.6);
+		use_onboard_value_volume = use_onboard_value_grid && use_3d_library && (onboard_value_volume_num_layers > 0);
+		if (use_onboard_value_volume) {
+			cost_to_go_volume.SetLayers(onboard_value_grid_resolution, onboard_value_grid_num_cells_per_side, onboard_value_grid_num_cells_per_side,
+			                            -onboard_value_grid_half_width, -onboard_value_grid_half_width,
+			                            flight_altitude - 0.5*(onboard_value_volume_num_layers - 1)*onboard_value_volume_layer_spacing,
+			                            onboard_value_volume_layer_spacing, onboard_value_volume_num_layers);
+			cost_to_go_volume.SetObstacleInflationRadius(onboard_value_grid_inflation_radius);
+			cost_to_go_volume.SetMetersPerValue(onboard_value_grid_meters_per_value);
+			cost_to_go_volume.SetRebuildThreads(std::max(onboard_value_grid_rebuild_threads, 0));
+			cost_to_go_volume.SetObstacleBand(onboard_value_grid_obstacle_min_z, onboard_value_grid_obstacle_max_z);
+		}
+
+		// Acceleration grid the library is built from
+		nh.param("acceleration_grid_horizontal_fractions", planner_config.acceleration_grid_horizontal_fractions, std::vector<double>({1.0, 0.6, 0.15}));
+		nh.param("acceleration_grid_vertical_accelerations", planner_config.acceleration_grid_vertical_accelerations, std::vector<double>({-2.0, -0.75, 0.75, 2.0}));
+		nh.param("acceleration_grid_samples_around_circle", planner_config.acceleration_grid_samples_around_circle, 8);
+		nh.param("use_motion_bvh", planner_config.use_motion_bvh, false);
+		nh.param("motion_library_file", planner_config.motion_library_file, std::string(""));
+
+		// Camera model and speed-dependent depth image resolution
+		nh.param("camera_fx", planner_config.camera_fx, 308.57684326171875);
+		nh.param("camera_fy", planner_config.camera_fy, 308.57684326171875);
+		nh.param("camera_cx", planner_config.camera_cx, 154.6868438720703);
+		nh.param("camera_cy", planner_config.camera_cy, 120.21442413330078);
+		nh.param("camera_width", planner_config.camera_width, 320);
+		nh.param("camera_height", planner_config.camera_height, 240);
+		nh.param("depth_image_decimation", planner_config.depth_image_decimation, 4.0);
+		nh.param("depth_pyramid_speeds", planner_config.depth_pyramid_speeds, std::vector<double>());
+
+		// A generated library file replaces the grid; it must have been generated with the same acceleration parameters
+		std::string error;
+		if (!motion_planner.Configure(planner_config, error)) {
+			ROS_ERROR("Could not load motion library, using the acceleration grid: %s", error.c_str());
+		}
+		else if (!planner_config.motion_library_file.empty()) {
+			ROS_INFO("Loaded motion library %s", planner_config.motion_library_file.c_str());
+		}
 		attitude_generator.setZsetpoint(flight_altitude);
 
-		motion_visualizer.initialize(&motion_selector, nh, &best_traj_index, final_time);
+		// Every planner input from here on, for replay with motion_selector_replay
+		std::string flight_log_file;
+		nh.param("flight_log_file", flight_log_file, std::string(""));
+		if (!flight_log_file.empty()) {
+			if (flight_log.Open(flight_log_file)) {
+				motion_planner.SetFlightLog(&flight_log);
+				ROS_INFO("Logging planner inputs to %s", flight_log_file.c_str());
+			}
+			else {
+				ROS_ERROR("Could not open the flight log: %s", flight_log.GetError().c_str());
+			}
+		}
+
+		motion_visualizer.initialize(&motion_selector, nh, final_time);
 		tf_listener_ = std::make_shared<tf2_ros::TransformListener>(tf_buffer_);
 		srand ( time(NULL) ); //initialize the random seed
 
+		control_stage.Start(std::bind(&MotionSelectorNode::ControlStep, this), std::chrono::milliseconds(10));
+		planning_stage.Start(std::bind(&MotionSelectorNode::PlanningStep, this), planning_period);
+		map_stage.Start(std::bind(&MotionSelectorNode::MapStep, this), std::chrono::milliseconds(100));
+		ingest_stage.Start(std::bind(&MotionSelectorNode::IngestStep, this), std::chrono::milliseconds(100));
+		diagnostics_stage.Start(std::bind(&MotionSelectorNode::DiagnosticsStep, this), std::chrono::seconds(1));
+
+		int trace_events_per_thread;
+		nh.param("trace_events_per_thread", trace_events_per_thread, 0);
+		nh.param("trace_file", trace_file, std::string("/tmp/motion_selector_trace.json"));
+		if (trace_events_per_thread > 0) {
+			Trace::Enable(trace_events_per_thread);
+			dump_trace_service = state_nh.advertiseService("dump_trace", &MotionSelectorNode::OnDumpTrace, this);
+		}
+
+		// Callbacks start only once every stage can take their messages
+		int sensor_callback_threads, state_callback_threads;
+		nh.param("sensor_callback_threads", sensor_callback_threads, 1);
+		nh.param("state_callback_threads", state_callback_threads, 1);
+		sensor_spinner.reset(new ros::AsyncSpinner(std::max(sensor_callback_threads, 1), &sensor_callback_queue));
+		state_spinner.reset(new ros::AsyncSpinner(std::max(state_callback_threads, 1), &state_callback_queue));
+		sensor_spinner->start();
+		state_spinner->start();
+
 		ROS_INFO("Finished constructing the motion selector node");
 	}
 
-	void SetThrustForLibrary(double thrust) {
-		MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
-		if (motion_library_ptr != nullptr) {
-			motion_library_ptr->setThrust(thrust);
-		}
+	// Callbacks and then stages upstream first, so nothing is pushed to a stopped stage
+	~MotionSelectorNode() {
+		sensor_spinner->stop();
+		state_spinner->stop();
+		ingest_stage.Stop();
+		map_stage.Stop();
+		planning_stage.Stop();
+		control_stage.Stop();
+		diagnostics_stage.Stop();
 	}
 
-	geometry_msgs::TransformStamped GetTransformToWorld() {
-		geometry_msgs::TransformStamped tf;
-	    try {
+	void ReactToSampledPointCloud() {
+		std::chrono::steady_clock::time_point step_start_time = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+		if (planning_deadline > 0.0) {
+			deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(planning_deadline));
+		}
+
+		MotionPlanner::Plan plan = motion_planner.ComputePlan(ros::Time::now().toSec(), deadline, library_thrust.load());
+		if (motion_planner.getNumMotionsEvaluated() < motion_selector.getNumMotions()) {
+			ROS_WARN_THROTTLE(1.0, "Planning deadline hit, evaluated %zu of %zu motions", motion_planner.getNumMotionsEvaluated(), motion_selector.getNumMotions());
+		}
+		motion_visualizer.setCollisionProbabilities(motion_planner.getCollisionProbabilities());
+		motion_visualizer.setBestMotion(motion_planner.getBestMotion());
 
-	      tf = tf_buffer_.lookupTransform("world", "ortho_body", 
-	                                    ros::Time(0), ros::Duration(1.0/30.0));
-	    } catch (tf2::TransformException &ex) {
-	      ROS_ERROR("%s", ex.what());
-	      return tf;
-	    }
-	    return tf;
+		ControlCommand command;
+		command.desired_acceleration = plan.desired_acceleration;
+		command.has_z_setpoint = plan.has_z_setpoint;
+		command.z_setpoint = plan.z_setpoint;
+		command.has_bearing = plan.has_bearing;
+		command.bearing_azimuth_degrees = plan.bearing_azimuth_degrees;
+		command.sensor_stamp = planning_sensor_stamp;
+		Forward(control_command_queue, command, "control command");
+		control_stage.Wake();
+		planning_duration.Record(MicrosecondsSince(step_start_time));
 	}
 
-	bool CheckIfInevitableCollision(std::vector<double> const hokuyo_collision_probabilities) {
-		for (size_t i = 0; i < hokuyo_collision_probabilities.size(); i++) {
-			if (hokuyo_collision_probabilities.at(i) < 0.6) {
-				return false;
-			}
-		}
-		return true;
+	bool UseDepthImage() {
+		return use_depth_image;
 	}
 
-	void ReactToSampledPointCloud() {
-		auto t1 = std::chrono::high_resolution_clock::now();
-		mutex.lock();
-		motion_selector.computeBestEuclideanMotion(carrot_ortho_body_frame, best_traj_index, desired_acceleration);
-		// geometry_msgs::TransformStamped tf = GetTransformToWorld();
-		// motion_selector.computeBestDijkstraMotion(carrot_ortho_body_frame, carrot_world_frame, tf, best_traj_index, desired_acceleration);
-	    mutex.unlock();
-		
-		mutex.lock();
-      	std::vector<double> collision_probabilities = motion_selector.getCollisionProbabilities();
-      	std::vector<double> hokuyo_collision_probabilities = motion_selector.getHokuyoCollisionProbabilities();
-		motion_visualizer.setCollisionProbabilities(collision_probabilities);
-		if (executing_e_stop || CheckIfInevitableCollision(hokuyo_collision_probabilities)) {
-			ExecuteEStop();
-		}
-	    else if (yaw_on) {
-	    	SetYawFromMotion();
-	    } 
-	    mutex.unlock();
-
-		PublishCurrentAttitudeSetpoint();
-	}
-
-	void ExecuteEStop() {
-		best_traj_index = 0; // this overwrites the "best acceleration motion"
-
-		MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
-		// If first time entering e stop, compute open loop parameters
-		if (!executing_e_stop) {
-			begin_e_stop_time = ros::Time::now().toSec();
-			if (motion_library_ptr != nullptr) {
-				double e_stop_acceleration_magnitude = 9.8*tan(max_e_stop_pitch_degrees * M_PI / 180.0);
-				Vector3 initial_velocity_ortho_body = motion_library_ptr->getMotionFromIndex(best_traj_index).getVelocity(0.0);
-				Vector3 e_stop_acceleration = -1.0 * e_stop_acceleration_magnitude * initial_velocity_ortho_body/initial_velocity_ortho_body.norm();
-				motion_library_ptr->setBestAccelerationMotion(e_stop_acceleration);
-				Vector3 end_jerk_velocity_ortho_body = motion_library_ptr->getMotionFromIndex(best_traj_index).getVelocity(0.2);
-
-				e_stop_time_needed = end_jerk_velocity_ortho_body.norm() / e_stop_acceleration_magnitude / 0.85;
-				std::cout << "E STOP TIME NEEDED " << e_stop_time_needed << std::endl;
-			}
-		}
-		executing_e_stop = true;
-		if (motion_library_ptr != nullptr) {
-			desired_acceleration = motion_library_ptr->getMotionFromIndex(best_traj_index).getAcceleration();
-		}
+	void drawAll() {
+		selector_mutex.lock();
+		motion_visualizer.drawAll();
+		selector_mutex.unlock();
+	}
 
+private:
 
-		// Check if time to exit open loop e stop
-		double e_stop_time_elapsed = ros::Time::now().toSec() - begin_e_stop_time;
-		std::cout << "E STOP TIME ELAPSED " << e_stop_time_elapsed << std::endl;
-		if (e_stop_time_elapsed > e_stop_time_needed) {
-			executing_e_stop = false;
+	enum SensorSource { DEPTH_IMAGE_SOURCE, LASER_SOURCE };
+
+	// Resolved from tf on first use, then read without locking
+	struct SensorExtrinsic {
+		explicit SensorExtrinsic(std::string const& frame) : frame(frame) {};
+		std::string frame;
+		std::atomic<bool> resolved{false};
+		Eigen::Isometry3d body_to_sensor = Eigen::Isometry3d::Identity();
+	};
+
+	// Cloud already in the ortho_body frame, with the rotation into the camera frame for depth images
+	struct SensorFrame {
+		SensorSource source;
+		double stamp;
+		pcl::PointCloud<pcl::PointXYZ>::Ptr ortho_body_cloud;
+		Matrix3 ortho_body_to_rdf;
+	};
+
+	struct MapUpdate {
+		bool depth_image_updated;
+		double sensor_stamp;
+	};
+
+	// Each part counts its updates, so a reader can tell which parts changed since its last snapshot
+	struct VehicleState {
+		double x, y, z;
+		double roll, pitch, yaw;
+		uint64_t num_pose_updates;
+		double velocity_world_frame[3];
+		uint64_t num_velocity_updates;
+		double carrot_world_frame[3];
+		uint64_t num_carrot_updates;
+	};
+
+	struct ControlCommand {
+		Vector3 desired_acceleration = Vector3::Zero();
+		bool has_z_setpoint = false;
+		double z_setpoint = 0.0;
+		bool has_bearing = false;
+		double bearing_azimuth_degrees = 0.0;
+		double sensor_stamp = 0.0;   // newest sensor data the plan saw
+	};
+
+	static uint64_t MicrosecondsSince(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	template <class T>
+	void Forward(SpscQueue<T> &queue, T item, char const* name) {
+		if (!queue.TryPush(std::move(item))) {
+			ROS_WARN_THROTTLE(1.0, "Dropped %s, the next stage is behind", name);
+		}
+	}
+
+	// Clouds whose sensor extrinsic is not known yet are dropped
+	void IngestStep() {
+		TraceSpan span("IngestStep");
+		VehicleState state = vehicle_state.Load();
+		sensor_msgs::PointCloud2ConstPtr point_cloud_msg;
+		Eigen::Isometry3d ortho_body_to_sensor;
+		if (depth_cloud_queue.PopLatest(point_cloud_msg) && OrthoBodyToSensor(rdf_extrinsic, state.roll, state.pitch, ortho_body_to_sensor)) {
+			std::chrono::steady_clock::time_point step_start_time = std::chrono::steady_clock::now();
+			SensorFrame frame;
+			frame.source = DEPTH_IMAGE_SOURCE;
+			frame.stamp = point_cloud_msg->header.stamp.toSec();
+			frame.ortho_body_cloud.reset(new pcl::PointCloud<pcl::PointXYZ>);
+			TransformToOrthoBodyPointCloud(ortho_body_to_sensor.inverse(Eigen::Isometry), point_cloud_msg, frame.ortho_body_cloud);
+			frame.ortho_body_to_rdf = ortho_body_to_sensor.linear();
+			Forward(sensor_frame_queue, frame, "depth image");
+			map_stage.Wake();
+			ingest_duration.Record(MicrosecondsSince(step_start_time));
+		}
+		if (laser_cloud_queue.PopLatest(point_cloud_msg) && OrthoBodyToSensor(laser_extrinsic, state.roll, state.pitch, ortho_body_to_sensor)) {
+			std::chrono::steady_clock::time_point step_start_time = std::chrono::steady_clock::now();
+			SensorFrame frame;
+			frame.source = LASER_SOURCE;
+			frame.stamp = point_cloud_msg->header.stamp.toSec();
+			frame.ortho_body_cloud.reset(new pcl::PointCloud<pcl::PointXYZ>);
+			TransformToOrthoBodyPointCloud(ortho_body_to_sensor.inverse(Eigen::Isometry), point_cloud_msg, frame.ortho_body_cloud);
+		    if (!use_3d_library) {
+		    	ProjectOrthoBodyLaserPointCloud(frame.ortho_body_cloud);
+		    }
+			Forward(sensor_frame_queue, frame, "laser scan");
+			map_stage.Wake();
+			ingest_duration.Record(MicrosecondsSince(step_start_time));
 		}
 	}
 
-	void ComputeBestAccelerationMotion() {
-		if (executing_e_stop) { //Does not compute if executing e stop
+	void MapStep() {
+		TraceSpan span("MapStep");
+		SensorFrame frame, depth_image_frame, laser_frame;
+		bool has_depth_image_frame = false;
+		bool has_laser_frame = false;
+		while (sensor_frame_queue.TryPop(frame)) {
+			if (frame.source == DEPTH_IMAGE_SOURCE) {
+				depth_image_frame = std::move(frame);
+				has_depth_image_frame = true;
+			}
+			else {
+				laser_frame = std::move(frame);
+				has_laser_frame = true;
+			}
+		}
+		if (!has_depth_image_frame && !has_laser_frame) {
 			return;
 		}
+		std::chrono::steady_clock::time_point step_start_time = std::chrono::steady_clock::now();
+		double sensor_stamp = std::max(has_depth_image_frame ? depth_image_frame.stamp : 0.0, has_laser_frame ? laser_frame.stamp : 0.0);
 
-		mutex.lock();
-		MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
-		if (motion_library_ptr != nullptr) {
-
-			// compute best acceleration in open field
-			double time_to_eval = 0.5;
-			Vector3 initial_velocity_ortho_body = motion_library_ptr->getMotionFromIndex(best_traj_index).getVelocity(0.0);
-			Vector3 position_if_dont_accel = initial_velocity_ortho_body*time_to_eval;
-			Vector3 vector_towards_goal = (carrot_ortho_body_frame - position_if_dont_accel);
-			Vector3 best_acceleration = ((vector_towards_goal/vector_towards_goal.norm()) * soft_top_speed_max - initial_velocity_ortho_body) / time_to_eval;
-			double current_max_acceleration = motion_library_ptr->getNewMaxAcceleration();
-			if (best_acceleration.norm() > current_max_acceleration) {
-				best_acceleration = best_acceleration * current_max_acceleration / best_acceleration.norm();
-			}
-			motion_library_ptr->setBestAccelerationMotion(best_acceleration);
-
-			// if within stopping distance, line search for best stopping acceleration
-			Vector3 stop_position = motion_library_ptr->getMotionFromIndex(0).getTerminalStopPosition(0.5);
-			double stop_distance = stop_position.dot(vector_towards_goal/vector_towards_goal.norm());
-			double distance_to_carrot = carrot_ortho_body_frame(0);
-			
-			int max_line_searches = 10;
-			int counter_line_searches = 0;
-			while ( (stop_distance > distance_to_carrot) && (counter_line_searches < max_line_searches) ) {
-				best_acceleration = best_acceleration * distance_to_carrot / stop_distance;
-				if (best_acceleration.norm() > current_max_acceleration) {
-					best_acceleration = best_acceleration * current_max_acceleration / best_acceleration.norm();
-				}
-				motion_library_ptr->setBestAccelerationMotion(best_acceleration);
-				stop_position = motion_library_ptr->getMotionFromIndex(0).getTerminalStopPosition(0.5);
-				stop_distance = stop_position.dot(vector_towards_goal/vector_towards_goal.norm());
-				counter_line_searches++;	
-			} 
-
+		if (has_depth_image_frame) {
+			motion_planner.UpdateDepthImage(depth_image_frame.ortho_body_cloud, depth_image_frame.ortho_body_to_rdf);
+		}
+		if (has_laser_frame) {
+			motion_planner.UpdateLaserScan(laser_frame.ortho_body_cloud);
 		}
-		mutex.unlock();
-	}
 
-	void PublishCurrentAttitudeSetpoint() {
-		mutex.lock();
-		if (use_3d_library) {
-			AltitudeFeedbackOnBestMotion();
+		if (has_laser_frame && use_onboard_value_grid) {
+			UpdateOnboardValueGrid(laser_frame.ortho_body_cloud, vehicle_state.Load());
 		}
-		Vector3 attitude_thrust_desired = attitude_generator.generateDesiredAttitudeThrust(desired_acceleration);
-		SetThrustForLibrary(attitude_thrust_desired(2));
-		mutex.unlock();
-		PublishAttitudeSetpoint(attitude_thrust_desired);
+
+		Forward(map_update_queue, MapUpdate{has_depth_image_frame, sensor_stamp}, "map update");
+		planning_stage.Wake();
+		map_duration.Record(MicrosecondsSince(step_start_time));
 	}
 
-	void AltitudeFeedbackOnBestMotion() {
-		MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
-		if (motion_library_ptr != nullptr) {
-				Motion best_motion = motion_library_ptr->getMotionFromIndex(best_traj_index);
-				Vector3 best_motion_position_ortho_body =  best_motion.getPosition(0.5);
-				Vector3 best_motion_position_world = TransformOrthoBodyToWorld(best_motion_position_ortho_body);
-				double new_z_setpoint = best_motion_position_world(2);
-				attitude_generator.setZsetpoint(new_z_setpoint);
+	// Applies the newest state, then plans on every new depth image, or at the planning period
+	// when only the laser is used
+	void PlanningStep() {
+		TraceSpan span("PlanningStep");
+		VehicleState state = vehicle_state.Load();
+		if (state.num_carrot_updates != planning_state.num_carrot_updates) {
+			ApplyLocalGoal(Vector3(state.carrot_world_frame[0], state.carrot_world_frame[1], state.carrot_world_frame[2]));
 		}
-	}
+		if (state.num_pose_updates != planning_state.num_pose_updates) {
+			ApplyPose(state);
+		}
+		if (state.num_velocity_updates != planning_state.num_velocity_updates) {
+			motion_planner.ApplyVelocity(Vector3(state.velocity_world_frame[0], state.velocity_world_frame[1], state.velocity_world_frame[2]));
+		}
+		planning_state = state;
 
-	bool UseDepthImage() {
-		return use_depth_image;
-	}
+		bool depth_image_updated = false;
+		MapUpdate map_update;
+		while (map_update_queue.TryPop(map_update)) {
+			depth_image_updated = depth_image_updated || map_update.depth_image_updated;
+			planning_sensor_stamp = std::max(planning_sensor_stamp, map_update.sensor_stamp);
+		}
 
-	void drawAll() {
-		mutex.lock();
-		motion_visualizer.drawAll();
-		mutex.unlock();
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (UseDepthImage() ? depth_image_updated : (now - last_planning_time >= planning_period)) {
+			last_planning_time = now;
+			ReactToSampledPointCloud();
+		}
+		if (now - last_drawing_time >= planning_period) {
+			last_drawing_time = now;
+			drawAll();
+		}
 	}
 
-private:
-
+	void ControlStep() {
+		TraceSpan span("ControlStep");
+		std::chrono::steady_clock::time_point step_start_time = std::chrono::steady_clock::now();
+		VehicleState state = vehicle_state.Load();
+		attitude_generator.setZ(state.z);
+		attitude_generator.setZvelocity(state.velocity_world_frame[2]);
+		UpdateAttitudeGeneratorRollPitch(state.roll, state.pitch);
+		control_yaw = state.yaw;
 
-	void SetYawFromMotion() {
-		MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
-		if (motion_library_ptr != nullptr) {
-
-			// get position at t=0
-			Vector3 initial_position_ortho_body = motion_library_ptr->getMotionFromIndex(best_traj_index).getPosition(0.0);
-			// get velocity at t=0
-			Vector3 initial_velocity_ortho_body = motion_library_ptr->getMotionFromIndex(best_traj_index).getVelocity(0.5);
-			Vector3 final_velocity_ortho_body = motion_library_ptr->getMotionFromIndex(best_traj_index).getVelocity(0.5);
-			// normalize velocity
-			double speed_initial = initial_velocity_ortho_body.norm();
-			double speed_final = final_velocity_ortho_body.norm();
-			if (speed_final != 0) {
-				final_velocity_ortho_body = final_velocity_ortho_body / speed_final;
+		ControlCommand command;
+		if (control_command_queue.PopLatest(command)) {
+			commanded_acceleration = command.desired_acceleration;
+			if (command.has_z_setpoint) {
+				attitude_generator.setZsetpoint(command.z_setpoint);
 			}
+			if (command.has_bearing) {
+				bearing_azimuth_degrees = command.bearing_azimuth_degrees;
+			}
+		}
 
-			// add normalized velocity to position to get a future position
-			Vector3 final_position_ortho_body = initial_position_ortho_body + initial_velocity_ortho_body;
-			// yaw towards future position using below
+		Vector3 attitude_thrust_desired = attitude_generator.generateDesiredAttitudeThrust(commanded_acceleration);
+		library_thrust.store(attitude_thrust_desired(2));
+		PublishAttitudeSetpoint(attitude_thrust_desired);
 
-			Vector3 final_position_world = TransformOrthoBodyToWorld(final_position_ortho_body);
-			
-			if (speed_initial < 2.0 && carrot_ortho_body_frame.norm() < 2.0) {
-				motion_selector.SetSoftTopSpeed(soft_top_speed_max);
-				return;
+		// Only the first command planned from each sensor stamp measures how stale the data was
+		if (command.sensor_stamp > last_commanded_sensor_stamp) {
+			last_commanded_sensor_stamp = command.sensor_stamp;
+			double latency = ros::Time::now().toSec() - command.sensor_stamp;
+			if (latency >= 0.0) {
+				sensor_to_command_latency.Record(latency*1e6);
 			}
-			if ((final_position_world(0) - pose_global_x)!= 0) {
-				double potential_bearing_azimuth_degrees = CalculateYawFromPosition(final_position_world);
-				double actual_bearing_azimuth_degrees = -pose_global_yaw * 180.0/M_PI;
-				double bearing_error = potential_bearing_azimuth_degrees - actual_bearing_azimuth_degrees;
-				while(bearing_error > 180) { 
-					bearing_error -= 360;
-				}
-				while(bearing_error < -180) { 
-					bearing_error += 360;
-				}
+		}
+		control_duration.Record(MicrosecondsSince(step_start_time));
+	}
 
-				if (abs(bearing_error) < 60.0)  {
-					motion_selector.SetSoftTopSpeed(soft_top_speed_max);
-					bearing_azimuth_degrees = potential_bearing_azimuth_degrees;
-					return;
-				}
-				motion_selector.SetSoftTopSpeed(0.1);
-				if (speed_initial < 0.5) {
-					bearing_azimuth_degrees = CalculateYawFromPosition(carrot_world_frame);
-				}
+	void DiagnosticsStep() {
+		PublishLatencyDiagnostics();
+		if (trace_dump_requested.exchange(false)) {
+			if (Trace::WriteChromeTrace(trace_file)) {
+				ROS_INFO("Wrote trace to %s", trace_file.c_str());
+			}
+			else {
+				ROS_WARN("Could not write trace to %s", trace_file.c_str());
 			}
 		}
 	}
 
-	double CalculateYawFromPosition(Vector3 final_position) {
-		return 180.0/M_PI*atan2(-(final_position(1) - pose_global_y), final_position(0) - pose_global_x);	
+	// The dump is written by the diagnostics stage, so it never holds up the state callbacks
+	bool OnDumpTrace(std_srvs::Trigger::Request &request, std_srvs::Trigger::Response &response) {
+		trace_dump_requested.store(true);
+		diagnostics_stage.Wake();
+		response.success = true;
+		response.message = "writing trace to " + trace_file;
+		return true;
 	}
-	
 
-	void SetGoalFromBearing() {
-		bool go;
-		nh.param("go", go, false);
-		if (go) {
-			carrot_ortho_body_frame << 100, 0, 0;
-		}
-		else if (carrot_ortho_body_frame(0) == 100) {
-			carrot_ortho_body_frame << 5, 0, 0;
-		}
+	void PublishLatencyDiagnostics() {
+		diagnostic_msgs::DiagnosticArray diagnostics;
+		diagnostics.header.stamp = ros::Time::now();
+		diagnostics.status.push_back(LatencyStatus("sensor to command latency", sensor_to_command_latency));
+		diagnostics.status.push_back(LatencyStatus("ingest stage duration", ingest_duration));
+		diagnostics.status.push_back(LatencyStatus("map stage duration", map_duration));
+		diagnostics.status.push_back(LatencyStatus("planning stage duration", planning_duration));
+		diagnostics.status.push_back(LatencyStatus("control stage duration", control_duration));
+		diagnostics_pub.publish(diagnostics);
 	}
 
-	void UpdateMotionLibraryRollPitch(double roll, double pitch) {
-		MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
-		if (motion_library_ptr != nullptr) {
-			motion_library_ptr->setRollPitch(roll, pitch);
-		}
+	// Percentiles in milliseconds over the window since the last publish
+	diagnostic_msgs::DiagnosticStatus LatencyStatus(std::string const& metric, LatencyHistogram &histogram) {
+		LatencyHistogram::Snapshot snapshot;
+		histogram.TakeSnapshot(snapshot);
+
+		diagnostic_msgs::DiagnosticStatus status;
+		status.level = diagnostic_msgs::DiagnosticStatus::OK;
+		status.name = "motion_selector: " + metric;
+		status.hardware_id = "motion_selector";
+		status.message = snapshot.total_count > 0 ? "ok" : "no samples";
+		AddKeyValue(status, "count", std::to_string(snapshot.total_count));
+		AddKeyValue(status, "p50 ms", std::to_string(snapshot.ValueAtPercentile(50.0)*1e-3));
+		AddKeyValue(status, "p90 ms", std::to_string(snapshot.ValueAtPercentile(90.0)*1e-3));
+		AddKeyValue(status, "p99 ms", std::to_string(snapshot.ValueAtPercentile(99.0)*1e-3));
+		AddKeyValue(status, "p99.9 ms", std::to_string(snapshot.ValueAtPercentile(99.9)*1e-3));
+		AddKeyValue(status, "max ms", std::to_string(snapshot.max_value*1e-3));
+		return status;
+	}
+
+	static void AddKeyValue(diagnostic_msgs::DiagnosticStatus &status, std::string const& key, std::string const& value) {
+		diagnostic_msgs::KeyValue key_value;
+		key_value.key = key;
+		key_value.value = value;
+		status.values.push_back(key_value);
 	}
 
+
 	void PublishOrthoBodyTransform(double roll, double pitch) {
 		static tf2_ros::TransformBroadcaster br;
   		geometry_msgs::TransformStamped transformStamped;
@@ -338,181 +547,83 @@ private:
 	    br.sendTransform(transformStamped);
 	}
 
-	void UpdateCarrotOrthoBodyFrame() {
-		geometry_msgs::TransformStamped tf;
-	    try {
-
-	      tf = tf_buffer_.lookupTransform("ortho_body", "world", 
-	                                    ros::Time(0), ros::Duration(1.0/30.0));
-	    } catch (tf2::TransformException &ex) {
-	      ROS_ERROR("%s", ex.what());
-	      return;
-	    }
+	// Sensors are fixed on the body, so their extrinsic is looked up once; the rest of the chain is
+	// the ortho_body rotation the node itself broadcasts
+	bool ResolveExtrinsic(SensorExtrinsic &extrinsic) {
+		if (!extrinsic.resolved.load(std::memory_order_acquire)) {
+			std::lock_guard<std::mutex> lock(extrinsics_mutex);
+			if (!extrinsic.resolved.load(std::memory_order_relaxed)) {
+				geometry_msgs::TransformStamped tf;
+				try {
+					tf = tf_buffer_.lookupTransform(extrinsic.frame, "body", ros::Time(0), ros::Duration(1/30.0));
+				} catch (tf2::TransformException &ex) {
+					ROS_ERROR_THROTTLE(1.0, "%s", ex.what());
+					return false;
+				}
+				extrinsic.body_to_sensor = IsometryFromTransform(tf);
+				extrinsic.resolved.store(true, std::memory_order_release);
+			}
+		}
+		return true;
+	}
 
-	    geometry_msgs::PoseStamped pose_global_goal_world_frame = PoseFromVector3(carrot_world_frame, "world");
-	    geometry_msgs::PoseStamped pose_global_goal_ortho_body_frame = PoseFromVector3(Vector3(0,0,0), "ortho_body");
-	   
-	    tf2::doTransform(pose_global_goal_world_frame, pose_global_goal_ortho_body_frame, tf);
-	    carrot_ortho_body_frame = VectorFromPose(pose_global_goal_ortho_body_frame);
+	bool OrthoBodyToSensor(SensorExtrinsic &extrinsic, double roll, double pitch, Eigen::Isometry3d &ortho_body_to_sensor) {
+		if (!ResolveExtrinsic(extrinsic)) {
+			return false;
+		}
+		Eigen::Isometry3d ortho_body_to_body = Eigen::Isometry3d::Identity();
+		ortho_body_to_body.rotate(OrthoBodyRotationInBody(roll, pitch));
+		ortho_body_to_sensor = extrinsic.body_to_sensor * ortho_body_to_body;
+		return true;
 	}
 
 	void UpdateAttitudeGeneratorRollPitch(double roll, double pitch) {
 		attitude_generator.UpdateRollPitch(roll, pitch);
 	}
 
-	void UpdateLaserRDFFramesFromPose() {
-		transformAccelerationsIntoLaserRDFFrames();
-		MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
-		Vector3 initial_acceleration = motion_library_ptr->getInitialAcceleration();
-    	if (motion_library_ptr != nullptr) {
-			motion_library_ptr->setInitialAccelerationLASER(transformOrthoBodyIntoLaserFrame(initial_acceleration));
-			motion_library_ptr->setInitialAccelerationRDF(transformOrthoBodyIntoRDFFrame(initial_acceleration));
-		}
-	}
-
-
+	// The ortho_body frame is still broadcast for visualization and other nodes; the stages compute it
+	// from the vehicle state instead of looking it up
 	void OnPose( geometry_msgs::PoseStamped const& pose ) {
 		//ROS_INFO("GOT POSE");
-		attitude_generator.setZ(pose.pose.position.z);
-		
 		tf::Quaternion q(pose.pose.orientation.x, pose.pose.orientation.y, pose.pose.orientation.z, pose.pose.orientation.w);
 		double roll, pitch, yaw;
 		tf::Matrix3x3(q).getRPY(roll, pitch, yaw);
-
-		mutex.lock();
-		UpdateMotionLibraryRollPitch(roll, pitch);
-		UpdateAttitudeGeneratorRollPitch(roll, pitch);
 		PublishOrthoBodyTransform(roll, pitch);
-		UpdateCarrotOrthoBodyFrame();
-		UpdateLaserRDFFramesFromPose();
-		mutex.unlock();
-
-		ComputeBestAccelerationMotion();
-
-		mutex.lock();
-		SetPose(pose.pose.position.x, pose.pose.position.y, pose.pose.position.z, yaw);
-		mutex.unlock();
-	}
-
-	void SetPose(double x, double y, double z, double yaw) {
-		pose_global_x = x;
-		pose_global_y = y;
-		pose_global_z = z;
-		pose_global_yaw = yaw;
-	}
-
-	void transformAccelerationsIntoLaserRDFFrames() {
-		MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
-		if (motion_library_ptr != nullptr) {
-
-			std::vector<Motion>::iterator motion_iterator_begin = motion_library_ptr->GetMotionNonConstIteratorBegin();
-	  		std::vector<Motion>::iterator motion_iterator_end = motion_library_ptr->GetMotionNonConstIteratorEnd();
-
-	  		Vector3 acceleration_ortho_body;
-			Vector3 acceleration_laser_frame;
-			Vector3 acceleration_rdf_frame;
-
-
-	  		for (auto motion = motion_iterator_begin; motion != motion_iterator_end; motion++) {
-	  			acceleration_ortho_body = motion->getAcceleration();
-
-	  			acceleration_laser_frame = transformOrthoBodyIntoLaserFrame(acceleration_ortho_body);
-	  			motion->setAccelerationLASER(acceleration_laser_frame);
-
-	  			acceleration_rdf_frame = transformOrthoBodyIntoRDFFrame(acceleration_ortho_body);
-	  			motion->setAccelerationRDF(acceleration_rdf_frame);
-	  		} 
-	  	}
-	}
-
-	Vector3 transformOrthoBodyIntoLaserFrame(Vector3 const& ortho_body_vector) {
-		geometry_msgs::TransformStamped tf;
-    	try {
-     		tf = tf_buffer_.lookupTransform("laser", "ortho_body", 
-                                    ros::Time(0), ros::Duration(1/30.0));
-   		} catch (tf2::TransformException &ex) {
-     	 	ROS_ERROR("%s", ex.what());
-      	return Vector3(0,0,0);
-    	}
-    	geometry_msgs::PoseStamped pose_ortho_body_vector = PoseFromVector3(ortho_body_vector, "ortho_body");
-    	geometry_msgs::PoseStamped pose_vector_laser_frame = PoseFromVector3(Vector3(0,0,0), "laser");
-    	tf2::doTransform(pose_ortho_body_vector, pose_vector_laser_frame, tf);
-    	return VectorFromPose(pose_vector_laser_frame);
-	}
-
-	Vector3 transformOrthoBodyIntoRDFFrame(Vector3 const& ortho_body_vector) {
-		geometry_msgs::TransformStamped tf;
-    	try {
-     		tf = tf_buffer_.lookupTransform("r200_depth_optical_frame", "ortho_body", 
-                                    ros::Time(0), ros::Duration(1/30.0));
-   		} catch (tf2::TransformException &ex) {
-     	 	ROS_ERROR("%s", ex.what());
-      	return Vector3(0,0,0);
-    	}
-    	geometry_msgs::PoseStamped pose_ortho_body_vector = PoseFromVector3(ortho_body_vector, "ortho_body");
-    	geometry_msgs::PoseStamped pose_vector_rdf_frame = PoseFromVector3(Vector3(0,0,0), "r200_depth_optical_frame");
-    	tf2::doTransform(pose_ortho_body_vector, pose_vector_rdf_frame, tf);
-    	return VectorFromPose(pose_vector_rdf_frame);
-	}
-
-	Matrix3 GetOrthoBodyToRDFRotationMatrix() {
-		geometry_msgs::TransformStamped tf;
-    	try {
-     		tf = tf_buffer_.lookupTransform("r200_depth_optical_frame", "ortho_body", 
-                                    ros::Time(0), ros::Duration(1/30.0));
-   		} catch (tf2::TransformException &ex) {
-     	 	ROS_ERROR("%s", ex.what());
-      	return Matrix3();
-    	}
-    	Eigen::Quaternion<Scalar> quat(tf.transform.rotation.w, tf.transform.rotation.x, tf.transform.rotation.y, tf.transform.rotation.z);
-	    Matrix3 R = quat.toRotationMatrix();
-	    return R;
-	}
-
-	Vector3 TransformWorldToOrthoBody(Vector3 const& world_frame) {
-		geometry_msgs::TransformStamped tf;
-	    try {
-	      tf = tf_buffer_.lookupTransform("ortho_body", "world", 
-	                                    ros::Time(0), ros::Duration(1/30.0));
-	    } catch (tf2::TransformException &ex) {
-	      ROS_ERROR("%s", ex.what());
-	      return Vector3::Zero();
-	    }
-
-	    Eigen::Quaternion<Scalar> quat(tf.transform.rotation.w, tf.transform.rotation.x, tf.transform.rotation.y, tf.transform.rotation.z);
-	    Matrix3 R = quat.toRotationMatrix();
-	    return R*world_frame;
-	}
-
-	void UpdateMotionLibraryVelocity(Vector3 const& velocity_ortho_body_frame) {
-		MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
-		if (motion_library_ptr != nullptr) {
-			motion_library_ptr->setInitialVelocity(velocity_ortho_body_frame);
-			motion_library_ptr->setInitialVelocityLASER(transformOrthoBodyIntoLaserFrame(velocity_ortho_body_frame));
-			motion_library_ptr->setInitialVelocityRDF(transformOrthoBodyIntoRDFFrame(velocity_ortho_body_frame));
+
+		vehicle_state.Update([&](VehicleState &state) {
+			state.x = pose.pose.position.x;
+			state.y = pose.pose.position.y;
+			state.z = pose.pose.position.z;
+			state.roll = roll;
+			state.pitch = pitch;
+			state.yaw = yaw;
+			state.num_pose_updates++;
+		});
+		planning_stage.Wake();
+	}
+
+	// Sensor frames whose extrinsic is not known yet keep their previous transform
+	void ApplyPose(VehicleState const& pose) {
+		if (!laser_extrinsic_applied && ResolveExtrinsic(laser_extrinsic)) {
+			motion_planner.SetLaserExtrinsic(laser_extrinsic.body_to_sensor);
+			laser_extrinsic_applied = true;
 		}
+		if (!rdf_extrinsic_applied && ResolveExtrinsic(rdf_extrinsic)) {
+			motion_planner.SetDepthCameraExtrinsic(rdf_extrinsic.body_to_sensor);
+			rdf_extrinsic_applied = true;
+		}
+		motion_planner.ApplyPose(Vector3(pose.x, pose.y, pose.z), pose.roll, pose.pitch, pose.yaw);
 	}
 
 	void OnVelocity( geometry_msgs::TwistStamped const& twist) {
 		//ROS_INFO("GOT VELOCITY");
-		attitude_generator.setZvelocity(twist.twist.linear.z);
-		Vector3 velocity_world_frame(twist.twist.linear.x, twist.twist.linear.y, twist.twist.linear.z);
-		Vector3 velocity_ortho_body_frame = TransformWorldToOrthoBody(velocity_world_frame);
-		velocity_ortho_body_frame(2) = 0.0;  // WARNING for 2D only
-		
-		mutex.lock();
-		UpdateMotionLibraryVelocity(velocity_ortho_body_frame);
-		double speed = velocity_ortho_body_frame.norm();
-		//UpdateTimeHorizon(speed);
-		UpdateMaxAcceleration(speed);
-		mutex.unlock();
-	}
-
-	void UpdateMaxAcceleration(double speed) {
-		MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
-			if (motion_library_ptr != nullptr) {
-				motion_library_ptr->UpdateMaxAcceleration(speed);
-			}
+		vehicle_state.Update([&](VehicleState &state) {
+			state.velocity_world_frame[0] = twist.twist.linear.x;
+			state.velocity_world_frame[1] = twist.twist.linear.y;
+			state.velocity_world_frame[2] = twist.twist.linear.z;
+			state.num_velocity_updates++;
+		});
+		planning_stage.Wake();
 	}
 
 	void UpdateTimeHorizon(double speed) { 
@@ -527,22 +638,6 @@ private:
 		motion_selector.UpdateTimeHorizon(final_time);
 	}
 	
-	Vector3 TransformOrthoBodyToWorld(Vector3 const& ortho_body_frame) {
-		geometry_msgs::TransformStamped tf;
-	    try {
-	      tf = tf_buffer_.lookupTransform("world", "ortho_body",
-	                                    ros::Time(0), ros::Duration(1/30.0));
-	    } catch (tf2::TransformException &ex) {
-	      ROS_ERROR("%s", ex.what());
-	      return Vector3::Zero();
-	    }
-
-	    geometry_msgs::PoseStamped pose_ortho_body_vector = PoseFromVector3(ortho_body_frame, "ortho_body");
-    	geometry_msgs::PoseStamped pose_vector_world_frame = PoseFromVector3(Vector3(0,0,0), "world");
-    	tf2::doTransform(pose_ortho_body_vector, pose_vector_world_frame, tf);
-    	return VectorFromPose(pose_vector_world_frame);
-	}
-
 	void ProjectOrthoBodyLaserPointCloud(pcl::PointCloud<pcl::PointXYZ>::Ptr &cloud_ptr) {
 		pcl::PointCloud<pcl::PointXYZ>::iterator point_cloud_iterator_begin = cloud_ptr->begin();
 		pcl::PointCloud<pcl::PointXYZ>::iterator point_cloud_iterator_end = cloud_ptr->end();
@@ -557,60 +652,92 @@ private:
 
 	void OnScan(sensor_msgs::PointCloud2ConstPtr const& laser_point_cloud_msg) {
 		//ROS_INFO("GOT SCAN");
-		DepthImageCollisionEvaluator* depth_image_collision_ptr = motion_selector.GetDepthImageCollisionEvaluatorPtr();
-
-		if (depth_image_collision_ptr != nullptr) {
+		Forward(laser_cloud_queue, laser_point_cloud_msg, "laser scan");
+		ingest_stage.Wake();
+	}
 
-			//sensor_msgs::PointCloud2ConstPtr laser_point_cloud_msg_ptr(laser_point_cloud_msg);
-			pcl::PointCloud<pcl::PointXYZ>::Ptr ortho_body_cloud(new pcl::PointCloud<pcl::PointXYZ>);
-		    TransformToOrthoBodyPointCloud("laser", laser_point_cloud_msg, ortho_body_cloud);
+	// Scan points accumulate as obstacles in the world frame, then only the cells they or a new
+	// carrot affect are repaired and written into the value grid
+	void UpdateOnboardValueGrid(pcl::PointCloud<pcl::PointXYZ>::Ptr const& ortho_body_cloud, VehicleState const& state) {
+		if (state.num_pose_updates == 0) {
+			return;
+		}
+		// The grid has no height, so only points in the band the vehicle flies through become
+		// obstacles; ground returns the projection left below z=0 would otherwise block cells for good
+		Eigen::Isometry3d ortho_body_to_world = OrthoBodyToWorld(Vector3(state.x, state.y, state.z), state.roll, state.pitch, state.yaw);
+		Eigen::Matrix<Scalar, 3, Eigen::Dynamic> points_world_frame(3, ortho_body_cloud->size());
+		size_t num_points = 0;
+		for (size_t i = 0; i < ortho_body_cloud->size(); i++) {
+			pcl::PointXYZ const& point = ortho_body_cloud->points[i];
+			if (point.z >= onboard_value_grid_obstacle_min_z && point.z <= onboard_value_grid_obstacle_max_z) {
+				points_world_frame.col(num_points++) = ortho_body_to_world * Vector3(point.x, point.y, point.z);
+			}
+		}
+		points_world_frame.conservativeResize(3, num_points);
+		cost_to_go_grid.AddObstaclePoints(points_world_frame);
+		if (state.num_carrot_updates > 0) {
+			cost_to_go_grid.SetGoal(Vector3(state.carrot_world_frame[0], state.carrot_world_frame[1], state.carrot_world_frame[2]));
+		}
 
-		    if (!use_3d_library) {
-		    	ProjectOrthoBodyLaserPointCloud(ortho_body_cloud);
-		    }
+		cost_to_go_grid.ComputeCostToGo(onboard_value_grid_max_cells_per_update);
+		cost_to_go_grid.PublishValues(*motion_selector.GetValueGridEvaluatorPtr());
 
-			depth_image_collision_ptr->UpdateLaserPointCloudPtr(ortho_body_cloud);
+		// Layers take every scan point, each keeping those in its own band
+		if (use_onboard_value_volume) {
+			Eigen::Matrix<Scalar, 3, Eigen::Dynamic> all_points_world_frame(3, ortho_body_cloud->size());
+			for (size_t i = 0; i < ortho_body_cloud->size(); i++) {
+				pcl::PointXYZ const& point = ortho_body_cloud->points[i];
+				all_points_world_frame.col(i) = ortho_body_to_world * Vector3(point.x, point.y, point.z);
+			}
+			cost_to_go_volume.AddObstaclePoints(all_points_world_frame);
+			if (state.num_carrot_updates > 0) {
+				cost_to_go_volume.SetGoal(Vector3(state.carrot_world_frame[0], state.carrot_world_frame[1], state.carrot_world_frame[2]));
+			}
+			cost_to_go_volume.ComputeCostToGo(onboard_value_grid_max_cells_per_update);
+			cost_to_go_volume.PublishValues(*motion_selector.GetValueGridEvaluatorPtr());
 		}
 	}
 
-	void UpdateValueGrid(nav_msgs::OccupancyGrid value_grid_msg) {
+	// The grid is copied once, into the evaluator's back buffer; planning keeps reading the previous grid meanwhile
+	void OnValueGrid(nav_msgs::OccupancyGrid::ConstPtr const& value_grid_msg) {
 		auto t1 = std::chrono::high_resolution_clock::now();
 
 		ValueGridEvaluator* value_grid_evaluator_ptr = motion_selector.GetValueGridEvaluatorPtr();
 		if (value_grid_evaluator_ptr != nullptr) {
-			ValueGrid* value_grid_ptr = value_grid_evaluator_ptr->GetValueGridPtr();
-			if (value_grid_ptr != nullptr) {
-
-				value_grid_ptr->SetResolution(value_grid_msg.info.resolution);
-				value_grid_ptr->SetSize(value_grid_msg.info.width, value_grid_msg.info.height);
-				value_grid_ptr->SetOrigin(value_grid_msg.info.origin.position.x, value_grid_msg.info.origin.position.y);
-				value_grid_ptr->SetValues(value_grid_msg.data);
-
-				//motion_selector.PassInUpdatedValueGrid(&value_grid);
-				auto t2 = std::chrono::high_resolution_clock::now();
-				std::cout << "Whole value grid construction took "
-		      		<< std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count()
-		      		<< " microseconds\n";
-
-				std::cout << value_grid_ptr->GetValueOfPosition(carrot_world_frame) << " is value of goal" << std::endl;
-				std::cout << value_grid_ptr->GetValueOfPosition(Vector3(0,0,0)) << " is value of world origin" << std::endl;
-				std::cout << value_grid_ptr->GetValueOfPosition(Vector3(0,-2.0,0)) << " is value of 1.5 to my right" << std::endl;
-			}
+			value_grid_evaluator_ptr->SetValueGrid(value_grid_msg->info.resolution, value_grid_msg->info.width, value_grid_msg->info.height,
+			                                       value_grid_msg->info.origin.position.x, value_grid_msg->info.origin.position.y, value_grid_msg->data);
+
+			auto t2 = std::chrono::high_resolution_clock::now();
+			ROS_DEBUG("Whole value grid construction took %ld microseconds", (long)std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count());
 		}
 	}
 
-	void OnValueGrid(nav_msgs::OccupancyGrid value_grid_msg) {
-		ROS_INFO("GOT VALUE GRID");
-		UpdateValueGrid(value_grid_msg);
+	// Only the changed block is written, into the back buffer, before it is swapped in
+	void OnValueGridUpdate(map_msgs::OccupancyGridUpdate::ConstPtr const& value_grid_update_msg) {
+		ValueGridEvaluator* value_grid_evaluator_ptr = motion_selector.GetValueGridEvaluatorPtr();
+		if (value_grid_evaluator_ptr != nullptr) {
+			if (!value_grid_evaluator_ptr->UpdateValueGridRegion(value_grid_update_msg->x, value_grid_update_msg->y, value_grid_update_msg->width,
+			                                                     value_grid_update_msg->height, value_grid_update_msg->data)) {
+				ROS_WARN_THROTTLE(1.0, "Dropped value grid update outside the current value grid");
+			}
+		}
 	}
 
 
 	void OnLocalGoal(geometry_msgs::PoseStamped const& local_goal) {
 		//ROS_INFO("GOT LOCAL GOAL");
-		mutex.lock();
-		carrot_world_frame << local_goal.pose.position.x, local_goal.pose.position.y, flight_altitude; 
-		UpdateCarrotOrthoBodyFrame();
-		mutex.unlock();
+		vehicle_state.Update([&](VehicleState &state) {
+			state.carrot_world_frame[0] = local_goal.pose.position.x;
+			state.carrot_world_frame[1] = local_goal.pose.position.y;
+			state.carrot_world_frame[2] = flight_altitude;
+			state.num_carrot_updates++;
+		});
+		planning_stage.Wake();
+	}
+
+	void ApplyLocalGoal(Vector3 const& goal_world_frame) {
+		motion_planner.ApplyLocalGoal(goal_world_frame);
+		Vector3 const& carrot_ortho_body_frame = motion_planner.getCarrotOrthoBodyFrame();
 
 		visualization_msgs::Marker marker;
 		marker.header.frame_id = "ortho_body";
@@ -619,11 +746,9 @@ private:
 		marker.id = 1;
 		marker.type = visualization_msgs::Marker::SPHERE;
 		marker.action = visualization_msgs::Marker::ADD;
-		mutex.lock();
 		marker.pose.position.x = carrot_ortho_body_frame(0);
 		marker.pose.position.y = carrot_ortho_body_frame(1);
 		marker.pose.position.z = carrot_ortho_body_frame(2);
-		mutex.unlock();
 		marker.scale.x = 0.5;
 		marker.scale.y = 0.5;
 		marker.scale.z = 0.5;
@@ -634,27 +759,11 @@ private:
 		carrot_pub.publish( marker );
 	}
 
-	void TransformToOrthoBodyPointCloud(std::string const& source_frame, const sensor_msgs::PointCloud2ConstPtr msg, pcl::PointCloud<pcl::PointXYZ>::Ptr &cloud_out){
+	void TransformToOrthoBodyPointCloud(Eigen::Isometry3d const& sensor_to_ortho_body, const sensor_msgs::PointCloud2ConstPtr msg, pcl::PointCloud<pcl::PointXYZ>::Ptr &cloud_out){
+		TraceSpan span("TransformToOrthoBodyPointCloud");
 	  	sensor_msgs::PointCloud2 msg_out;
 
-	  	geometry_msgs::TransformStamped tf;
-    	try {
-	     	tf = tf_buffer_.lookupTransform("ortho_body", source_frame,
-	                                    ros::Time(0), ros::Duration(1/30.0));
-	   		} catch (tf2::TransformException &ex) {
-	     	 	ROS_ERROR("%s", ex.what());
-      	return;
-    	}
-
-	  	Eigen::Quaternionf quat(tf.transform.rotation.w, tf.transform.rotation.x, tf.transform.rotation.y, tf.transform.rotation.z);
-	    Eigen::Matrix3f R = quat.toRotationMatrix();
-
-	    Eigen::Vector4f T = Eigen::Vector4f(tf.transform.translation.x,tf.transform.translation.y,tf.transform.translation.z, 1.0); 
-
-     	Eigen::Matrix4f transform_eigen; // Your Transformation Matrix
-		transform_eigen.setIdentity();   // Set to Identity to make bottom row of Matrix 0,0,0,1
-		transform_eigen.block<3,3>(0,0) = R;
-		transform_eigen.col(3) = T;
+     	Eigen::Matrix4f transform_eigen = sensor_to_ortho_body.matrix().cast<float>();
 
 	  	pcl_ros::transformPointCloud(transform_eigen, *msg, msg_out);
 
@@ -667,27 +776,16 @@ private:
 	}
 
 	void OnDepthImage(const sensor_msgs::PointCloud2ConstPtr& point_cloud_msg) {
+		TraceSpan span("OnDepthImage");
 		// ROS_INFO("GOT POINT CLOUD");
 		if (UseDepthImage()) {
-			DepthImageCollisionEvaluator* depth_image_collision_ptr = motion_selector.GetDepthImageCollisionEvaluatorPtr();
-
-			if (depth_image_collision_ptr != nullptr) {
-
-		    	pcl::PointCloud<pcl::PointXYZ>::Ptr ortho_body_cloud(new pcl::PointCloud<pcl::PointXYZ>);
-		    	TransformToOrthoBodyPointCloud("r200_depth_optical_frame", point_cloud_msg, ortho_body_cloud);
-
-		    	Matrix3 R = GetOrthoBodyToRDFRotationMatrix();
-
-		    	mutex.lock();
-				depth_image_collision_ptr->UpdateRotationMatrix(R);
-				depth_image_collision_ptr->UpdatePointCloudPtr(ortho_body_cloud);
-				mutex.unlock();
-			}
-			ReactToSampledPointCloud();
+			Forward(depth_cloud_queue, point_cloud_msg, "depth image");
+			ingest_stage.Wake();
 		}
 	}
 
 	void PublishAttitudeSetpoint(Vector3 const& roll_pitch_thrust) { 
+		TraceSpan span("PublishAttitudeSetpoint");
 
 		using namespace Eigen;
 
@@ -697,12 +795,10 @@ private:
 			| mavros_msgs::AttitudeTarget::IGNORE_PITCH_RATE
 			| mavros_msgs::AttitudeTarget::IGNORE_YAW_RATE
 			;
-		
-		mutex.lock();
 
 		// // Limit size of bearing errors
 		double bearing_error_cap = 30;
-		double actual_bearing_azimuth_degrees = -pose_global_yaw * 180.0/M_PI;
+		double actual_bearing_azimuth_degrees = -control_yaw * 180.0/M_PI;
 		double actual_bearing_error = bearing_azimuth_degrees - actual_bearing_azimuth_degrees;
 		while(actual_bearing_error > 180) { 
 			actual_bearing_error -= 360;
@@ -748,8 +844,6 @@ private:
 		* AngleAxisf(roll_pitch_thrust(1), Vector3f::UnitY())
 		* AngleAxisf(-roll_pitch_thrust(0), Vector3f::UnitX());
 
-		mutex.unlock();
-
 		Quaternionf q(m);
 
 		setpoint_msg.orientation.w = q.w();
@@ -763,64 +857,118 @@ private:
 	}
 
 
+	// Declared before the subscribers, which unregister from their queue when destroyed
+	ros::CallbackQueue sensor_callback_queue;
+	ros::CallbackQueue state_callback_queue;
+	ros::NodeHandle sensor_nh;
+	ros::NodeHandle state_nh;
+	std::unique_ptr<ros::AsyncSpinner> sensor_spinner;
+	std::unique_ptr<ros::AsyncSpinner> state_spinner;
+
 	ros::Subscriber pose_sub;
 	ros::Subscriber velocity_sub;
 	ros::Subscriber depth_image_sub;
 	ros::Subscriber global_goal_sub;
 	ros::Subscriber local_goal_sub;
 	ros::Subscriber value_grid_sub;
+	ros::Subscriber value_grid_update_sub;
 	ros::Subscriber laser_scan_sub;
+	ros::ServiceServer dump_trace_service;
 
 	ros::Publisher carrot_pub;
 	ros::Publisher gaussian_pub;
 	ros::Publisher attitude_thrust_pub;
 	ros::Publisher attitude_setpoint_visualization_pub;
+	ros::Publisher diagnostics_pub;
 
 	std::vector<ros::Publisher> action_paths_pubs;
 	tf::TransformListener listener;
 	std::shared_ptr<tf2_ros::TransformListener> tf_listener_;
 
 	tf2_ros::Buffer tf_buffer_;
+	std::mutex extrinsics_mutex;
+	SensorExtrinsic laser_extrinsic{"laser"};
+	SensorExtrinsic rdf_extrinsic{"r200_depth_optical_frame"};
+	// Whether the planning stage has handed each extrinsic to the planner
+	bool laser_extrinsic_applied = false;
+	bool rdf_extrinsic_applied = false;
 
 	double start_time = 0.0;
 	double final_time = 1.5;
 
+	// Owned by the control stage
 	double bearing_azimuth_degrees = 0.0;
 	double set_bearing_azimuth_degrees = 0.0;
+	double control_yaw = 0.0;
+	Vector3 commanded_acceleration = Vector3::Zero();
+	double last_commanded_sensor_stamp = 0.0;
 
 	Eigen::Vector4d pose_x_y_z_yaw;
 
 	Eigen::Matrix<Scalar, Eigen::Dynamic, 1> sampling_time_vector;
 	size_t num_samples;
 
-	std::mutex mutex;
-
-	Vector3 carrot_world_frame;
-	Vector3 carrot_ortho_body_frame;
+	// Taken by the planning stage while it uses the collision evaluator and by the map stage while it
+	// updates the evaluator's index; never by control
+	std::mutex selector_mutex;
 
-	size_t best_traj_index = 0;
-	Vector3 desired_acceleration;
+	// Last thrust from the control stage, which the planning stage gives the motion library
+	std::atomic<double> library_thrust{0.0};
 
 	MotionSelector motion_selector;
+	// Owned by the planning stage, apart from the cloud updates the map stage makes through it
+	MotionPlanner motion_planner{motion_selector, selector_mutex};
+	FlightLogWriter flight_log;
 	AttitudeGenerator attitude_generator;
 
-	double pose_global_x = 0;
-	double pose_global_y = 0;
-	double pose_global_z = 0;
-	double pose_global_yaw = 0;
-
-	bool yaw_on = false;
-	double soft_top_speed_max = 0.0;
 	bool use_depth_image = true;
 	bool use_3d_library = false;
 	double flight_altitude;
 
-	bool executing_e_stop = false;
-	double begin_e_stop_time = 0.0;
-	double e_stop_time_needed = 0.0;
-	double max_e_stop_pitch_degrees = 60.0;
-
 	double laser_z_below_project_up = -0.5;
+	double planning_deadline = 0.0;
+
+	bool use_value_grid = false;
+	bool use_onboard_value_grid = false;
+	CostToGoGrid cost_to_go_grid;
+	size_t onboard_value_grid_max_cells_per_update = 0;
+	double onboard_value_grid_obstacle_min_z = -0.3;
+	double onboard_value_grid_obstacle_max_z = 0.3;
+	bool use_onboard_value_volume = false;
+	CostToGoVolume cost_to_go_volume;
+
+	SpscQueue<sensor_msgs::PointCloud2ConstPtr> depth_cloud_queue;
+	SpscQueue<sensor_msgs::PointCloud2ConstPtr> laser_cloud_queue;
+	SpscQueue<SensorFrame> sensor_frame_queue;
+	SpscQueue<MapUpdate> map_update_queue;
+	SpscQueue<ControlCommand> control_command_queue;
+
+	// Written by the pose, velocity and local goal callbacks
+	SeqLock<VehicleState> vehicle_state;
+	// The snapshot the planning stage last applied
+	VehicleState planning_state = VehicleState();
+	// Newest sensor stamp in the maps the planning stage has seen
+	double planning_sensor_stamp = 0.0;
+
+	// In microseconds; recorded by the stages, published and reset by the diagnostics stage
+	LatencyHistogram sensor_to_command_latency;
+	LatencyHistogram ingest_duration;
+	LatencyHistogram map_duration;
+	LatencyHistogram planning_duration;
+	LatencyHistogram control_duration;
+
+	std::string trace_file;
+	std::atomic<bool> trace_dump_requested{false};
+
+	std::chrono::steady_clock::duration planning_period = std::chrono::milliseconds(40);
+	std::chrono::steady_clock::time_point last_planning_time;
+	std::chrono::steady_clock::time_point last_drawing_time;
+
+	StageThread ingest_stage;
+	StageThread map_stage;
+	StageThread planning_stage;
+	StageThread control_stage;
+	StageThread diagnostics_stage;
 
 	ros::NodeHandle nh;
 
@@ -838,32 +986,7 @@ int main(int argc, char* argv[]) {
 	MotionSelectorNode motion_selector_node;
 
 	std::cout << "Got through to here" << std::endl;
-	ros::Rate spin_rate(100);
-
-	auto t1 = std::chrono::high_resolution_clock::now();
-	auto t2 = std::chrono::high_resolution_clock::now();
-
-	size_t counter = 0;
-
-	while (ros::ok()) {
-		//t1 = std::chrono::high_resolution_clock::now();
-		//motion_selector_node.ReactToSampledPointCloud();
-		//t2 = std::chrono::high_resolution_clock::now();
-		// std::cout << "ReactToSampledPointCloud took "
-  //     		<< std::chrono::duration_cast<std::chrono::microseconds>(t2-t1).count()
-  //     		<< " microseconds\n";
-		motion_selector_node.PublishCurrentAttitudeSetpoint();
-
-		counter++;
-		if (counter > 3) {
-			counter = 0;
-			motion_selector_node.drawAll();
-			if (!motion_selector_node.UseDepthImage()) {
-				motion_selector_node.ReactToSampledPointCloud();
-			}
-		}
-      	
-		ros::spinOnce();
-		spin_rate.sleep();
-	}
+
+	// Callbacks run on the node's spinners and hand messages to the stages, which run on their own threads
+	ros::waitForShutdown();
 }
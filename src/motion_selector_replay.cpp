@@ -0,0 +1,147 @@
+// Replays a flight log written by the node's flight_log_file parameter through the planning core,
+// as fast as it runs, and writes what every plan selected.
+//
+//   motion_selector_replay flight.mplog [plans.txt]
+//
+// Each output line is the plan's time, best_traj_index and desired acceleration, with every digit a
+// double needs, so two replays can be diffed to check a change leaves the selection bit-identical.
+// Mismatches with what the vehicle selected are counted too.  Where the planning deadline cut a
+// plan short in flight, replay evaluates the same number of motions the log recorded, and it draws
+// as many refinement samples as the refinement budget allowed, so those plans match as well.
+// Dijkstra logs are not replayed, as their value grids are not in the log.
+
+#include "flight_log.h"
+#include "motion_planner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+int main(int argc, char* argv[]) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "usage: motion_selector_replay flight.mplog [plans.txt]" << std::endl;
+    return 1;
+  }
+  FlightLogReader reader;
+  if (!reader.Open(argv[1])) {
+    std::cerr << reader.GetError() << std::endl;
+    return 1;
+  }
+  FILE* output = stdout;
+  if (argc == 3) {
+    output = fopen(argv[2], "w");
+    if (output == nullptr) {
+      std::cerr << "cannot open " << argv[2] << std::endl;
+      return 1;
+    }
+  }
+
+  MotionSelector motion_selector;
+  std::mutex selector_mutex;
+  MotionPlanner motion_planner(motion_selector, selector_mutex);
+  bool configured = false;
+
+  FlightLogRecord record;
+  size_t num_records = 0;
+  size_t num_plans = 0;
+  size_t num_mismatches = 0;
+  size_t num_plans_cut_short = 0;
+  double max_planning_budget = 0.0;
+  double first_plan_time = 0.0;
+  double last_plan_time = 0.0;
+  MotionPlanner::Plan plan;
+  std::chrono::steady_clock::time_point replay_start_time = std::chrono::steady_clock::now();
+  while (reader.ReadRecord(record)) {
+    num_records++;
+    if (record.type == FLIGHT_LOG_CONFIG) {
+      if (configured) {
+        std::cerr << "the log has a second configuration, stopping there" << std::endl;
+        break;
+      }
+      MotionPlannerConfig config = record.config;
+      if (config.use_dijkstra) {
+        std::cerr << "the log was taken with a value grid, which replay does not support" << std::endl;
+        return 1;
+      }
+      std::string error;
+      if (!motion_planner.Configure(config, error)) {
+        std::cerr << "could not load the motion library, replay would not match: " << error << std::endl;
+        return 1;
+      }
+      configured = true;
+      continue;
+    }
+    if (!configured) {
+      std::cerr << "the log does not start with a configuration" << std::endl;
+      return 1;
+    }
+
+    switch (record.type) {
+    case FLIGHT_LOG_LASER_EXTRINSIC:
+      motion_planner.SetLaserExtrinsic(record.transform);
+      break;
+    case FLIGHT_LOG_DEPTH_CAMERA_EXTRINSIC:
+      motion_planner.SetDepthCameraExtrinsic(record.transform);
+      break;
+    case FLIGHT_LOG_POSE:
+      motion_planner.ApplyPose(record.vector, record.roll, record.pitch, record.yaw);
+      break;
+    case FLIGHT_LOG_VELOCITY:
+      motion_planner.ApplyVelocity(record.vector);
+      break;
+    case FLIGHT_LOG_LOCAL_GOAL:
+      motion_planner.ApplyLocalGoal(record.vector);
+      break;
+    case FLIGHT_LOG_DEPTH_IMAGE:
+      motion_planner.UpdateDepthImage(record.cloud, record.ortho_body_to_rdf);
+      break;
+    case FLIGHT_LOG_LASER_SCAN:
+      motion_planner.UpdateLaserScan(record.cloud);
+      break;
+    case FLIGHT_LOG_PLAN:
+      plan = motion_planner.ComputePlan(record.now, std::chrono::steady_clock::time_point::max(), record.library_thrust, record.num_motions_evaluated, record.num_refinement_samples);
+      if (record.num_motions_evaluated < motion_selector.getNumMotions()) {
+        num_plans_cut_short++;
+      }
+      max_planning_budget = std::max(max_planning_budget, record.planning_budget);
+      if (num_plans == 0) {
+        first_plan_time = record.now;
+      }
+      last_plan_time = record.now;
+      num_plans++;
+      fprintf(output, "%.17g %zu %.17g %.17g %.17g\n", record.now, plan.best_traj_index,
+              plan.desired_acceleration(0), plan.desired_acceleration(1), plan.desired_acceleration(2));
+      break;
+    case FLIGHT_LOG_PLAN_RESULT:
+      if (record.best_traj_index != plan.best_traj_index || record.vector != plan.desired_acceleration) {
+        num_mismatches++;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  double replay_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - replay_start_time).count();
+  if (output != stdout) {
+    fclose(output);
+  }
+
+  if (!reader.GetError().empty()) {
+    std::cerr << "stopped at a damaged record: " << reader.GetError() << std::endl;
+  }
+  double flight_time = last_plan_time - first_plan_time;
+  std::cerr << "Replayed " << num_records << " records and " << num_plans << " plans in " << replay_time << " s";
+  if (replay_time > 0.0 && flight_time > 0.0) {
+    std::cerr << ", " << flight_time / replay_time << "x the " << flight_time << " s flown";
+  }
+  std::cerr << std::endl;
+  if (max_planning_budget > 0.0) {
+    std::cerr << "The log was taken with a planning deadline of up to " << max_planning_budget << " s; " << num_plans_cut_short
+              << " plans it cut short were replayed with the motions they evaluated in flight" << std::endl;
+  }
+  std::cerr << num_mismatches << " plans differ from what was selected in flight" << std::endl;
+  return reader.GetError().empty() ? 0 : 1;
+}
@@ -16,4 +16,27 @@ Eigen::Vector3d VectorFromPose(geometry_msgs::PoseStamped const& pose) {
 
 Eigen::Vector3d VectorFromPoseUnstamped(geometry_msgs::Pose const& pose) {
 	return Vector3(pose.position.x, pose.position.y, pose.position.z);
-}
\ No newline at end of file
+}
+
+// Same mapping tf2::doTransform applies to a pose, for transforming many points without messages
+Eigen::Isometry3d IsometryFromTransform(geometry_msgs::TransformStamped const& tf) {
+	Eigen::Isometry3d isometry = Eigen::Isometry3d::Identity();
+	isometry.translate(Eigen::Vector3d(tf.transform.translation.x, tf.transform.translation.y, tf.transform.translation.z));
+	isometry.rotate(Eigen::Quaterniond(tf.transform.rotation.w, tf.transform.rotation.x, tf.transform.rotation.y, tf.transform.rotation.z));
+	return isometry;
+}
+geometry_msgs::TransformStamped TransformFromIsometry(Eigen::Isometry3d const& isometry, std::string const& frame, std::string const& child_frame) {
+	geometry_msgs::TransformStamped tf;
+	tf.header.frame_id = frame;
+	tf.header.stamp = ros::Time::now();
+	tf.child_frame_id = child_frame;
+	Eigen::Quaterniond rotation(isometry.rotation());
+	tf.transform.translation.x = isometry.translation()(0);
+	tf.transform.translation.y = isometry.translation()(1);
+	tf.transform.translation.z = isometry.translation()(2);
+	tf.transform.rotation.x = rotation.x();
+	tf.transform.rotation.y = rotation.y();
+	tf.transform.rotation.z = rotation.z();
+	tf.transform.rotation.w = rotation.w();
+	return tf;
+}
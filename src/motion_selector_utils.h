@@ -1,11 +1,16 @@
 #ifndef MOTION_SELECTOR_UTILS_H
 #define MOTION_SELECTOR_UTILS_H
 
-#include "motion.h"
+#include "frame_utils.h"
 #include "geometry_msgs/PoseStamped.h"
+#include "geometry_msgs/TransformStamped.h"
+
+#include <Eigen/Geometry>
 
 geometry_msgs::PoseStamped PoseFromVector3(Vector3 const& position, std::string const& frame);
 Eigen::Vector3d VectorFromPose(geometry_msgs::PoseStamped const& pose);
 Eigen::Vector3d VectorFromPoseUnstamped(geometry_msgs::Pose const& pose);
+Eigen::Isometry3d IsometryFromTransform(geometry_msgs::TransformStamped const& tf);
+geometry_msgs::TransformStamped TransformFromIsometry(Eigen::Isometry3d const& isometry, std::string const& frame, std::string const& child_frame);
 
 #endif
\ No newline at end of file
@@ -75,15 +75,14 @@ void MotionVisualizer::drawAll() {
 		nav_msgs::Path action_samples_msg;
 		action_samples_msg.header.frame_id = drawing_frame;
 		action_samples_msg.header.stamp = ros::Time::now();
-		Vector3 sigma;
 		for (size_t sample = 0; sample < num_samples; sample++) {
 			action_samples_msg.poses.push_back(PoseFromVector3(sample_points_xyz_over_time.row(sample), drawing_frame));
-			sigma = motion_library_ptr->getSigmaAtTime(sampling_time_vector(sample));
-			if (motion_index == *best_traj_index) {
-				drawGaussianPropagation(sample, sample_points_xyz_over_time.row(sample), sigma);
-			}
 		}
 		drawCollisionIndicator(motion_index, sample_points_xyz_over_time.row(num_samples-1), collision_probabilities.at(motion_index));
 		action_paths_pubs.at(motion_index).publish(action_samples_msg);
 	}
+	for (size_t sample = 0; sample < num_samples; sample++) {
+		Vector3 sigma = motion_library_ptr->getSigmaAtTime(sampling_time_vector(sample));
+		drawGaussianPropagation(sample, best_motion.getPosition(sampling_time_vector(sample)), sigma);
+	}
 }
\ No newline at end of file
@@ -6,16 +6,16 @@
 #include <visualization_msgs/Marker.h>
 
 #include "motion_selector.h"
+#include "motion_selector_utils.h"
 
 class MotionVisualizer {
 public:
 	
 	MotionVisualizer() {};
 
-	void initialize(MotionSelector* motion_selector, ros::NodeHandle & nh, size_t* best_traj_index, double const& final_time) {
+	void initialize(MotionSelector* motion_selector, ros::NodeHandle & nh, double const& final_time) {
 		this->motion_selector = motion_selector;
 		this->nh = nh;
-		this->best_traj_index = best_traj_index;
 		this->final_time = final_time;
 		for (size_t i = 0; i < motion_selector->getNumMotions(); i++) {
       collision_probabilities.push_back(0.0);
@@ -39,6 +39,10 @@ public:
   void setCollisionProbabilities(std::vector<double> const& collision_probabilities) {
   	this->collision_probabilities = collision_probabilities;
   }
+  // The uncertainty is drawn along the motion flown, which refinement may have moved off the library
+  void setBestMotion(Motion const& best_motion) {
+  	this->best_motion = best_motion;
+  }
 
 private:
 
@@ -55,7 +59,7 @@ private:
   double start_time = 0;
   double final_time = 0;
 
-  size_t* best_traj_index;
+  Motion best_motion;
 
   std::vector<double> collision_probabilities;
 };
@@ -0,0 +1,157 @@
+#ifndef OBJECTIVE_POLICIES_H
+#define OBJECTIVE_POLICIES_H
+
+#include "motion.h"
+
+#include <ratio>
+#include <vector>
+
+// Objectives are small policy structs combined at compile time, e.g.
+//
+//   typedef WeightedObjective< Weighted<GoalProgressTerm>, Weighted<TerminalVelocityTerm, std::ratio<1,2> > > MyObjective;
+//
+// Each configuration becomes one inlined per-motion kernel: no virtual calls, and terms that are not
+// listed are never evaluated.  A new term only needs a struct with the static members below.
+
+// Per-cycle inputs shared by all motions
+struct ObjectiveContext {
+  Vector3 carrot_body_frame;
+  double initial_distance_to_carrot;
+  double soft_top_speed;
+  double nominal_altitude;
+  const double* dijkstra_evaluations;
+};
+
+// Motion state sampled once and shared by the terms that need it
+struct ObjectiveSample {
+  Vector3 position_at_eval_time;
+  Vector3 velocity_at_eval_time;
+  double altitude;
+};
+
+const double objective_eval_time = 0.5;
+const double objective_altitude_eval_time = 0.1;
+
+
+struct GoalProgressTerm {
+  static constexpr bool needs_eval_time_state = true;
+  static constexpr bool needs_altitude = false;
+
+  static double Evaluate(Motion const& motion, ObjectiveSample const& sample, ObjectiveContext const& context, size_t /*motion_index*/) {
+    Vector3 final_motion_position = motion.getTerminalStopPosition(sample.position_at_eval_time, sample.velocity_at_eval_time);
+    return context.initial_distance_to_carrot - (final_motion_position - context.carrot_body_frame).norm();
+  }
+};
+
+struct TerminalVelocityTerm {
+  static constexpr bool needs_eval_time_state = true;
+  static constexpr bool needs_altitude = false;
+
+  static double Evaluate(Motion const& /*motion*/, ObjectiveSample const& sample, ObjectiveContext const& context, size_t /*motion_index*/) {
+    double cost = 0;
+    double final_motion_speed = sample.velocity_at_eval_time.norm();
+    if (final_motion_speed > context.soft_top_speed) {
+      cost -= 2.0*(context.soft_top_speed - final_motion_speed)*(context.soft_top_speed - final_motion_speed);
+    }
+    return cost;
+  }
+};
+
+struct AltitudeTerm {
+  static constexpr bool needs_eval_time_state = false;
+  static constexpr bool needs_altitude = true;
+
+  static double Evaluate(Motion const& /*motion*/, ObjectiveSample const& sample, ObjectiveContext const& context, size_t /*motion_index*/) {
+    const double minimum_altitude = 0.7;
+    const double maximum_altitude = 5.0;
+    double final_altitude = sample.altitude;
+    double cost = 0;
+    cost -= 0.1 * (context.nominal_altitude - final_altitude) * (context.nominal_altitude - final_altitude);
+    if (final_altitude < minimum_altitude) {
+      cost -= 10.0*(final_altitude - minimum_altitude)*(final_altitude - minimum_altitude);
+    }
+    else if (final_altitude > maximum_altitude) {
+      cost -= 10.0*(final_altitude - maximum_altitude)*(final_altitude - maximum_altitude);
+    }
+    return cost;
+  }
+};
+
+// Precomputed per motion by MotionSelector::EvaluateDijkstraCost
+struct DijkstraCostTerm {
+  static constexpr bool needs_eval_time_state = false;
+  static constexpr bool needs_altitude = false;
+
+  static double Evaluate(Motion const& /*motion*/, ObjectiveSample const& /*sample*/, ObjectiveContext const& context, size_t motion_index) {
+    return context.dijkstra_evaluations[motion_index];
+  }
+};
+
+
+template <typename Term, typename Weight = std::ratio<1> >
+struct Weighted {
+  static constexpr bool needs_eval_time_state = Term::needs_eval_time_state;
+  static constexpr bool needs_altitude = Term::needs_altitude;
+  static constexpr double weight = static_cast<double>(Weight::num) / Weight::den;
+
+  static double Evaluate(Motion const& motion, ObjectiveSample const& sample, ObjectiveContext const& context, size_t motion_index) {
+    return weight * Term::Evaluate(motion, sample, context, motion_index);
+  }
+};
+
+// Sums the terms left to right, so every objective adds its terms in the order they are listed
+template <typename... Terms>
+struct ObjectiveSum;
+
+template <>
+struct ObjectiveSum<> {
+  static constexpr bool needs_eval_time_state = false;
+  static constexpr bool needs_altitude = false;
+
+  static double Accumulate(double sum, Motion const& /*motion*/, ObjectiveSample const& /*sample*/, ObjectiveContext const& /*context*/, size_t /*motion_index*/) {
+    return sum;
+  }
+};
+
+template <typename Term, typename... Rest>
+struct ObjectiveSum<Term, Rest...> {
+  static constexpr bool needs_eval_time_state = Term::needs_eval_time_state || ObjectiveSum<Rest...>::needs_eval_time_state;
+  static constexpr bool needs_altitude = Term::needs_altitude || ObjectiveSum<Rest...>::needs_altitude;
+
+  static double Accumulate(double sum, Motion const& motion, ObjectiveSample const& sample, ObjectiveContext const& context, size_t motion_index) {
+    return ObjectiveSum<Rest...>::Accumulate(sum + Term::Evaluate(motion, sample, context, motion_index), motion, sample, context, motion_index);
+  }
+};
+
+template <typename... Terms>
+struct WeightedObjective {
+  typedef ObjectiveSum<Terms...> Sum;
+
+  static double EvaluateOne(Motion const& motion, ObjectiveContext const& context, size_t motion_index) {
+    ObjectiveSample sample;
+    if (Sum::needs_eval_time_state) {
+      sample.position_at_eval_time = motion.getPosition(objective_eval_time);
+      sample.velocity_at_eval_time = motion.getVelocity(objective_eval_time);
+    }
+    if (Sum::needs_altitude) {
+      sample.altitude = motion.getPosition(objective_altitude_eval_time)(2);
+    }
+    return Sum::Accumulate(0.0, motion, sample, context, motion_index);
+  }
+
+  // Objective weighted by the probability of no collision, plus the collision reward
+  static void EvaluateAll(std::vector<Motion>::const_iterator motion, size_t num_motions, ObjectiveContext const& context,
+                          const double* collision_probabilities, const double* no_collision_probabilities, double collision_reward, double* objectives) {
+    for (size_t i = 0; i < num_motions; i++, motion++) {
+      objectives[i] = EvaluateOne(*motion, context, i)*no_collision_probabilities[i] + collision_reward*collision_probabilities[i];
+    }
+  }
+};
+
+
+// Deployed configurations
+typedef WeightedObjective< Weighted<GoalProgressTerm>, Weighted<TerminalVelocityTerm> > EuclideanObjective2D;
+typedef WeightedObjective< Weighted<GoalProgressTerm>, Weighted<TerminalVelocityTerm>, Weighted<AltitudeTerm> > EuclideanObjective3D;
+typedef WeightedObjective< Weighted<DijkstraCostTerm>, Weighted<TerminalVelocityTerm> > DijkstraObjective;
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <string.h>
+#include <stdint.h>
+
+// Value published through a sequence lock.  Readers copy a consistent snapshot without taking a
+// lock and never hold up a writer; they retry in the rare case a write lands during the copy.
+// Writers are serialized with each other by a mutex that readers never touch.
+//
+// The value is copied through relaxed atomic words between the sequence loads, so a read that
+// races with a write is well defined and simply discarded.
+template <class T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value, "SeqLock values are copied bytewise");
+
+public:
+
+  SeqLock() {
+    Store(T());
+  };
+  SeqLock(SeqLock const&) = delete;
+  SeqLock& operator=(SeqLock const&) = delete;
+
+  T Load() const {
+    uint64_t buffer[NUM_WORDS];
+    while (true) {
+      uint64_t sequence_before = sequence.load(std::memory_order_acquire);
+      if (sequence_before & 1) {
+        continue;
+      }
+      for (size_t i = 0; i < NUM_WORDS; i++) {
+        buffer[i] = words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == sequence_before) {
+        break;
+      }
+    }
+    T value;
+    memcpy(&value, buffer, sizeof(T));
+    return value;
+  };
+
+  void Store(T const& value) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    Publish(value);
+  };
+
+  // Changes some fields of the current value and publishes the result as one snapshot
+  template <class Modify>
+  void Update(Modify modify) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    T value = current;
+    modify(value);
+    Publish(value);
+  };
+
+private:
+  enum { NUM_WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t) };
+
+  void Publish(T const& value) {
+    current = value;
+    uint64_t buffer[NUM_WORDS] = {};
+    memcpy(buffer, &value, sizeof(T));
+    uint64_t sequence_before = sequence.load(std::memory_order_relaxed);
+    sequence.store(sequence_before + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < NUM_WORDS; i++) {
+      words[i].store(buffer[i], std::memory_order_relaxed);
+    }
+    sequence.store(sequence_before + 2, std::memory_order_release);
+  };
+
+  std::atomic<uint64_t> sequence{0};
+  std::atomic<uint64_t> words[NUM_WORDS];
+
+  std::mutex write_mutex;
+  T current;   // writers' copy, so updates need not read back through the words
+
+};
+
+#endif
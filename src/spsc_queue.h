@@ -0,0 +1,70 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <utility>
+#include <vector>
+#include <stddef.h>
+
+// Bounded lock-free queue between exactly one producer thread and one consumer thread.  Neither
+// side ever waits: a push into a full queue fails, and the producer decides what to drop.
+template <class T>
+class SpscQueue {
+public:
+
+  // Capacity is rounded up to a power of two
+  explicit SpscQueue(size_t capacity) {
+    size_t num_slots = 1;
+    while (num_slots < capacity) {
+      num_slots *= 2;
+    }
+    slots.resize(num_slots);
+    mask = num_slots - 1;
+  };
+  SpscQueue(SpscQueue const&) = delete;
+  SpscQueue& operator=(SpscQueue const&) = delete;
+
+  size_t getCapacity() const {return slots.size();};
+
+  // Producer only
+  bool TryPush(T item) {
+    size_t tail_index = tail.load(std::memory_order_relaxed);
+    if (tail_index - head.load(std::memory_order_acquire) == slots.size()) {
+      return false;
+    }
+    slots[tail_index & mask] = std::move(item);
+    tail.store(tail_index + 1, std::memory_order_release);
+    return true;
+  };
+
+  // Consumer only
+  bool TryPop(T &item) {
+    size_t head_index = head.load(std::memory_order_relaxed);
+    if (head_index == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = std::move(slots[head_index & mask]);
+    head.store(head_index + 1, std::memory_order_release);
+    return true;
+  };
+
+  // Consumer only; empties the queue, keeping the newest item
+  bool PopLatest(T &item) {
+    bool popped = false;
+    while (TryPop(item)) {
+      popped = true;
+    }
+    return popped;
+  };
+
+private:
+  std::vector<T> slots;
+  size_t mask;
+
+  // Free-running indices on separate cache lines, so the two threads do not share one
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+
+};
+
+#endif
@@ -0,0 +1,41 @@
+#include "stage_thread.h"
+
+void StageThread::Start(std::function<void()> const& step, std::chrono::steady_clock::duration period) {
+  Stop();
+  this->step = step;
+  this->period = period;
+  stopping.store(false);
+  thread = std::thread(&StageThread::Loop, this);
+}
+
+void StageThread::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping.store(true);
+  }
+  wake_condition.notify_all();
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+// Periodic steps keep their schedule when woken steps come in between, and skip ahead rather than
+// run back to back after a step that overran
+void StageThread::Loop() {
+  std::chrono::steady_clock::time_point next_step_time = std::chrono::steady_clock::now();
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake_condition.wait_until(lock, next_step_time, [this] {return woken.load() || stopping.load();});
+    }
+    if (stopping.load()) {
+      return;
+    }
+    woken.store(false);
+    step();
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    while (next_step_time <= now) {
+      next_step_time += period;
+    }
+  }
+}
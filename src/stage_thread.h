@@ -0,0 +1,47 @@
+#ifndef STAGE_THREAD_H
+#define STAGE_THREAD_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// One stage of a pipeline on its own thread.  The step runs whenever a producer wakes the stage
+// and otherwise once per period, so a stage that is never woken runs at a fixed rate.
+class StageThread {
+public:
+
+  StageThread() {};
+  ~StageThread() {
+    Stop();
+  };
+  StageThread(StageThread const&) = delete;
+  StageThread& operator=(StageThread const&) = delete;
+
+  void Start(std::function<void()> const& step, std::chrono::steady_clock::duration period);
+  void Stop();
+
+  // Producers never take the lock, so a wakeup racing with the start of a wait can be missed; the
+  // step then runs at the end of the period instead
+  void Wake() {
+    woken.store(true);
+    wake_condition.notify_one();
+  };
+
+private:
+  void Loop();
+
+  std::thread thread;
+  std::function<void()> step;
+  std::chrono::steady_clock::duration period;
+
+  std::mutex mutex;
+  std::condition_variable wake_condition;
+  std::atomic<bool> woken{false};
+  std::atomic<bool> stopping{false};
+
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<size_t> Trace::events_per_thread{0};
+
+struct TraceEvent {
+  std::atomic<const char*> name{nullptr};
+  std::atomic<int64_t> begin_ns{0};
+  std::atomic<int64_t> end_ns{0};
+};
+
+// Written only by its own thread.  num_started is bumped before a slot is rewritten and
+// num_written after, so a dump can tell which of the slots it copied were rewritten meanwhile.
+struct ThreadTraceBuffer {
+  ThreadTraceBuffer(int thread_id, size_t capacity) : thread_id(thread_id), capacity(capacity), events(new TraceEvent[capacity]) {};
+
+  int thread_id;
+  size_t capacity;
+  std::unique_ptr<TraceEvent[]> events;
+  std::atomic<uint64_t> num_started{0};
+  std::atomic<uint64_t> num_written{0};
+};
+
+// Buffers outlive their threads so that a dump still shows threads that have exited
+static std::mutex buffers_mutex;
+static std::vector<std::unique_ptr<ThreadTraceBuffer> > buffers;
+static thread_local ThreadTraceBuffer* thread_buffer = nullptr;
+
+static int64_t Nanoseconds(std::chrono::steady_clock::time_point const& time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+void Trace::Enable(size_t events_per_thread) {
+  Trace::events_per_thread.store(events_per_thread);
+}
+
+void Trace::Record(const char* name, std::chrono::steady_clock::time_point const& begin, std::chrono::steady_clock::time_point const& end) {
+  if (thread_buffer == nullptr) {
+    size_t capacity = events_per_thread.load();
+    if (capacity == 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    buffers.emplace_back(new ThreadTraceBuffer(buffers.size() + 1, capacity));
+    thread_buffer = buffers.back().get();
+  }
+
+  uint64_t index = thread_buffer->num_started.load(std::memory_order_relaxed);
+  thread_buffer->num_started.store(index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  TraceEvent &event = thread_buffer->events[index % thread_buffer->capacity];
+  event.name.store(name, std::memory_order_relaxed);
+  event.begin_ns.store(Nanoseconds(begin), std::memory_order_relaxed);
+  event.end_ns.store(Nanoseconds(end), std::memory_order_relaxed);
+  thread_buffer->num_written.store(index + 1, std::memory_order_release);
+}
+
+bool Trace::WriteChromeTrace(std::string const& filename) {
+  std::ofstream file(filename);
+  if (!file) {
+    return false;
+  }
+
+  std::vector<ThreadTraceBuffer*> buffers_to_write;
+  {
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    for (auto const& buffer : buffers) {
+      buffers_to_write.push_back(buffer.get());
+    }
+  }
+
+  file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first_event = true;
+  struct CopiedEvent {
+    const char* name;
+    int64_t begin_ns;
+    int64_t end_ns;
+  };
+  std::vector<CopiedEvent> copied_events;
+  for (ThreadTraceBuffer* buffer : buffers_to_write) {
+    uint64_t num_written = buffer->num_written.load(std::memory_order_acquire);
+    uint64_t first_index = (num_written > buffer->capacity) ? num_written - buffer->capacity : 0;
+    copied_events.clear();
+    for (uint64_t index = first_index; index < num_written; index++) {
+      TraceEvent const& event = buffer->events[index % buffer->capacity];
+      copied_events.push_back(CopiedEvent{event.name.load(std::memory_order_relaxed), event.begin_ns.load(std::memory_order_relaxed), event.end_ns.load(std::memory_order_relaxed)});
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t num_started = buffer->num_started.load(std::memory_order_relaxed);
+    uint64_t first_intact_index = (num_started > buffer->capacity) ? num_started - buffer->capacity : 0;
+
+    for (uint64_t index = std::max(first_index, first_intact_index); index < num_written; index++) {
+      CopiedEvent const& event = copied_events[index - first_index];
+      file << (first_event ? "" : ",") << "\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+           << ",\"ts\":" << event.begin_ns/1000 << "." << event.begin_ns%1000/100
+           << ",\"dur\":" << (event.end_ns - event.begin_ns)/1000 << "." << (event.end_ns - event.begin_ns)%1000/100 << "}";
+      first_event = false;
+    }
+  }
+  file << "\n]}\n";
+  return file.good();
+}
@@ -0,0 +1,55 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+
+// Scoped spans recorded into a ring buffer per thread and written out as Chrome trace-event JSON
+// (chrome://tracing or Perfetto).  Tracing is off until Enable is called, and a span then costs
+// two clock reads and a few relaxed stores; nothing is locked except when a thread records its
+// first span.  Each thread keeps only its newest events_per_thread spans.
+class Trace {
+public:
+
+  static void Enable(size_t events_per_thread);
+  static bool IsEnabled() {
+    return events_per_thread.load(std::memory_order_relaxed) > 0;
+  };
+
+  // name must outlive the trace, e.g. a string literal
+  static void Record(const char* name, std::chrono::steady_clock::time_point const& begin, std::chrono::steady_clock::time_point const& end);
+
+  // May run while other threads record; spans overwritten during the dump are left out
+  static bool WriteChromeTrace(std::string const& filename);
+
+private:
+  static std::atomic<size_t> events_per_thread;
+
+};
+
+class TraceSpan {
+public:
+
+  explicit TraceSpan(const char* name) : name(name), enabled(Trace::IsEnabled()) {
+    if (enabled) {
+      begin = std::chrono::steady_clock::now();
+    }
+  };
+  ~TraceSpan() {
+    if (enabled) {
+      Trace::Record(name, begin, std::chrono::steady_clock::now());
+    }
+  };
+  TraceSpan(TraceSpan const&) = delete;
+  TraceSpan& operator=(TraceSpan const&) = delete;
+
+private:
+  const char* name;
+  bool enabled;
+  std::chrono::steady_clock::time_point begin;
+
+};
+
+#endif
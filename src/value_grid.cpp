@@ -1,32 +1,80 @@
 #include "value_grid.h"
 
-int ValueGrid::GetValueOfPosition(Vector3 const& position_in_world_frame) {
-	Eigen::Matrix<Scalar, 2, 1> point_in_value_grid_frame = transformIntoValueGridFrame(position_in_world_frame);
-	size_t col_index, row_index;
-	IndexInValueGrid(point_in_value_grid_frame, col_index, row_index);
+#include <math.h>
 
-	if (col_index < 0 || col_index > width || row_index < 0 || row_index > height ) {
-		std::cout << "FOUND OUT OF BOUNDS, TRYING " << col_index << ", " << row_index << std::endl;
-		return 0;
+// A message whose data does not match its size leaves the grid empty, so every lookup reads the
+// out-of-bounds value
+void ValueGrid::SetValues(std::vector<int8_t> const& data) {
+	if (data.size() != width*height) {
+		values.clear();
+		return;
 	}
+	values = data;
+}
+
+bool ValueGrid::SetValuesInRegion(size_t col_index, size_t row_index, size_t num_cols, size_t num_rows, std::vector<int8_t> const& data) {
+	if (values.empty() || col_index > width || num_cols > width - col_index || row_index > height || num_rows > height - row_index || data.size() != num_cols*num_rows) {
+		return false;
+	}
+	for (size_t row = 0; row < num_rows; row++) {
+		std::copy(data.begin() + row*num_cols, data.begin() + (row + 1)*num_cols, values.begin() + (row_index + row)*width + col_index);
+	}
+	return true;
+}
 
-	return ValueFromIndex(col_index, row_index);
+int ValueGrid::GetValueOfPosition(Vector3 const& position_in_world_frame) const {
+	if (values.empty()) {
+		return out_of_bounds_value;
+	}
+	return ValueFromGridCoordinates((position_in_world_frame(0) - cell_0_x_in_world) * inverse_resolution,
+	                                (position_in_world_frame(1) - cell_0_y_in_world) * inverse_resolution);
 }
 
-Eigen::Matrix<Scalar, 2, 1> ValueGrid::transformIntoValueGridFrame(Vector3 const& point) {
-	return Eigen::Matrix<Scalar, 2, 1>(point(0) - cell_0_x_in_world, point(1) - cell_0_y_in_world);
+double ValueGrid::GetInterpolatedValueOfPosition(Vector3 const& position_in_world_frame) const {
+	if (values.empty()) {
+		return out_of_bounds_value;
+	}
+	return InterpolatedValueFromGridCoordinates((position_in_world_frame(0) - cell_0_x_in_world) * inverse_resolution,
+	                                            (position_in_world_frame(1) - cell_0_y_in_world) * inverse_resolution);
 }
 
-void ValueGrid::IndexInValueGrid(Eigen::Matrix<Scalar, 2, 1> const& position_in_value_grid_frame, size_t& col_index, size_t& row_index) {
-	col_index = static_cast<size_t> (position_in_value_grid_frame(0) / resolution);
-	row_index = static_cast<size_t> (position_in_value_grid_frame(1) / resolution);
+void ValueGrid::GetValuesOfPositions(Eigen::Matrix<Scalar, 3, Eigen::Dynamic> const& positions_in_world_frame, Eigen::VectorXi &values_out) const {
+	size_t num_positions = positions_in_world_frame.cols();
+	if (values.empty()) {
+		values_out.setConstant(num_positions, out_of_bounds_value);
+		return;
+	}
+	values_out.resize(num_positions);
+	for (size_t i = 0; i < num_positions; i++) {
+		values_out(i) = ValueFromGridCoordinates((positions_in_world_frame(0,i) - cell_0_x_in_world) * inverse_resolution,
+		                                         (positions_in_world_frame(1,i) - cell_0_y_in_world) * inverse_resolution);
+	}
 }
 
-int ValueGrid::ValueFromIndex(size_t col_index, size_t row_index) {
-	if (values.size() == 0) {
-		std::cout << "NO VALUE GRID YET " << std::endl;
-		return 0;
+void ValueGrid::GetInterpolatedValuesOfPositions(Eigen::Matrix<Scalar, 3, Eigen::Dynamic> const& positions_in_world_frame, Eigen::VectorXd &values_out) const {
+	size_t num_positions = positions_in_world_frame.cols();
+	if (values.empty()) {
+		values_out.setConstant(num_positions, out_of_bounds_value);
+		return;
+	}
+	values_out.resize(num_positions);
+	for (size_t i = 0; i < num_positions; i++) {
+		values_out(i) = InterpolatedValueFromGridCoordinates((positions_in_world_frame(0,i) - cell_0_x_in_world) * inverse_resolution,
+		                                                     (positions_in_world_frame(1,i) - cell_0_y_in_world) * inverse_resolution);
 	}
-	return values[row_index*width + col_index];
 }
 
+// Values sit at cell centers, so the four neighbours are read at the centers around the coordinate
+// shifted by half a cell.  Neighbours outside the grid follow the out-of-bounds policy.
+double ValueGrid::InterpolatedValueFromGridCoordinates(double col_coordinate, double row_coordinate) const {
+	double col_floor = floor(col_coordinate - 0.5);
+	double row_floor = floor(row_coordinate - 0.5);
+	double col_weight = col_coordinate - 0.5 - col_floor;
+	double row_weight = row_coordinate - 0.5 - row_floor;
+	double col_center = col_floor + 0.5;
+	double row_center = row_floor + 0.5;
+
+	double bottom = (1.0 - col_weight)*ValueFromGridCoordinates(col_center, row_center) + col_weight*ValueFromGridCoordinates(col_center + 1.0, row_center);
+	double top = (1.0 - col_weight)*ValueFromGridCoordinates(col_center, row_center + 1.0) + col_weight*ValueFromGridCoordinates(col_center + 1.0, row_center + 1.0);
+	return (1.0 - row_weight)*bottom + row_weight*top;
+}
@@ -1,20 +1,30 @@
 #ifndef VALUE_GRID_H
 #define VALUE_GRID_H
 
-#include <iostream>
-#include "motion_selector_utils.h"
+#include "motion.h"
 
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
 
+// Lookups do not branch on the position: grid coordinates are clamped into the grid before the
+// read, and the out-of-bounds value is selected afterwards.
 class ValueGrid {
 public:
-	
+
+	// Positions outside the grid either read a fixed value or the nearest edge cell
+	enum OutOfBoundsPolicy { OUT_OF_BOUNDS_VALUE, OUT_OF_BOUNDS_CLAMP };
+
 	void SetResolution(float meters_per_cell) {
 		resolution = meters_per_cell;
+		inverse_resolution = 1.0 / resolution;
 	};
-	
+
 	void SetSize(size_t num_cols, size_t num_rows) {
 		width = num_cols;
 		height = num_rows;
+		max_col_coordinate = (double)width - 1.0;
+		max_row_coordinate = (double)height - 1.0;
 	};
 
 	void SetOrigin(double x_in_world, double y_in_world) {
@@ -22,26 +32,55 @@ public:
 		cell_0_y_in_world = y_in_world;
 	};
 
-	void SetValues(std::vector<int8_t> const& data) {
-		values = data;
-	}
+	void SetOutOfBoundsPolicy(OutOfBoundsPolicy policy, int out_of_bounds_value = 0) {
+		clamp_out_of_bounds = (policy == OUT_OF_BOUNDS_CLAMP);
+		this->out_of_bounds_value = out_of_bounds_value;
+	};
+
+	// Row-major, as in nav_msgs::OccupancyGrid; SetSize must be called first
+	void SetValues(std::vector<int8_t> const& data);
+	// Row-major block of num_cols by num_rows cells starting at the given cell, as in
+	// map_msgs::OccupancyGridUpdate.  Returns false, changing nothing, if it does not fit in the grid.
+	bool SetValuesInRegion(size_t col_index, size_t row_index, size_t num_cols, size_t num_rows, std::vector<int8_t> const& data);
 
-	int GetValueOfPosition(Vector3 const& position_in_world_frame);
+	size_t getWidth() const {return width;};
+	size_t getHeight() const {return height;};
+
+	int GetValueOfPosition(Vector3 const& position_in_world_frame) const;
+	// Bilinear between cell centers
+	double GetInterpolatedValueOfPosition(Vector3 const& position_in_world_frame) const;
+
+	// One value per column
+	void GetValuesOfPositions(Eigen::Matrix<Scalar, 3, Eigen::Dynamic> const& positions_in_world_frame, Eigen::VectorXi &values_out) const;
+	void GetInterpolatedValuesOfPositions(Eigen::Matrix<Scalar, 3, Eigen::Dynamic> const& positions_in_world_frame, Eigen::VectorXd &values_out) const;
 
 private:
-	Eigen::Matrix<Scalar, 2, 1> transformIntoValueGridFrame(Vector3 const& point);
-	void IndexInValueGrid(Eigen::Matrix<Scalar, 2, 1> const& position_in_value_grid_frame, size_t& x_index, size_t& y_index);
-	int ValueFromIndex(size_t x_index, size_t y_index);
+	// Comparisons are ordered so a NaN coordinate clamps to cell 0 and reads as out of bounds
+	int ValueFromGridCoordinates(double col_coordinate, double row_coordinate) const {
+		bool inside = (col_coordinate >= 0.0) & (col_coordinate < max_col_coordinate + 1.0) & (row_coordinate >= 0.0) & (row_coordinate < max_row_coordinate + 1.0);
+		int col_index = std::min(max_col_coordinate, std::max(0.0, col_coordinate));
+		int row_index = std::min(max_row_coordinate, std::max(0.0, row_coordinate));
+		int value = values[row_index*width + col_index];
+		return (inside | clamp_out_of_bounds) ? value : out_of_bounds_value;
+	};
+
+	double InterpolatedValueFromGridCoordinates(double col_coordinate, double row_coordinate) const;
+
+	float resolution = 1.0;
+	double inverse_resolution = 1.0;
+	size_t width = 0;
+	size_t height = 0;
+	double max_col_coordinate = -1.0;
+	double max_row_coordinate = -1.0;
 
-	float resolution;
-	size_t width;
-	size_t height;
+	double cell_0_x_in_world = 0.0;
+	double cell_0_y_in_world = 0.0;
 
-	double cell_0_x_in_world;
-	double cell_0_y_in_world;
+	bool clamp_out_of_bounds = false;
+	int out_of_bounds_value = 0;
 
 	std::vector<int8_t> values;
 
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,5 +1,66 @@
 #include "value_grid_evaluator.h"
 
-ValueGrid* ValueGridEvaluator::GetValueGridPtr() {
-	return &value_grid;
-};
\ No newline at end of file
+ValueGridEvaluator::ValueGridEvaluator()
+	: front_grid(std::make_shared<ValueGrid>()), value_volume(std::make_shared<ValueVolume>()), back_grid(std::make_shared<ValueGrid>()) {
+}
+
+std::shared_ptr<ValueGrid const> ValueGridEvaluator::GetValueGrid() const {
+	return std::atomic_load(&front_grid);
+}
+
+std::shared_ptr<ValueVolume const> ValueGridEvaluator::GetValueVolume() const {
+	return std::atomic_load(&value_volume);
+}
+
+void ValueGridEvaluator::SetValueVolume(std::shared_ptr<ValueVolume const> const& value_volume) {
+	std::atomic_store(&this->value_volume, value_volume);
+}
+
+void ValueGridEvaluator::SetValueGrid(float resolution, size_t num_cols, size_t num_rows, double origin_x, double origin_y, std::vector<int8_t> const& data) {
+	std::lock_guard<std::mutex> lock(update_mutex);
+	PrepareBackGrid(true);
+	back_grid->SetResolution(resolution);
+	back_grid->SetSize(num_cols, num_rows);
+	back_grid->SetOrigin(origin_x, origin_y);
+	back_grid->SetValues(data);
+	PublishBackGrid();
+	back_grid_needs_full_copy = true;
+}
+
+bool ValueGridEvaluator::UpdateValueGridRegion(size_t col_index, size_t row_index, size_t num_cols, size_t num_rows, std::vector<int8_t> const& data) {
+	std::lock_guard<std::mutex> lock(update_mutex);
+	PrepareBackGrid(false);
+	if (!back_grid->SetValuesInRegion(col_index, row_index, num_cols, num_rows, data)) {
+		return false;
+	}
+	PublishBackGrid();
+	back_grid_missing_updates.push_back(RegionUpdate{col_index, row_index, num_cols, num_rows, data});
+	return true;
+}
+
+// Brings the back grid up to date with the front grid.  The back grid was the front grid until the
+// last update, so normally only that update is replayed.  A reader still holding it forces a new grid.
+void ValueGridEvaluator::PrepareBackGrid(bool will_overwrite) {
+	std::shared_ptr<ValueGrid> current_front_grid = front_grid;
+	if (back_grid.use_count() > 1) {
+		back_grid = will_overwrite ? std::make_shared<ValueGrid>() : std::make_shared<ValueGrid>(*current_front_grid);
+		num_full_grid_copies += will_overwrite ? 0 : 1;
+	}
+	else if (!will_overwrite && back_grid_needs_full_copy) {
+		*back_grid = *current_front_grid;
+		num_full_grid_copies++;
+	}
+	else if (!will_overwrite) {
+		for (auto const& update : back_grid_missing_updates) {
+			back_grid->SetValuesInRegion(update.col_index, update.row_index, update.num_cols, update.num_rows, update.data);
+		}
+	}
+	back_grid_needs_full_copy = false;
+	back_grid_missing_updates.clear();
+}
+
+void ValueGridEvaluator::PublishBackGrid() {
+	std::shared_ptr<ValueGrid> retired_grid = front_grid;
+	std::atomic_store(&front_grid, back_grid);
+	back_grid = retired_grid;
+}
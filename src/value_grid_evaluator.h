@@ -3,13 +3,53 @@
 
 #include "motion.h"
 #include "value_grid.h"
+#include "value_volume.h"
 
+#include <memory>
+#include <mutex>
+
+// Double-buffered value grid.  Updates are written into the back grid, which is then published
+// with an atomic pointer swap, so readers never wait on an update and never see a partial one.
+// Region updates are replayed into the retired grid on the next update instead of copying the
+// whole grid.
 class ValueGridEvaluator {
 public:
-	ValueGrid* GetValueGridPtr();
+	ValueGridEvaluator();
+
+	// Readers hold the returned grid while they use it; later updates leave it unchanged
+	std::shared_ptr<ValueGrid const> GetValueGrid() const;
+
+	void SetValueGrid(float resolution, size_t num_cols, size_t num_rows, double origin_x, double origin_y, std::vector<int8_t> const& data);
+	// Returns false if the region does not fit in the current grid
+	bool UpdateValueGridRegion(size_t col_index, size_t row_index, size_t num_cols, size_t num_rows, std::vector<int8_t> const& data);
+
+	size_t getNumFullGridCopies() const {return num_full_grid_copies;};
+
+	// 3D values for the 3D library, replaced as a whole; empty until a volume is set
+	std::shared_ptr<ValueVolume const> GetValueVolume() const;
+	void SetValueVolume(std::shared_ptr<ValueVolume const> const& value_volume);
 
 private:
-	ValueGrid value_grid;
+	struct RegionUpdate {
+		size_t col_index;
+		size_t row_index;
+		size_t num_cols;
+		size_t num_rows;
+		std::vector<int8_t> data;
+	};
+
+	void PrepareBackGrid(bool will_overwrite);
+	void PublishBackGrid();
+
+	// Only read and written with std::atomic_load and std::atomic_store
+	std::shared_ptr<ValueGrid> front_grid;
+	std::shared_ptr<ValueVolume const> value_volume;
+
+	std::mutex update_mutex;
+	std::shared_ptr<ValueGrid> back_grid;
+	bool back_grid_needs_full_copy = false;
+	std::vector<RegionUpdate> back_grid_missing_updates;
+	size_t num_full_grid_copies = 0;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,167 @@
+#include "value_volume.h"
+
+#include <algorithm>
+#include <math.h>
+
+void ValueVolume::SetResolution(double meters_per_voxel) {
+  resolution = meters_per_voxel;
+  inverse_resolution = 1.0 / resolution;
+  Clear();
+}
+
+void ValueVolume::Clear() {
+  block_indices.clear();
+  block_keys.clear();
+  block_values.clear();
+}
+
+// Block coordinates are offset to be non-negative and packed KEY_BITS each
+bool ValueVolume::VoxelOfPosition(Vector3 const& position_world_frame, int64_t voxel[3]) const {
+  const double max_voxel = (double)((int64_t)1 << (KEY_BITS - 1 + BLOCK_BITS));
+  for (size_t i = 0; i < 3; i++) {
+    double coordinate = floor(position_world_frame(i) * inverse_resolution);
+    if (!(coordinate >= -max_voxel && coordinate < max_voxel)) {
+      return false;
+    }
+    voxel[i] = coordinate;
+  }
+  return true;
+}
+
+bool ValueVolume::VoxelIsIndexable(int64_t const voxel[3]) {
+  const int64_t max_voxel = (int64_t)1 << (KEY_BITS - 1 + BLOCK_BITS);
+  for (size_t i = 0; i < 3; i++) {
+    if (voxel[i] < -max_voxel || voxel[i] >= max_voxel) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint64_t ValueVolume::BlockKey(int64_t const voxel[3]) {
+  const int64_t offset = (int64_t)1 << (KEY_BITS - 1);
+  const uint64_t mask = ((uint64_t)1 << KEY_BITS) - 1;
+  uint64_t key = 0;
+  for (size_t i = 0; i < 3; i++) {
+    key |= ((uint64_t)((voxel[i] >> BLOCK_BITS) + offset) & mask) << (i*KEY_BITS);
+  }
+  return key;
+}
+
+void ValueVolume::SetValueOfPosition(Vector3 const& position_world_frame, int8_t value) {
+  int64_t voxel[3];
+  if (!VoxelOfPosition(position_world_frame, voxel)) {
+    return;
+  }
+  size_t block_index = FindOrAllocateBlock(BlockKey(voxel));
+  block_values[block_index*BLOCK_VOXELS + VoxelInBlock(voxel)] = value;
+}
+
+// Walks the blocks the columns overlap and copies each voxel row's run of x values at once
+bool ValueVolume::SetValuesOfColumns(double x, double y, size_t num_cols, size_t num_rows, std::vector<int8_t> const& values, double min_z, double max_z) {
+  int64_t min_voxel[3] = {(int64_t)floor(x * inverse_resolution), (int64_t)floor(y * inverse_resolution), (int64_t)ceil(min_z * inverse_resolution - 0.5)};
+  int64_t max_voxel[3] = {min_voxel[0] + (int64_t)num_cols - 1, min_voxel[1] + (int64_t)num_rows - 1, (int64_t)ceil(max_z * inverse_resolution - 0.5) - 1};
+  if (num_cols == 0 || num_rows == 0 || max_voxel[2] < min_voxel[2]) {
+    return true;
+  }
+  if (!VoxelIsIndexable(min_voxel) || !VoxelIsIndexable(max_voxel)) {
+    return false;
+  }
+  int64_t min_block[3], max_block[3];
+  for (size_t i = 0; i < 3; i++) {
+    min_block[i] = min_voxel[i] >> BLOCK_BITS;
+    max_block[i] = max_voxel[i] >> BLOCK_BITS;
+  }
+  int64_t block_voxel[3];
+  for (block_voxel[2] = min_block[2]*BLOCK_SIZE; block_voxel[2] <= max_block[2]*BLOCK_SIZE; block_voxel[2] += BLOCK_SIZE) {
+    for (block_voxel[1] = min_block[1]*BLOCK_SIZE; block_voxel[1] <= max_block[1]*BLOCK_SIZE; block_voxel[1] += BLOCK_SIZE) {
+      for (block_voxel[0] = min_block[0]*BLOCK_SIZE; block_voxel[0] <= max_block[0]*BLOCK_SIZE; block_voxel[0] += BLOCK_SIZE) {
+        std::vector<int8_t>::iterator block_begin = block_values.begin() + FindOrAllocateBlock(BlockKey(block_voxel))*BLOCK_VOXELS;
+        int64_t begin[3], end[3];
+        for (size_t i = 0; i < 3; i++) {
+          begin[i] = std::max(min_voxel[i], block_voxel[i]);
+          end[i] = std::min(max_voxel[i], block_voxel[i] + BLOCK_MASK);
+        }
+        int64_t voxel[3] = {begin[0], begin[1], begin[2]};
+        for (voxel[2] = begin[2]; voxel[2] <= end[2]; voxel[2]++) {
+          for (voxel[1] = begin[1]; voxel[1] <= end[1]; voxel[1]++) {
+            std::vector<int8_t>::const_iterator row_begin = values.begin() + (voxel[1] - min_voxel[1])*num_cols + (begin[0] - min_voxel[0]);
+            std::copy(row_begin, row_begin + (end[0] - begin[0] + 1), block_begin + VoxelInBlock(voxel));
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+size_t ValueVolume::FindOrAllocateBlock(uint64_t key) {
+  auto block = block_indices.find(key);
+  return (block != block_indices.end()) ? block->second : AllocateBlock(key);
+}
+
+// A full volume recycles the block whose coordinates are farthest from the new one
+size_t ValueVolume::AllocateBlock(uint64_t key) {
+  const uint64_t mask = ((uint64_t)1 << KEY_BITS) - 1;
+  size_t block_index = block_keys.size();
+  if (max_num_blocks > 0 && block_keys.size() >= max_num_blocks) {
+    int64_t farthest_squared_distance = -1;
+    for (size_t i = 0; i < block_keys.size(); i++) {
+      int64_t squared_distance = 0;
+      for (size_t axis = 0; axis < 3; axis++) {
+        int64_t difference = (int64_t)((block_keys[i] >> (axis*KEY_BITS)) & mask) - (int64_t)((key >> (axis*KEY_BITS)) & mask);
+        squared_distance += difference*difference;
+      }
+      if (squared_distance > farthest_squared_distance) {
+        farthest_squared_distance = squared_distance;
+        block_index = i;
+      }
+    }
+    block_indices.erase(block_keys[block_index]);
+    block_keys[block_index] = key;
+    std::fill(block_values.begin() + block_index*BLOCK_VOXELS, block_values.begin() + (block_index + 1)*BLOCK_VOXELS, 0);
+  }
+  else {
+    block_keys.push_back(key);
+    block_values.resize(block_values.size() + BLOCK_VOXELS, 0);
+  }
+  block_indices[key] = block_index;
+  return block_index;
+}
+
+int ValueVolume::GetValueOfPosition(Vector3 const& position_world_frame) const {
+  int64_t voxel[3];
+  if (!VoxelOfPosition(position_world_frame, voxel)) {
+    return 0;
+  }
+  auto block = block_indices.find(BlockKey(voxel));
+  if (block == block_indices.end()) {
+    return 0;
+  }
+  return block_values[block->second*BLOCK_VOXELS + VoxelInBlock(voxel)];
+}
+
+// Consecutive samples of a motion mostly fall in the same block, so the last block found is tried
+// before hashing
+void ValueVolume::GetValuesOfPositions(Eigen::Matrix<Scalar, 3, Eigen::Dynamic> const& positions_in_world_frame, Eigen::VectorXi &values_out) const {
+  size_t num_positions = positions_in_world_frame.cols();
+  values_out.setZero(num_positions);
+  uint64_t last_key = 0;
+  int64_t last_block_index = -1;
+  for (size_t i = 0; i < num_positions; i++) {
+    int64_t voxel[3];
+    if (!VoxelOfPosition(positions_in_world_frame.col(i), voxel)) {
+      continue;
+    }
+    uint64_t key = BlockKey(voxel);
+    if (last_block_index < 0 || key != last_key) {
+      auto block = block_indices.find(key);
+      last_key = key;
+      last_block_index = (block != block_indices.end()) ? (int64_t)block->second : -1;
+      if (last_block_index < 0) {
+        continue;
+      }
+    }
+    values_out(i) = block_values[last_block_index*BLOCK_VOXELS + VoxelInBlock(voxel)];
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef VALUE_VOLUME_H
+#define VALUE_VOLUME_H
+
+#include "motion.h"
+
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+// Sparse 3D counterpart of ValueGrid, for scoring the 3D library.  Space is split into 8x8x8 voxel
+// blocks that are allocated on first write and found through a hash of their block coordinates, so
+// memory follows the written volume rather than its bounding box.  Unwritten voxels read as 0,
+// like positions outside a ValueGrid.
+class ValueVolume {
+public:
+
+  // Clears the volume
+  void SetResolution(double meters_per_voxel);
+  // Writing a new block when this many exist recycles the block farthest from it
+  void SetMaxNumBlocks(size_t max_num_blocks) {
+    this->max_num_blocks = max_num_blocks;
+  };
+  void Clear();
+
+  // Positions too far from the origin to index are ignored
+  void SetValueOfPosition(Vector3 const& position_world_frame, int8_t value);
+  // Writes num_cols by num_rows row-major values, one per column of voxels starting at the column
+  // holding (x, y), into the voxels whose centers lie in [min_z, max_z).  Each block is looked up
+  // once.  Returns false, writing nothing, if the columns reach too far from the origin to index.
+  bool SetValuesOfColumns(double x, double y, size_t num_cols, size_t num_rows, std::vector<int8_t> const& values, double min_z, double max_z);
+
+  int GetValueOfPosition(Vector3 const& position_world_frame) const;
+  // One value per column, same layout as ValueGrid::GetValuesOfPositions
+  void GetValuesOfPositions(Eigen::Matrix<Scalar, 3, Eigen::Dynamic> const& positions_in_world_frame, Eigen::VectorXi &values_out) const;
+
+  double getResolution() const {return resolution;};
+  size_t getNumBlocks() const {return block_keys.size();};
+
+private:
+  enum { BLOCK_BITS = 3, BLOCK_SIZE = 1 << BLOCK_BITS, BLOCK_MASK = BLOCK_SIZE - 1, BLOCK_VOXELS = BLOCK_SIZE*BLOCK_SIZE*BLOCK_SIZE };
+  enum { KEY_BITS = 21 };
+
+  bool VoxelOfPosition(Vector3 const& position_world_frame, int64_t voxel[3]) const;
+  static bool VoxelIsIndexable(int64_t const voxel[3]);
+  static uint64_t BlockKey(int64_t const voxel[3]);
+  static size_t VoxelInBlock(int64_t const voxel[3]) {
+    return ((voxel[2] & BLOCK_MASK) << (2*BLOCK_BITS)) | ((voxel[1] & BLOCK_MASK) << BLOCK_BITS) | (voxel[0] & BLOCK_MASK);
+  };
+  size_t FindOrAllocateBlock(uint64_t key);
+  size_t AllocateBlock(uint64_t key);
+
+  double resolution = 0.2;
+  double inverse_resolution = 5.0;
+  size_t max_num_blocks = 1 << 14;
+
+  std::unordered_map<uint64_t, uint32_t> block_indices;
+  std::vector<uint64_t> block_keys;
+  std::vector<int8_t> block_values;   // BLOCK_VOXELS per block, x fastest
+
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "worker_pool.h"
+
+WorkerPool::WorkerPool(size_t num_threads) {
+  for (size_t thread_index = 1; thread_index < num_threads; thread_index++) {
+    workers.push_back(std::thread(&WorkerPool::WorkerLoop, this, thread_index));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  start_condition.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void WorkerPool::Run(std::function<void(size_t)> const& task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    current_task = &task;
+    num_running = workers.size();
+    generation++;
+  }
+  start_condition.notify_all();
+  task(0);
+  std::unique_lock<std::mutex> lock(mutex);
+  done_condition.wait(lock, [this] {return num_running == 0;});
+  current_task = nullptr;
+}
+
+void WorkerPool::WorkerLoop(size_t thread_index) {
+  size_t last_generation = 0;
+  while (true) {
+    std::function<void(size_t)> const* task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      start_condition.wait(lock, [this, last_generation] {return stopping || generation != last_generation;});
+      if (stopping) {
+        return;
+      }
+      last_generation = generation;
+      task = current_task;
+    }
+    (*task)(thread_index);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      num_running--;
+    }
+    done_condition.notify_one();
+  }
+}
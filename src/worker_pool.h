@@ -0,0 +1,40 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads for short data-parallel steps.  The threads stay alive between steps, so
+// each Run costs a wakeup rather than a thread creation.
+class WorkerPool {
+public:
+
+  // num_threads includes the calling thread
+  explicit WorkerPool(size_t num_threads);
+  ~WorkerPool();
+  WorkerPool(WorkerPool const&) = delete;
+  WorkerPool& operator=(WorkerPool const&) = delete;
+
+  size_t getNumThreads() const {return workers.size() + 1;};
+
+  // Calls task(thread_index) once on every thread, index 0 on the caller, and returns when all are done
+  void Run(std::function<void(size_t)> const& task);
+
+private:
+  void WorkerLoop(size_t thread_index);
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable start_condition;
+  std::condition_variable done_condition;
+  std::function<void(size_t)> const* current_task = nullptr;
+  size_t generation = 0;
+  size_t num_running = 0;
+  bool stopping = false;
+
+};
+
+#endif
@@ -0,0 +1,794 @@
+#include "benchmark/benchmark.h"
+
+#include "motion_selector.h"
+#include "value_grid.h"
+#include "cost_to_go_grid.h"
+#include "cost_to_go_volume.h"
+
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+
+void InitializeMotionSelector(MotionSelector &motion_selector) {
+  motion_selector.InitializeLibrary(true, 1.0, 3.0, 2.5, 10.0, 7.5);
+  MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
+  motion_library_ptr->setInitialVelocity(Vector3(3.5, 0.5, 0.0));
+  motion_library_ptr->setThrust(0.6);
+  motion_library_ptr->setRollPitch(0.05, 0.2);
+  motion_library_ptr->UpdateMaxAcceleration(3.5);
+}
+
+const Vector3 carrot_body_frame(8.0, 2.0, 0.3);
+
+
+// Single motions sampled along the horizon, as the objectives and collision checks do
+static void BM_MotionGetPosition(benchmark::State& state) {
+  MotionSelector motion_selector;
+  InitializeMotionSelector(motion_selector);
+  Motion const& motion = motion_selector.GetMotionLibraryPtr()->getMotionFromIndex(1);
+  Vector3 sum = Vector3::Zero();
+  while (state.KeepRunning()) {
+    for (size_t i = 1; i <= 10; i++) {
+      sum += motion.getPosition(0.1*i);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations()*10);
+}
+BENCHMARK(BM_MotionGetPosition);
+
+static void BM_MotionGetTerminalStopPosition(benchmark::State& state) {
+  MotionSelector motion_selector;
+  InitializeMotionSelector(motion_selector);
+  Motion const& motion = motion_selector.GetMotionLibraryPtr()->getMotionFromIndex(1);
+  Vector3 sum = Vector3::Zero();
+  while (state.KeepRunning()) {
+    for (size_t i = 1; i <= 10; i++) {
+      sum += motion.getTerminalStopPosition(0.1*i);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations()*10);
+}
+BENCHMARK(BM_MotionGetTerminalStopPosition);
+
+
+// The four-pass objective sequence the composed kernels replaced: goal progress, terminal velocity
+// and altitude each loop over the library into their own .at()-checked vector, then a fourth pass
+// weights their sum.  Kept here to check the kernels against and to time them.
+struct ReferenceEuclideanObjectives {
+  std::vector<double> goal_progress_evaluations;
+  std::vector<double> terminal_velocity_evaluations;
+  std::vector<double> altitude_evaluations;
+
+  void Evaluate(std::vector<Motion> const& motions, bool use_3d_library, ObjectiveContext const& context,
+                std::vector<double> const& collision_probabilities, double collision_reward, std::vector<double> &objectives) {
+    goal_progress_evaluations.assign(motions.size(), 0.0);
+    terminal_velocity_evaluations.assign(motions.size(), 0.0);
+    altitude_evaluations.assign(motions.size(), 0.0);
+    objectives.resize(motions.size());
+
+    for (size_t i = 0; i < motions.size(); i++) {
+      Vector3 final_motion_position = motions.at(i).getTerminalStopPosition(0.5);
+      goal_progress_evaluations.at(i) = context.initial_distance_to_carrot - (final_motion_position - context.carrot_body_frame).norm();
+    }
+    for (size_t i = 0; i < motions.size(); i++) {
+      double final_motion_speed = motions.at(i).getVelocity(0.5).norm();
+      terminal_velocity_evaluations.at(i) = 0;
+      if (final_motion_speed > context.soft_top_speed) {
+        terminal_velocity_evaluations.at(i) -= 2.0*(context.soft_top_speed - final_motion_speed)*(context.soft_top_speed - final_motion_speed);
+      }
+    }
+    if (use_3d_library) {
+      double minimum_altitude = 0.7;
+      double maximum_altitude = 5.0;
+      for (size_t i = 0; i < motions.size(); i++) {
+        double final_altitude = motions.at(i).getPosition(0.1)(2);
+        altitude_evaluations.at(i) = 0;
+        altitude_evaluations.at(i) -= 0.1 * (context.nominal_altitude - final_altitude) * (context.nominal_altitude - final_altitude);
+        if (final_altitude < minimum_altitude) {
+          altitude_evaluations.at(i) -= 10.0*(final_altitude - minimum_altitude)*(final_altitude - minimum_altitude);
+        }
+        else if (final_altitude > maximum_altitude) {
+          altitude_evaluations.at(i) -= 10.0*(final_altitude - maximum_altitude)*(final_altitude - maximum_altitude);
+        }
+      }
+    }
+    for (size_t i = 0; i < motions.size(); i++) {
+      double objective = goal_progress_evaluations.at(i) + terminal_velocity_evaluations.at(i) + altitude_evaluations.at(i);
+      objectives.at(i) = objective*(1.0 - collision_probabilities.at(i)) + collision_reward*collision_probabilities.at(i);
+    }
+  }
+};
+
+const double objective_collision_reward = -10000;
+
+struct ObjectiveInputs {
+  std::vector<Motion> motions;
+  ObjectiveContext context;
+  std::vector<double> collision_probabilities;
+  std::vector<double> no_collision_probabilities;
+};
+
+// Library motions with collision probabilities spread over [0, 1)
+ObjectiveInputs MakeObjectiveInputs(bool use_3d_library) {
+  MotionSelector motion_selector;
+  motion_selector.InitializeLibrary(use_3d_library, 1.0, 3.0, 2.5, 10.0, 7.5);
+  MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
+  motion_library_ptr->setInitialVelocity(Vector3(3.5, 0.5, 0.0));
+  motion_library_ptr->setThrust(0.6);
+  motion_library_ptr->setRollPitch(0.05, 0.2);
+  motion_library_ptr->UpdateMaxAcceleration(3.5);
+
+  ObjectiveInputs inputs;
+  inputs.motions.assign(motion_library_ptr->GetMotionIteratorBegin(), motion_library_ptr->GetMotionIteratorEnd());
+  inputs.context.carrot_body_frame = carrot_body_frame;
+  inputs.context.initial_distance_to_carrot = carrot_body_frame.norm();
+  inputs.context.soft_top_speed = 3.0;
+  inputs.context.nominal_altitude = 1.5;
+  inputs.context.dijkstra_evaluations = nullptr;
+  for (size_t i = 0; i < inputs.motions.size(); i++) {
+    double collision_probability = (i % 7) / 7.0;
+    inputs.collision_probabilities.push_back(collision_probability);
+    inputs.no_collision_probabilities.push_back(1.0 - collision_probability);
+  }
+  return inputs;
+}
+
+template <typename Objective>
+void EvaluateComposedObjectives(ObjectiveInputs const& inputs, std::vector<double> &objectives) {
+  objectives.resize(inputs.motions.size());
+  Objective::EvaluateAll(inputs.motions.begin(), inputs.motions.size(), inputs.context, inputs.collision_probabilities.data(),
+                         inputs.no_collision_probabilities.data(), objective_collision_reward, objectives.data());
+}
+
+static void BM_ObjectivesEuclidReference(benchmark::State& state) {
+  ObjectiveInputs inputs = MakeObjectiveInputs(true);
+  ReferenceEuclideanObjectives reference;
+  std::vector<double> objectives;
+  while (state.KeepRunning()) {
+    reference.Evaluate(inputs.motions, true, inputs.context, inputs.collision_probabilities, objective_collision_reward, objectives);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations()*inputs.motions.size());
+}
+BENCHMARK(BM_ObjectivesEuclidReference);
+
+static void BM_ObjectivesEuclidComposed(benchmark::State& state) {
+  ObjectiveInputs inputs = MakeObjectiveInputs(true);
+  std::vector<double> objectives;
+  while (state.KeepRunning()) {
+    EvaluateComposedObjectives<EuclideanObjective3D>(inputs, objectives);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations()*inputs.motions.size());
+}
+BENCHMARK(BM_ObjectivesEuclidComposed);
+
+
+// Uniform points in the 20 m x 20 m x 4 m box in front of the vehicle, some of them NaN like the
+// invalid pixels of a depth image
+pcl::PointCloud<pcl::PointXYZ>::Ptr RandomPointCloud(size_t num_points, unsigned seed) {
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZ>);
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> x(0.0, 20.0), y(-10.0, 10.0), z(-2.0, 2.0);
+  for (size_t i = 0; i < num_points; i++) {
+    if (i % 16 == 0) {
+      float nan = std::numeric_limits<float>::quiet_NaN();
+      cloud->push_back(pcl::PointXYZ(nan, nan, nan));
+    }
+    else {
+      cloud->push_back(pcl::PointXYZ(x(generator), y(generator), z(generator)));
+    }
+  }
+  return cloud;
+}
+
+static void BM_KDTreeInitialize(benchmark::State& state) {
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud = RandomPointCloud(state.range(0), 3);
+  KDTree<double> kd_tree;
+  while (state.KeepRunning()) {
+    kd_tree.Initialize(cloud);
+  }
+  state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+BENCHMARK(BM_KDTreeInitialize)->RangeMultiplier(10)->Range(1000, 100000)->Unit(benchmark::kMicrosecond);
+
+static void BM_KDTreeSearchForNearest(benchmark::State& state) {
+  KDTree<double> kd_tree;
+  kd_tree.Initialize(RandomPointCloud(state.range(0), 3));
+  std::vector<Vector3> queries;
+  std::mt19937 generator(4);
+  std::uniform_real_distribution<double> x(0.0, 20.0), y(-10.0, 10.0), z(-2.0, 2.0);
+  for (size_t i = 0; i < 1024; i++) {
+    queries.push_back(Vector3(x(generator), y(generator), z(generator)));
+  }
+  size_t query_index = 0;
+  while (state.KeepRunning()) {
+    Vector3 const& query = queries[query_index++ % queries.size()];
+    kd_tree.SearchForNearest<1>(query(0), query(1), query(2));
+    benchmark::DoNotOptimize(kd_tree.squared_distances.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_KDTreeSearchForNearest)->RangeMultiplier(10)->Range(1000, 100000);
+
+// Both sources requested while only the depth image has points, as when no scan has arrived yet
+static void BM_MultiSourceKDTreeSearchWithEmptySource(benchmark::State& state) {
+  MultiSourceKDTree<double, 2> kd_tree;
+  kd_tree.Initialize(0, RandomPointCloud(state.range(0), 3));
+  std::vector<Vector3> queries;
+  std::mt19937 generator(4);
+  std::uniform_real_distribution<double> x(0.0, 20.0), y(-10.0, 10.0), z(-2.0, 2.0);
+  for (size_t i = 0; i < 1024; i++) {
+    queries.push_back(Vector3(x(generator), y(generator), z(generator)));
+  }
+  size_t query_index = 0;
+  while (state.KeepRunning()) {
+    Vector3 const& query = queries[query_index++ % queries.size()];
+    kd_tree.SearchForNearest(query(0), query(1), query(2), 0x3);
+    benchmark::DoNotOptimize(kd_tree.squared_distances);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MultiSourceKDTreeSearchWithEmptySource)->RangeMultiplier(10)->Range(1000, 100000);
+
+// Depth image and laser sizes as in flight: the default 80 x 60 decimated image, finer pyramid
+// levels, and a 1081 point scan.  Replacing one source rebuilds the index over both, which is the
+// price of answering both sensors with one descent; BM_KDTreeInitialize at the scan's size is what
+// a tree of its own would cost instead.
+static void MixedSourceSizes(benchmark::internal::Benchmark* benchmark) {
+  for (int num_depth_points : {1200, 4800, 19200}) {
+    benchmark->Args({num_depth_points, 1081});
+  }
+}
+
+static void BM_MultiSourceKDTreeReplaceLaserSource(benchmark::State& state) {
+  MultiSourceKDTree<double, 2> kd_tree;
+  kd_tree.Initialize(0, RandomPointCloud(state.range(0), 3));
+  pcl::PointCloud<pcl::PointXYZ>::Ptr laser_cloud = RandomPointCloud(state.range(1), 6);
+  while (state.KeepRunning()) {
+    kd_tree.Initialize(1, laser_cloud);
+  }
+}
+BENCHMARK(BM_MultiSourceKDTreeReplaceLaserSource)->Apply(MixedSourceSizes)->Unit(benchmark::kMicrosecond);
+
+std::vector<Vector3> RandomQueries() {
+  std::vector<Vector3> queries;
+  std::mt19937 generator(4);
+  std::uniform_real_distribution<double> x(0.0, 20.0), y(-10.0, 10.0), z(-2.0, 2.0);
+  for (size_t i = 0; i < 1024; i++) {
+    queries.push_back(Vector3(x(generator), y(generator), z(generator)));
+  }
+  return queries;
+}
+
+static void BM_MultiSourceKDTreeSearchBothSources(benchmark::State& state) {
+  MultiSourceKDTree<double, 2> kd_tree;
+  kd_tree.SetSource(0, RandomPointCloud(state.range(0), 3));
+  kd_tree.SetSource(1, RandomPointCloud(state.range(1), 6));
+  kd_tree.BuildIndex();
+  std::vector<Vector3> queries = RandomQueries();
+  size_t query_index = 0;
+  while (state.KeepRunning()) {
+    Vector3 const& query = queries[query_index++ % queries.size()];
+    kd_tree.SearchForNearest(query(0), query(1), query(2), 0x3);
+    benchmark::DoNotOptimize(kd_tree.squared_distances);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MultiSourceKDTreeSearchBothSources)->Apply(MixedSourceSizes);
+
+// The same nearest points from a tree per sensor
+static void BM_KDTreeSearchBothTrees(benchmark::State& state) {
+  KDTree<double> depth_image_kd_tree, laser_kd_tree;
+  depth_image_kd_tree.Initialize(RandomPointCloud(state.range(0), 3));
+  laser_kd_tree.Initialize(RandomPointCloud(state.range(1), 6));
+  std::vector<Vector3> queries = RandomQueries();
+  size_t query_index = 0;
+  while (state.KeepRunning()) {
+    Vector3 const& query = queries[query_index++ % queries.size()];
+    depth_image_kd_tree.SearchForNearest<1>(query(0), query(1), query(2));
+    laser_kd_tree.SearchForNearest<1>(query(0), query(1), query(2));
+    benchmark::DoNotOptimize(depth_image_kd_tree.squared_distances.data());
+    benchmark::DoNotOptimize(laser_kd_tree.squared_distances.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_KDTreeSearchBothTrees)->Apply(MixedSourceSizes);
+
+
+// Camera model of the node's defaults, looking along the ortho_body x axis at a random cloud
+void InitializeCollisionEvaluator(MotionSelector &motion_selector, size_t num_points) {
+  DepthImageCollisionEvaluator* depth_image_collision_ptr = motion_selector.GetDepthImageCollisionEvaluatorPtr();
+  depth_image_collision_ptr->SetCameraModel(308.57684326171875, 308.57684326171875, 154.6868438720703, 120.21442413330078, 320, 240, 4.0);
+  Matrix3 ortho_body_to_rdf;
+  ortho_body_to_rdf << 0, -1, 0,
+                       0, 0, -1,
+                       1, 0, 0;
+  depth_image_collision_ptr->UpdateRotationMatrix(ortho_body_to_rdf);
+  depth_image_collision_ptr->UpdatePointCloudPtr(RandomPointCloud(num_points, 5));
+}
+
+static void BM_ProbabilityOfCollisionOneMotion(benchmark::State& state) {
+  MotionSelector motion_selector;
+  InitializeMotionSelector(motion_selector);
+  InitializeCollisionEvaluator(motion_selector, state.range(0));
+  MotionLibrary* motion_library_ptr = motion_selector.GetMotionLibraryPtr();
+  size_t motion_index = 0;
+  double collision_probability, hokuyo_collision_probability;
+  while (state.KeepRunning()) {
+    Motion const& motion = *(motion_library_ptr->GetMotionIteratorBegin() + (motion_index++ % motion_selector.getNumMotions()));
+    motion_selector.computeProbabilityOfCollisionOneMotion(motion, collision_probability, hokuyo_collision_probability);
+    benchmark::DoNotOptimize(collision_probability);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ProbabilityOfCollisionOneMotion)->RangeMultiplier(10)->Range(1000, 100000);
+
+
+// A whole Euclidean planning cycle on 3D libraries of rings of 4 to 64 motions, against 10k points
+static void BM_ComputeBestEuclideanMotion(benchmark::State& state) {
+  MotionSelector motion_selector;
+  motion_selector.GetMotionLibraryPtr()->SetAccelerationGrid({1.0, 0.6, 0.15}, {-2.0, -0.75, 0.75, 2.0}, state.range(0));
+  InitializeMotionSelector(motion_selector);
+  InitializeCollisionEvaluator(motion_selector, 10000);
+  size_t best_traj_index;
+  Vector3 desired_acceleration;
+  while (state.KeepRunning()) {
+    motion_selector.computeBestEuclideanMotion(carrot_body_frame, best_traj_index, desired_acceleration);
+    benchmark::DoNotOptimize(desired_acceleration);
+  }
+  state.counters["motions"] = motion_selector.getNumMotions();
+  state.SetItemsProcessed(state.iterations()*motion_selector.getNumMotions());
+}
+BENCHMARK(BM_ComputeBestEuclideanMotion)->RangeMultiplier(2)->Range(4, 64)->Unit(benchmark::kMicrosecond);
+
+
+// A 100 m square grid at 0.1 m, read along random motion-like paths.  The reference is the
+// branching per-position lookup ValueGrid used before, with its bounds check corrected.
+const size_t value_grid_size = 1000;
+const float value_grid_resolution = 0.1;
+
+struct ReferenceValueGrid {
+  int GetValueOfPosition(Vector3 const& position) const {
+    int col_index = floor(position(0) / value_grid_resolution);
+    int row_index = floor(position(1) / value_grid_resolution);
+    if (col_index < 0 || col_index >= (int)value_grid_size || row_index < 0 || row_index >= (int)value_grid_size) {
+      return 0;
+    }
+    return values[row_index*value_grid_size + col_index];
+  }
+  std::vector<int8_t> values;
+};
+
+std::vector<int8_t> ValueGridData() {
+  std::vector<int8_t> data(value_grid_size*value_grid_size);
+  std::mt19937 generator(0);
+  std::uniform_int_distribution<int> value(1, 100);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = value(generator);
+  }
+  return data;
+}
+
+// 64 paths of 64 samples each, starting anywhere and stepping about a cell per sample
+Eigen::Matrix<Scalar, 3, Eigen::Dynamic> ValueGridQueryPositions() {
+  const size_t num_paths = 64;
+  const size_t samples_per_path = 64;
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic> positions(3, num_paths*samples_per_path);
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<double> start(-1.0, value_grid_size*value_grid_resolution + 1.0);
+  std::uniform_real_distribution<double> heading(-M_PI, M_PI);
+  for (size_t path = 0; path < num_paths; path++) {
+    Vector3 position(start(generator), start(generator), 0.0);
+    double angle = heading(generator);
+    for (size_t sample = 0; sample < samples_per_path; sample++) {
+      positions.col(path*samples_per_path + sample) = position;
+      angle += 0.05*heading(generator);
+      position += value_grid_resolution*Vector3(cos(angle), sin(angle), 0.0);
+    }
+  }
+  return positions;
+}
+
+void InitializeValueGrid(ValueGrid &value_grid) {
+  value_grid.SetResolution(value_grid_resolution);
+  value_grid.SetSize(value_grid_size, value_grid_size);
+  value_grid.SetOrigin(0.0, 0.0);
+  value_grid.SetValues(ValueGridData());
+}
+
+static void BM_ValueGridReferenceLookup(benchmark::State& state) {
+  ReferenceValueGrid value_grid;
+  value_grid.values = ValueGridData();
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic> positions = ValueGridQueryPositions();
+  Eigen::VectorXi values(positions.cols());
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < (size_t)positions.cols(); i++) {
+      values(i) = value_grid.GetValueOfPosition(positions.col(i));
+    }
+    benchmark::DoNotOptimize(values.data());
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_ValueGridReferenceLookup);
+
+static void BM_ValueGridLookup(benchmark::State& state) {
+  ValueGrid value_grid;
+  InitializeValueGrid(value_grid);
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic> positions = ValueGridQueryPositions();
+  Eigen::VectorXi values(positions.cols());
+  while (state.KeepRunning()) {
+    for (size_t i = 0; i < (size_t)positions.cols(); i++) {
+      values(i) = value_grid.GetValueOfPosition(positions.col(i));
+    }
+    benchmark::DoNotOptimize(values.data());
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_ValueGridLookup);
+
+static void BM_ValueGridBatchLookup(benchmark::State& state) {
+  ValueGrid value_grid;
+  InitializeValueGrid(value_grid);
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic> positions = ValueGridQueryPositions();
+  Eigen::VectorXi values;
+  while (state.KeepRunning()) {
+    value_grid.GetValuesOfPositions(positions, values);
+    benchmark::DoNotOptimize(values.data());
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_ValueGridBatchLookup);
+
+static void BM_ValueGridBatchInterpolatedLookup(benchmark::State& state) {
+  ValueGrid value_grid;
+  InitializeValueGrid(value_grid);
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic> positions = ValueGridQueryPositions();
+  Eigen::VectorXd values;
+  while (state.KeepRunning()) {
+    value_grid.GetInterpolatedValuesOfPositions(positions, values);
+    benchmark::DoNotOptimize(values.data());
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_ValueGridBatchInterpolatedLookup);
+
+// The same grid written into a value volume 0.8 m deep, read along the same paths
+static void BM_ValueVolumeBatchLookup(benchmark::State& state) {
+  ValueVolume value_volume;
+  value_volume.SetResolution(value_grid_resolution);
+  value_volume.SetMaxNumBlocks(0);
+  value_volume.SetValuesOfColumns(0.5*value_grid_resolution, 0.5*value_grid_resolution, value_grid_size, value_grid_size, ValueGridData(), 0.0, 0.8);
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic> positions = ValueGridQueryPositions();
+  Eigen::VectorXi values;
+  while (state.KeepRunning()) {
+    value_volume.GetValuesOfPositions(positions, values);
+    benchmark::DoNotOptimize(values.data());
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_ValueVolumeBatchLookup);
+
+
+// Rebuilding the onboard cost-to-go field after a goal change, on square grids at 0.2 m with a
+// straight 5 m wall per 10 cells of side length.  Threads 0 is the serial incremental rebuild.
+const double cost_to_go_resolution = 0.2;
+
+std::vector<Eigen::Matrix<Scalar, 3, Eigen::Dynamic> > CostToGoWalls(size_t grid_size) {
+  std::vector<Eigen::Matrix<Scalar, 3, Eigen::Dynamic> > walls;
+  std::mt19937 generator(2);
+  std::uniform_real_distribution<double> start(0.0, grid_size*cost_to_go_resolution);
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic> wall(3, 50);
+  for (size_t i = 0; i < grid_size/10; i++) {
+    Vector3 wall_start(start(generator), start(generator), 0.0);
+    Vector3 wall_direction = (generator() % 2) ? Vector3(0.1, 0.0, 0.0) : Vector3(0.0, 0.1, 0.0);
+    for (size_t j = 0; j < 50; j++) {
+      wall.col(j) = wall_start + j*wall_direction;
+    }
+    walls.push_back(wall);
+  }
+  return walls;
+}
+
+void InitializeCostToGoGrid(CostToGoGrid &cost_to_go_grid, size_t grid_size, size_t num_threads) {
+  cost_to_go_grid.SetGrid(cost_to_go_resolution, grid_size, grid_size, 0.0, 0.0);
+  cost_to_go_grid.SetRebuildThreads(num_threads);
+  for (auto const& wall : CostToGoWalls(grid_size)) {
+    cost_to_go_grid.AddObstaclePoints(wall);
+  }
+}
+
+static void BM_CostToGoRebuild(benchmark::State& state) {
+  size_t grid_size = state.range(0);
+  CostToGoGrid cost_to_go_grid;
+  InitializeCostToGoGrid(cost_to_go_grid, grid_size, state.range(1));
+  double side = grid_size*cost_to_go_resolution;
+  Vector3 goals[2] = {Vector3(0.5*side, 0.6*side, 0.0), Vector3(0.2*side, 0.3*side, 0.0)};
+  size_t goal_index = 0;
+  while (state.KeepRunning()) {
+    cost_to_go_grid.SetGoal(goals[goal_index]);
+    cost_to_go_grid.ComputeCostToGo();
+    goal_index = 1 - goal_index;
+  }
+  state.SetItemsProcessed(state.iterations()*grid_size*grid_size);
+}
+static void CostToGoRebuildArguments(benchmark::internal::Benchmark* benchmark) {
+  for (int grid_size : {250, 500, 1000, 2000}) {
+    for (int num_threads : {0, 1, 2, 4, 8}) {
+      benchmark->Args({grid_size, num_threads});
+    }
+  }
+}
+BENCHMARK(BM_CostToGoRebuild)->Apply(CostToGoRebuildArguments)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Every publish of the layered field copies the whole volume for the planner; five 0.6 m layers
+// over the node's default 500 cell square
+static void BM_CostToGoVolumeCopy(benchmark::State& state) {
+  const size_t grid_size = 500;
+  CostToGoVolume cost_to_go_volume;
+  cost_to_go_volume.SetLayers(cost_to_go_resolution, grid_size, grid_size, 0.0, 0.0, 0.0, 0.6, 5);
+  cost_to_go_volume.SetGoal(Vector3(50.0, 60.0, 0.0));
+  cost_to_go_volume.ComputeCostToGo();
+  ValueGridEvaluator value_grid_evaluator;
+  cost_to_go_volume.PublishValues(value_grid_evaluator);
+  while (state.KeepRunning()) {
+    std::shared_ptr<ValueVolume const> copy = std::make_shared<ValueVolume const>(cost_to_go_volume.getValueVolume());
+    benchmark::DoNotOptimize(copy.get());
+  }
+  state.counters["blocks"] = cost_to_go_volume.getValueVolume().getNumBlocks();
+}
+BENCHMARK(BM_CostToGoVolumeCopy)->Unit(benchmark::kMillisecond);
+
+
+// The composed objectives must reproduce the four-pass sequence exactly, with and without altitude
+template <typename Objective>
+bool ObjectivesMatchReference(bool use_3d_library, std::string const& name) {
+  ObjectiveInputs inputs = MakeObjectiveInputs(use_3d_library);
+  ReferenceEuclideanObjectives reference;
+  std::vector<double> expected, objectives;
+  reference.Evaluate(inputs.motions, use_3d_library, inputs.context, inputs.collision_probabilities, objective_collision_reward, expected);
+  EvaluateComposedObjectives<Objective>(inputs, objectives);
+  for (size_t i = 0; i < expected.size(); i++) {
+    if (objectives[i] != expected[i]) {
+      std::cout << name << " objective of motion " << i << " is " << objectives[i] << ", expected " << expected[i] << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Branch-free lookups must read the same values, including the zeros returned just outside the grid
+bool ValueGridMatchesReference() {
+  ReferenceValueGrid reference_value_grid;
+  reference_value_grid.values = ValueGridData();
+  ValueGrid value_grid;
+  InitializeValueGrid(value_grid);
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic> positions = ValueGridQueryPositions();
+  Eigen::VectorXi values;
+  value_grid.GetValuesOfPositions(positions, values);
+  for (size_t i = 0; i < (size_t)positions.cols(); i++) {
+    int expected = reference_value_grid.GetValueOfPosition(positions.col(i));
+    if (values(i) != expected || value_grid.GetValueOfPosition(positions.col(i)) != expected) {
+      std::cout << "Value grid read " << values(i) << " at sample " << i << ", expected " << expected << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+
+bool CostToGoMatches(CostToGoGrid const& expected, CostToGoGrid const& actual, size_t grid_size, std::string const& name) {
+  for (size_t row = 0; row < grid_size; row++) {
+    for (size_t col = 0; col < grid_size; col++) {
+      Vector3 position((col + 0.5)*cost_to_go_resolution, (row + 0.5)*cost_to_go_resolution, 0.0);
+      if (expected.getCostToGo(position) != actual.getCostToGo(position)) {
+        std::cout << name << " cost-to-go at cell " << col << ", " << row << " is " << actual.getCostToGo(position)
+                  << ", expected " << expected.getCostToGo(position) << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// The parallel rebuild must reach exactly the serial field
+bool ParallelCostToGoMatchesSerial() {
+  const size_t grid_size = 250;
+  CostToGoGrid serial, parallel;
+  InitializeCostToGoGrid(serial, grid_size, 0);
+  InitializeCostToGoGrid(parallel, grid_size, 4);
+  Vector3 goal(20.0, 30.0, 0.0);
+  serial.SetGoal(goal);
+  serial.ComputeCostToGo();
+  parallel.SetGoal(goal);
+  parallel.ComputeCostToGo();
+  return CostToGoMatches(serial, parallel, grid_size, "Parallel");
+}
+
+// Repairs must end at the field solved from scratch, whether walls arrive one per full repair,
+// repairs stop at a cell budget, or walls and goal moves land between budgeted repairs
+bool IncrementalCostToGoMatchesFromScratch() {
+  const size_t grid_size = 250;
+  const size_t max_cells_expanded = 500;
+  Vector3 goal(20.0, 30.0, 0.0);
+  Vector3 other_goal(40.0, 10.0, 0.0);
+  std::vector<Eigen::Matrix<Scalar, 3, Eigen::Dynamic> > walls = CostToGoWalls(grid_size);
+
+  CostToGoGrid from_scratch;
+  InitializeCostToGoGrid(from_scratch, grid_size, 0);
+  from_scratch.SetGoal(goal);
+  from_scratch.ComputeCostToGo();
+
+  CostToGoGrid incremental;
+  incremental.SetGrid(cost_to_go_resolution, grid_size, grid_size, 0.0, 0.0);
+  incremental.SetGoal(goal);
+  incremental.ComputeCostToGo();
+  for (auto const& wall : walls) {
+    incremental.AddObstaclePoints(wall);
+    incremental.ComputeCostToGo();
+  }
+
+  CostToGoGrid budgeted;
+  InitializeCostToGoGrid(budgeted, grid_size, 0);
+  budgeted.SetGoal(goal);
+  do {
+    budgeted.ComputeCostToGo(max_cells_expanded);
+  } while (!budgeted.IsComplete());
+
+  CostToGoGrid interleaved;
+  interleaved.SetGrid(cost_to_go_resolution, grid_size, grid_size, 0.0, 0.0);
+  interleaved.SetRebuildThreads(4);
+  interleaved.SetGoal(other_goal);
+  for (size_t i = 0; i < walls.size(); i++) {
+    if (i == walls.size()/2) {
+      interleaved.SetGoal(goal);
+    }
+    interleaved.AddObstaclePoints(walls[i]);
+    interleaved.ComputeCostToGo(max_cells_expanded);
+  }
+  do {
+    interleaved.ComputeCostToGo(max_cells_expanded);
+  } while (!interleaved.IsComplete());
+
+  return CostToGoMatches(from_scratch, incremental, grid_size, "Incremental") &&
+         CostToGoMatches(from_scratch, budgeted, grid_size, "Budgeted") &&
+         CostToGoMatches(from_scratch, interleaved, grid_size, "Interleaved");
+}
+
+
+// Each layer of the volume must read as the planar field built from only that layer's walls, both
+// after the first full publish and after a wall lands in one layer.  Above the top layer reads 0.
+// Samples keep clear of cell borders, where ValueGrid's float resolution may pick the neighbor, and
+// of the voxels a layer border cuts through, which belong to only one of the two layers.
+bool ValueVolumeMatchesLayers() {
+  const size_t grid_size = 250;
+  const size_t num_layers = 3;
+  const double lowest_altitude = 1.0;
+  const double layer_spacing = 0.6;
+  Vector3 goal(20.0, 30.0, 0.0);
+  std::vector<Eigen::Matrix<Scalar, 3, Eigen::Dynamic> > walls = CostToGoWalls(grid_size);
+  for (size_t i = 0; i < walls.size(); i++) {
+    walls[i].row(2).setConstant(lowest_altitude + (i % num_layers)*layer_spacing);
+  }
+
+  CostToGoVolume cost_to_go_volume;
+  cost_to_go_volume.SetLayers(cost_to_go_resolution, grid_size, grid_size, 0.0, 0.0, lowest_altitude, layer_spacing, num_layers);
+  ValueGridEvaluator volume_evaluator;
+  std::vector<CostToGoGrid> layers(num_layers);
+  std::vector<ValueGridEvaluator> layer_evaluators(num_layers);
+  for (size_t layer = 0; layer < num_layers; layer++) {
+    layers[layer].SetGrid(cost_to_go_resolution, grid_size, grid_size, 0.0, 0.0);
+  }
+  for (size_t i = 0; i < walls.size(); i++) {
+    cost_to_go_volume.AddObstaclePoints(walls[i]);
+    layers[i % num_layers].AddObstaclePoints(walls[i]);
+  }
+
+  std::mt19937 generator(3);
+  std::uniform_int_distribution<size_t> cell(0, grid_size - 1);
+  std::uniform_real_distribution<double> in_cell(0.05, 0.95);
+  std::uniform_real_distribution<double> vertical(-0.5*layer_spacing + cost_to_go_resolution, 0.5*layer_spacing - cost_to_go_resolution);
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic> positions(3, 4096);
+  for (size_t step = 0; step < 2; step++) {
+    if (step == 1) {
+      cost_to_go_volume.AddObstaclePoints(walls[0]);
+      layers[0].AddObstaclePoints(walls[0]);
+      Eigen::Matrix<Scalar, 3, Eigen::Dynamic> wall = walls[1];
+      wall.row(2).setConstant(lowest_altitude);
+      cost_to_go_volume.AddObstaclePoints(wall);
+      layers[0].AddObstaclePoints(wall);
+    }
+    cost_to_go_volume.SetGoal(goal);
+    cost_to_go_volume.ComputeCostToGo();
+    cost_to_go_volume.PublishValues(volume_evaluator);
+    std::shared_ptr<ValueVolume const> value_volume = volume_evaluator.GetValueVolume();
+    for (size_t layer = 0; layer < num_layers; layer++) {
+      layers[layer].SetGoal(goal);
+      layers[layer].ComputeCostToGo();
+      layers[layer].PublishValues(layer_evaluators[layer]);
+      for (size_t i = 0; i < (size_t)positions.cols(); i++) {
+        positions.col(i) << (cell(generator) + in_cell(generator))*cost_to_go_resolution, (cell(generator) + in_cell(generator))*cost_to_go_resolution,
+                            lowest_altitude + layer*layer_spacing + vertical(generator);
+      }
+      Eigen::VectorXi expected, values;
+      layer_evaluators[layer].GetValueGrid()->GetValuesOfPositions(positions, expected);
+      value_volume->GetValuesOfPositions(positions, values);
+      for (size_t i = 0; i < (size_t)positions.cols(); i++) {
+        if (values(i) != expected(i) || value_volume->GetValueOfPosition(positions.col(i)) != expected(i)) {
+          std::cout << "Value volume read " << values(i) << " in layer " << layer << " at sample " << i << " after publish " << step
+                    << ", expected " << expected(i) << std::endl;
+          return false;
+        }
+      }
+    }
+    Vector3 above(goal(0) + 5.0, goal(1), lowest_altitude + num_layers*layer_spacing);
+    if (value_volume->GetValueOfPosition(above) != 0) {
+      std::cout << "Value volume read " << value_volume->GetValueOfPosition(above) << " above the top layer" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+
+// A planar laser must see the same nearest points as a full 3D search, including the ground
+// returns the projection keeps below the plane.  Queries are at the table's cell centers, where
+// it is exact.
+bool PlanarLaserMatchesKDTree() {
+  pcl::PointCloud<pcl::PointXYZ>::Ptr scan(new pcl::PointCloud<pcl::PointXYZ>);
+  std::mt19937 generator(6);
+  std::uniform_int_distribution<int> cell(-110, 109);
+  for (size_t i = 0; i < 1080; i++) {
+    float z = (i % 3 == 0) ? -0.8f : 0.0f;
+    scan->push_back(pcl::PointXYZ((cell(generator) + 0.5f)*0.1f, (cell(generator) + 0.5f)*0.1f, z));
+  }
+  DepthImageCollisionEvaluator planar, reference;
+  planar.SetPlanarLaser(true);
+  planar.UpdateLaserPointCloudPtr(scan);
+  reference.UpdateLaserPointCloudPtr(scan);
+  Vector3 sigma(0.5, 0.5, 0.5);
+  for (int row = -80; row < 80; row++) {
+    for (int col = -80; col < 80; col++) {
+      Vector3 position((col + 0.5)*0.1, (row + 0.5)*0.1, 0.0);
+      double expected = reference.computeProbabilityOfCollisionNPositionsKDTree_Laser(position, sigma);
+      double laser, depth_image;
+      planar.computeProbabilityOfCollisionNPositionsKDTree_LaserAndDepthImage(position, sigma, laser, depth_image);
+      if (std::abs(planar.computeProbabilityOfCollisionNPositionsKDTree_Laser(position, sigma) - expected) > 1e-12 || std::abs(laser - expected) > 1e-12) {
+        std::cout << "Planar laser probability of collision at " << position.transpose() << " is " << laser
+                  << ", expected " << expected << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+// Results also go to motion_primitives_benchmarks.json unless --benchmark_out names another file
+int main(int argc, char* argv[]) {
+  if (!ObjectivesMatchReference<EuclideanObjective2D>(false, "2D") || !ObjectivesMatchReference<EuclideanObjective3D>(true, "3D") ||
+      !ValueGridMatchesReference() || !ValueVolumeMatchesLayers() || !ParallelCostToGoMatchesSerial() ||
+      !IncrementalCostToGoMatchesFromScratch() || !PlanarLaserMatchesKDTree()) {
+    return 1;
+  }
+  std::vector<char*> arguments(argv, argv + argc);
+  bool has_out_file = false;
+  for (int i = 1; i < argc; i++) {
+    has_out_file = has_out_file || (std::string(argv[i]).find("--benchmark_out=") == 0);
+  }
+  char default_out_file[] = "--benchmark_out=motion_primitives_benchmarks.json";
+  char default_out_format[] = "--benchmark_out_format=json";
+  if (!has_out_file) {
+    arguments.push_back(default_out_file);
+    arguments.push_back(default_out_format);
+  }
+  argc = arguments.size();
+  ::benchmark::Initialize(&argc, arguments.data());
+  ::benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}